@@ -0,0 +1,66 @@
+#ifndef P2P_ALIGNED_BUFFER_HPP
+#define P2P_ALIGNED_BUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace p2p {
+
+    // O_DIRECT wants the buffer, file offset and length aligned to the device
+    // block size. 4096 covers every disk we run on.
+    constexpr size_t DIRECT_IO_ALIGN = 4096;
+
+    // Grow-only byte buffer whose storage starts on a DIRECT_IO_ALIGN boundary.
+    // Used for PIECE receive buffers so they can go to disk without a bounce copy.
+    class AlignedBuffer {
+    public:
+        AlignedBuffer() = default;
+        ~AlignedBuffer(){ release_(data_); }
+
+        AlignedBuffer(const AlignedBuffer&) = delete;
+        AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+        uint8_t* data() { return data_; }
+        const uint8_t* data() const { return data_; }
+        size_t size() const { return size_; }
+
+        // Contents are not preserved when the buffer grows.
+        void resize(size_t n){
+            if (n <= cap_) { size_ = n; return; }
+            size_t cap = (n + DIRECT_IO_ALIGN - 1) / DIRECT_IO_ALIGN * DIRECT_IO_ALIGN;
+        #if defined(_WIN32)
+            void* p = _aligned_malloc(cap, DIRECT_IO_ALIGN);
+            if (!p) throw std::bad_alloc();
+        #else
+            void* p = nullptr;
+            if (posix_memalign(&p, DIRECT_IO_ALIGN, cap) != 0) throw std::bad_alloc();
+        #endif
+            release_(data_);
+            data_ = static_cast<uint8_t*>(p);
+            cap_ = cap;
+            size_ = n;
+        }
+
+    private:
+        static void release_(void* p){
+        #if defined(_WIN32)
+            _aligned_free(p);
+        #else
+            std::free(p);
+        #endif
+        }
+
+        uint8_t* data_ = nullptr;
+        size_t size_ = 0;
+        size_t cap_ = 0;
+    };
+
+} // namespace p2p
+
+#endif // P2P_ALIGNED_BUFFER_HPP
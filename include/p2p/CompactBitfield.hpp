@@ -0,0 +1,76 @@
+#ifndef P2P_COMPACT_BITFIELD_HPP
+#define P2P_COMPACT_BITFIELD_HPP
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+
+namespace p2p {
+
+    // Bitfield for very large piece counts (roaring-style).
+    // Pieces are split into chunks of 65536; each chunk is stored as
+    // empty / full (no storage), a sorted list of runs, or a plain bitmap
+    // once it gets too fragmented. Memory stays tiny for seeders and fresh
+    // peers, and never exceeds a dense bitmap by more than a few bytes per chunk.
+    class CompactBitfield {
+    public:
+        CompactBitfield() = default;
+        explicit CompactBitfield(size_t pieces) { reset(pieces); }
+
+        // Resize to `pieces` and clear all bits.
+        void reset(size_t pieces);
+
+        [[nodiscard]] size_t pieceCount() const { return pieces_; }
+        [[nodiscard]] bool has(size_t idx) const;
+        [[nodiscard]] size_t count() const;
+
+        void set(size_t idx) { setRange(idx, idx + 1); }
+        // Set bits [begin, end). Throws std::out_of_range past pieceCount().
+        void setRange(size_t begin, size_t end);
+
+        // Calls fn(begin, end) for each maximal run of set bits, in order.
+        // Stops early if fn returns false.
+        void forEachRange(const std::function<bool(size_t, size_t)>& fn) const;
+
+        // Approximate heap usage, for diagnostics.
+        [[nodiscard]] size_t memoryBytes() const;
+
+        // Dense bitfield bytes (bit 7..0 = pieces 0..7 etc), as used by BITFIELD.
+        static CompactBitfield fromBytes(const std::vector<uint8_t>& bytes, size_t pieces);
+        [[nodiscard]] std::vector<uint8_t> toBytes() const;
+
+        // Run-length wire form used by BITFIELD_RUNS: varints alternating
+        // clear-run / set-run lengths, starting with a (possibly empty) clear run.
+        // Trailing clear pieces are implied. decodeRuns throws std::runtime_error.
+        [[nodiscard]] std::vector<uint8_t> encodeRuns() const;
+        static CompactBitfield decodeRuns(const uint8_t* data, size_t n, size_t pieces);
+
+    private:
+        static constexpr size_t CHUNK_BITS = 16;
+        static constexpr size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+        // Past this many runs a bitmap (8 KB) is smaller.
+        static constexpr size_t MAX_RUNS = CHUNK_SIZE / 32;
+
+        struct Run { uint16_t first; uint16_t last; }; // inclusive
+
+        struct Chunk {
+            enum Kind : uint8_t { EMPTY, FULL, RUNS, BITMAP };
+            Kind kind = EMPTY;
+            uint32_t count = 0;
+            std::vector<Run> runs;
+            std::vector<uint64_t> bits;
+        };
+
+        size_t pieces_ = 0;
+        std::vector<Chunk> chunks_;
+
+        size_t chunkWidth_(size_t c) const;
+        void setInChunk_(size_t c, uint32_t first, uint32_t last);
+        static void toBitmap_(Chunk& ch);
+    };
+
+} // namespace p2p
+
+#endif // P2P_COMPACT_BITFIELD_HPP
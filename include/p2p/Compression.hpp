@@ -0,0 +1,30 @@
+#ifndef P2P_COMPRESSION_HPP
+#define P2P_COMPRESSION_HPP
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace p2p {
+
+    // LZ4 block-format codec used for PIECE payloads.
+    // Uses the system liblz4 when the build found it (P2P_HAVE_LZ4),
+    // otherwise a small built-in encoder/decoder that speaks the same format.
+    namespace lz4 {
+
+        // Compress n bytes from src. Returns an empty vector if the result
+        // would not be smaller than the input (caller should send raw).
+        std::vector<uint8_t> compress(const uint8_t* src, size_t n);
+
+        // Decompress into dst. Returns true only if the block decoded cleanly
+        // and produced exactly dstSize bytes.
+        bool decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t dstSize);
+
+        // "system" or "builtin", for logging.
+        const char* backend();
+
+    } // namespace lz4
+
+} // namespace p2p
+
+#endif // P2P_COMPRESSION_HPP
@@ -4,6 +4,8 @@
 #include <string>
 #include <vector>
 #include <optional>
+#include <unordered_map>
+#include <cstdint>
 
 namespace p2p {
 
@@ -14,6 +16,38 @@ namespace p2p {
         std::string fileName;
         long long fileSizeBytes = 0;
         int pieceSizeBytes = 32768;
+        bool compressPieces = true; // offer LZ4 PIECE payloads during handshake
+        long long maxUploadRate = 0; // bytes/sec across all swarms, 0 = unlimited
+        int connectTimeoutMs = 3000;     // outbound connect timeout per address
+        int connectRetries = 10;         // -1 = retry forever
+        int connectBackoffMs = 250;      // first retry delay, doubles each time
+        int connectBackoffMaxMs = 10000;
+        int maxConnections = 128;        // across all swarms; idle peers are evicted past this
+        int idleTimeoutSec = 300;
+        int maxNeighbors = 0;            // 0 = full mesh (connect to every earlier peer)
+        int neighborRefreshSec = 30;     // partial mesh: how often to swap out a slow neighbor
+        int sendQueueKB = 4096;          // per-connection outbound PIECE backlog
+        bool directIO = false;           // write downloaded pieces with O_DIRECT
+        int workerThreads = 0;           // disk/codec pool size, 0 = one per core
+        std::string streamTo;            // stream the file in order as it arrives: "-" = stdout, or a path/FIFO
+        int streamWindow = 16;           // pieces ahead of the stream position to fetch first
+        bool superSeed = false;          // when seeding a file from the start, hand out pieces one by one
+        int erasureStripe = 16;          // pieces per Reed-Solomon stripe (stripe + parity <= 256)
+        int erasureParity = 0;           // parity pieces per stripe; 0 = no erasure coding
+        std::string deltaFrom;           // older version of the file to reuse pieces from (relative: peer dir)
+        int deltaWaitSec = 15;           // how long requests wait for a manifest; 0: until one comes
+        bool zeroPieces = true;          // seeds find all-zero pieces at startup; nobody transfers them
+        int pexIntervalSec = 60;         // peer exchange gossip period, 0 = no PEX
+        int keepAliveSec = 30;           // keep-alive after this long with nothing sent; 0: never
+        int deadPeerSec = 120;           // drop connections silent this long; 0: never
+        bool localTransport = true;      // shared memory / Unix socket instead of TCP to peers on this host
+        bool udpTransport = false;       // offer / accept UDP with LEDBAT congestion control
+        int ledbatTargetMs = 100;        // queuing delay UDP transfers aim to stay under
+        std::unordered_map<int, std::string> udpRoutes; // "UdpRoute <peerId> <host:port>": reach its UDP there
+        std::unordered_map<int, std::string> tcpRoutes; // "TcpRoute <peerId> <host:port>": dial it there
+        std::string recordTo;            // directory for wire recordings (record_<peerId>.p2prec), empty = off
+        bool recordPayloads = false;     // include PIECE data in recordings
+        int profileSampleHz = 0;         // P2P_PROFILE builds: CPU samples per second, 0 = timers only
 
         static CommonConfig fromFile(const std::string& path);
     };
@@ -27,9 +61,25 @@ namespace p2p {
 
     struct PeerInfoCfg {
         std::vector<PeerInfoRow> rows;
+        std::unordered_map<int, size_t> byId; // peerId -> index in rows; see reindex()
         static PeerInfoCfg fromFile(const std::string& path);
+        void reindex();
         [[nodiscard]] std::optional<PeerInfoRow> findById(int peerId) const;
-        [[nodiscard]] std::vector<PeerInfoRow> earlierPeers(int peerId) const; // rows with lower index in file
+        [[nodiscard]] std::vector<PeerInfoRow> earlierPeers(int peerId) const; // rows with lower index in file (all rows if not listed)
+    };
+
+    // Extra files served by the same process (optional Swarms.cfg next to Common.cfg).
+    // Line format: <swarmId> <fileName> <fileSize> <pieceSize>. Swarm 0 is Common.cfg's file.
+    struct SwarmRow {
+        uint32_t swarmId = 0;
+        std::string fileName;
+        long long fileSizeBytes = 0;
+        int pieceSizeBytes = 32768;
+    };
+
+    struct SwarmCfg {
+        std::vector<SwarmRow> rows;
+        static SwarmCfg fromFile(const std::string& path); // missing file => no extra swarms
     };
 
     struct EnvPaths {
@@ -42,10 +92,14 @@ namespace p2p {
         int selfId = 0;
         CommonConfig common;
         PeerInfoCfg peers;
+        SwarmCfg swarms;
         PeerInfoRow self;
         EnvPaths paths;
 
-        static ConfigBundle load(int selfId, const std::string& commonPath, const std::string& peersPath, const std::string& workDir);
+        // joinPort: listen port for a peer that isn't in PeerInfo.cfg. It then treats
+        // every listed peer as a bootstrap node and finds the rest through PEX.
+        static ConfigBundle load(int selfId, const std::string& commonPath, const std::string& peersPath, const std::string& workDir,
+                                 int joinPort = 0);
     };
 
 } // namespace p2p
@@ -0,0 +1,87 @@
+#ifndef P2P_CONNECTION_MANAGER_HPP
+#define P2P_CONNECTION_MANAGER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "p2p/Net.hpp"
+#include "p2p/Logger.hpp"
+
+namespace p2p {
+
+    struct ConnectionLimits {
+        size_t maxConnections = 128; // across all swarms
+        int idleTimeoutSec = 300;    // drop silent connections neither side is interested in
+    };
+
+    // Owns every ConnectionHandler (incoming and outgoing).
+    //  - adopt() takes a new connection, evicting an idle/useless one if we're at the cap
+    //  - registerPeer() is called by the handler after the handshake and rejects
+    //    duplicate connections to the same peer for the same swarm
+    //  - reap() frees handlers whose socket has closed and drops idle ones
+    class ConnectionManager {
+    public:
+        using OnLost = std::function<void(int peerId, uint32_t swarmId)>;
+
+        ConnectionManager(int selfId, Logger& logger, ConnectionLimits limits);
+        ~ConnectionManager();
+
+        // Set once at startup. reap() calls it, outside the lock, for each
+        // outgoing connection that ended without us retiring it (the remote
+        // went away, the link broke) and left us no other connection to that
+        // peer for the swarm, so it can be dialed again.
+        void setOnLost(OnLost fn);
+
+        // Starts the handler if accepted. Returns false if the connection was
+        // refused (the handler, and its socket, are destroyed).
+        bool adopt(std::unique_ptr<ConnectionHandler> h);
+
+        // Called from the handler thread once the remote peer id and swarm are known.
+        // Returns false if this connection should be dropped as a duplicate.
+        bool registerPeer(ConnectionHandler& h);
+
+        // Is there a live connection to this peer for this swarm?
+        bool connectedTo(int peerId, uint32_t swarmId) const;
+
+        // Run fn on every live handler. The list is copied under the lock and fn
+        // runs outside it, so a blocking send can't hold up the manager; the
+        // handlers stay allocated until every forEach that saw them is done.
+        void forEach(const std::function<void(ConnectionHandler&)>& fn) const;
+
+        // Destroy finished handlers and close useless ones idle past the timeout.
+        void reap();
+
+        // Close everything and wait for the handler threads.
+        void closeAll();
+
+        size_t size() const;
+
+        ConnectionManager(const ConnectionManager&) = delete;
+        ConnectionManager& operator=(const ConnectionManager&) = delete;
+
+    private:
+        int selfId_;
+        Logger& logger_;
+        ConnectionLimits limits_;
+        OnLost onLost_;
+
+        mutable std::mutex mtx_;
+        std::vector<std::unique_ptr<ConnectionHandler>> conns_;
+        std::map<std::pair<uint32_t, int>, ConnectionHandler*> byPeer_; // (swarm, peer) -> handler
+        mutable int walkers_ = 0;                 // forEach calls running outside the lock
+        mutable std::condition_variable walkersCv_;
+        std::vector<std::unique_ptr<ConnectionHandler>> graveyard_; // reaped while walkers_ > 0
+
+        ConnectionHandler* pickVictim_() const; // caller holds mtx_
+        void unregister_(ConnectionHandler* h); // caller holds mtx_
+    };
+
+} // namespace p2p
+
+#endif // P2P_CONNECTION_MANAGER_HPP
@@ -0,0 +1,99 @@
+#ifndef P2P_CONNECTOR_HPP
+#define P2P_CONNECTOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "p2p/Net.hpp"
+#include "p2p/Logger.hpp"
+
+namespace p2p {
+
+    struct ConnectOptions {
+        int timeoutMs = 3000;       // per address attempt
+        int maxRetries = 10;        // after the first try; -1 = keep trying forever
+        int backoffMs = 250;        // first retry delay, doubled each time
+        int backoffMaxMs = 10000;   // cap for the doubling
+    };
+
+    // Opens outbound connections in parallel with non-blocking connect() and a
+    // single poll loop. Unreachable hosts time out on their own schedule instead
+    // of holding up the rest, and peers that aren't up yet are retried with
+    // exponential backoff. Resolved addresses are cached per host:port; lookups
+    // run off the loop, so a slow DNS answer only holds up dials to that host.
+    class Connector {
+    public:
+        struct Target {
+            int peerId = 0;
+            Endpoint ep;
+            uint32_t swarmId = 0;
+        };
+
+        // Called on the connector thread with a connected, blocking socket.
+        // The callee owns the socket.
+        using OnConnected = std::function<void(socket_t, const Target&)>;
+
+        Connector(Logger& logger, ConnectOptions opts, OnConnected onConnected);
+        ~Connector();
+
+        void start();
+        void stop();
+
+        // Queue a target; connecting starts right away if the loop is running.
+        void add(const Target& t);
+
+        Connector(const Connector&) = delete;
+        Connector& operator=(const Connector&) = delete;
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        struct Attempt {
+            Target target;
+            int tries = 0;                 // failed rounds so far
+            clock::time_point nextAt{};    // when to start the next round
+            socket_t fd = -1;              // in-progress connect, or -1
+            clock::time_point deadline{};
+            size_t addrIdx = 0;            // which cached address we're on
+            bool done = false;
+        };
+
+        Logger& logger_;
+        ConnectOptions opts_;
+        OnConnected onConnected_;
+
+        std::thread thr_;
+        std::atomic<bool> running_{false};
+
+        std::mutex mtx_;
+        std::vector<Target> incoming_; // added but not yet picked up by the loop
+        int wake_[2] = {-1, -1};       // self-pipe to interrupt poll()
+
+        std::vector<Attempt> attempts_; // loop thread only
+
+        // host:port -> resolved addresses (loop thread only), re-resolved after RESOLVE_TTL
+        static constexpr std::chrono::seconds RESOLVE_TTL{60};
+        struct Addr { int family; int socktype; int protocol; std::vector<uint8_t> sa; };
+        struct Resolved { std::vector<Addr> addrs; clock::time_point expires; };
+        std::map<std::string, Resolved> cache_;
+        // host:port lookups still running (loop thread only); each pokes wake_ when done
+        std::map<std::string, std::future<std::vector<Addr>>> resolving_;
+
+        void run_();
+        void resolvePending_(clock::time_point now);
+        void begin_(Attempt& a);
+        void fail_(Attempt& a, const std::string& why);
+        void finish_(Attempt& a);
+        static std::string key_(const Endpoint& ep);
+    };
+
+} // namespace p2p
+
+#endif // P2P_CONNECTOR_HPP
@@ -0,0 +1,92 @@
+#ifndef P2P_DELTA_SYNC_HPP
+#define P2P_DELTA_SYNC_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "p2p/PieceManager.hpp"
+#include "p2p/Sha256.hpp"
+
+namespace p2p {
+
+    // rsync's weak checksum: a = sum of bytes, b = sum of (n - i) * byte, both
+    // mod 2^16, packed as a | b << 16. Cheap to slide one byte along a file.
+    uint32_t rollingChecksum(const uint8_t* p, size_t n);
+
+    // Checksums of every piece of a file (parity pieces aren't included).
+    struct PieceManifest {
+        uint32_t pieceSize = 0;
+        std::vector<uint32_t> weak;
+        std::vector<Sha256::Digest> strong;
+
+        // MANIFEST payload: pieceSize(4) | count(4) | count x [weak(4) | sha256(32)].
+        // count 0 means "I don't have the whole file".
+        std::vector<uint8_t> encode() const;
+        // Throws std::runtime_error if malformed.
+        static PieceManifest decode(const uint8_t* p, size_t n);
+    };
+
+    // Update mode for one swarm. A leecher with an older version of the file
+    // (DeltaFrom in Common.cfg) asks its first peers for a manifest and holds
+    // its REQUESTs until one arrives. It then slides the rolling checksum over
+    // the old copy, confirms candidates with SHA-256, and writes every piece it
+    // finds wherever it sat in the old file. Only what changed goes over the
+    // network. Every swarm has one of these so it can answer MANIFEST_REQUEST.
+    class DeltaSync : public std::enable_shared_from_this<DeltaSync> {
+    public:
+        // The MANIFEST payload, or why it couldn't be built (payload empty).
+        using ManifestReady = std::function<void(const std::vector<uint8_t>& payload, const std::string& error)>;
+
+        // oldPath empty (or missing on disk): serve manifests only.
+        DeltaSync(std::shared_ptr<PieceManager> pm, std::string oldPath = "");
+
+        // Serving: hands `done` the MANIFEST payload for our copy, right away
+        // if it's built, else from gWorkPool once it is. It's built on first
+        // use, a batch of pieces per pool task, so reading and hashing the
+        // whole file stays off the receive threads. An empty manifest until
+        // we're complete. Must be owned by a shared_ptr.
+        void manifest(ManifestReady done);
+
+        // Leeching: still waiting for a manifest.
+        bool wantManifest() const { return state_.load() == WAITING; }
+        // REQUESTs for this swarm wait while we're waiting or scanning.
+        bool holding() const { return state_.load() != DONE; }
+
+        // Scan the old copy against a received manifest. Only the first usable
+        // manifest is taken: nullopt if this one wasn't (empty, or someone
+        // else's got here first). Otherwise the pieces written from the old
+        // copy. Throws std::runtime_error on a malformed or mismatched
+        // manifest (and keeps waiting for another).
+        std::optional<std::vector<size_t>> apply(const uint8_t* p, size_t n);
+
+        // Stop waiting and fetch everything. False if we weren't waiting.
+        bool giveUp();
+
+        const std::string& oldPath() const { return oldPath_; }
+
+    private:
+        enum State { WAITING, SCANNING, DONE };
+
+        std::shared_ptr<PieceManager> pm_;
+        std::string oldPath_;
+        std::atomic<int> state_{DONE};
+
+        std::mutex mtx_; // manifest_ build
+        std::vector<uint8_t> manifest_;
+        bool building_ = false;
+        std::vector<ManifestReady> waiting_; // asked while building_
+
+        std::vector<size_t> scan_(const PieceManifest& m);
+        void buildFrom_(std::shared_ptr<PieceManifest> m, size_t from);
+        void finishBuild_(std::vector<uint8_t> payload, const std::string& error);
+    };
+
+} // namespace p2p
+
+#endif // P2P_DELTA_SYNC_HPP
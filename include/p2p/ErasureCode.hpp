@@ -0,0 +1,63 @@
+#ifndef P2P_ERASURE_CODE_HPP
+#define P2P_ERASURE_CODE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace p2p {
+
+    // GF(2^8) arithmetic (polynomial 0x11d), mostly on whole buffers. The buffer
+    // kernels use a pair of 16-entry nibble tables per constant and a byte
+    // shuffle (AVX2, SSSE3 or NEON, picked at startup), with a table-driven
+    // scalar fallback.
+    namespace gf256 {
+
+        uint8_t mul(uint8_t a, uint8_t b);
+        uint8_t inv(uint8_t a); // a != 0
+
+        // dst[i] ^= c * src[i]
+        void mulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n);
+        // dst[i] = c * src[i]
+        void mulSet(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n);
+
+        // Kernel in use: "avx2", "ssse3", "neon" or "scalar", for logging.
+        const char* backend();
+        // Kernels this CPU can run, best first. useBackend() switches to one of
+        // them (for benchmarks); false if the name isn't in the list.
+        std::vector<const char*> backends();
+        bool useBackend(const char* name);
+
+    } // namespace gf256
+
+    // Systematic Reed-Solomon over GF(256): k data blocks plus m parity blocks,
+    // and any k of the k + m rebuild the rest. Parity row j is a row of a Cauchy
+    // matrix (1 / (x_j + y_i)), so every square submatrix is invertible and a
+    // stripe with fewer than k data blocks (the end of a file) is just the first
+    // columns. Blocks are all `size` bytes; pad short ones with zeros.
+    class ReedSolomon {
+    public:
+        // Throws std::invalid_argument unless k >= 1, m >= 1 and k + m <= 256.
+        ReedSolomon(int k, int m);
+
+        int dataBlocks() const { return k_; }
+        int parityBlocks() const { return m_; }
+
+        // parity[j] for j < m from data[0..dataCount); a null parity[j] is skipped.
+        void encode(const uint8_t* const* data, int dataCount, uint8_t* const* parity, size_t size) const;
+
+        // blocks[0..dataCount) are data, blocks[dataCount..dataCount+m) parity;
+        // present[i] (nonzero) says which hold real bytes. Fills in every missing data
+        // block (parity is left alone). False if fewer than dataCount are present.
+        bool reconstruct(uint8_t* const* blocks, const uint8_t* present, int dataCount, size_t size) const;
+
+    private:
+        int k_, m_;
+        std::vector<uint8_t> coef_; // m rows of k
+
+        uint8_t coefAt_(int row, int col) const { return coef_[static_cast<size_t>(row) * k_ + col]; }
+    };
+
+} // namespace p2p
+
+#endif // P2P_ERASURE_CODE_HPP
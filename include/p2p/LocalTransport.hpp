@@ -0,0 +1,113 @@
+#ifndef P2P_LOCAL_TRANSPORT_HPP
+#define P2P_LOCAL_TRANSPORT_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "p2p/Transport.hpp"
+
+namespace p2p {
+
+    // Same-host fast path. Two peerProcess instances on one machine first talk
+    // TCP as usual; if both offered CAP_LOCAL and their host ids match, the
+    // dialing side offers its LocalListener address, the other side connects to
+    // it over a Unix socket, and both move the connection onto a shared-memory
+    // ring (or the Unix socket itself where there's no memfd/futex).
+    //
+    // Switching is per direction: each side sends TRANSPORT_SWITCH as its last
+    // message on TCP and writes everything after it to the local transport; the
+    // reader follows when it reads the marker.
+
+    // Two single-producer rings in one memfd mapping, one per direction. Waits
+    // are futexes on the shared header; the Unix socket stays open only so
+    // either side notices the other process going away.
+    class ShmTransport : public Transport {
+    public:
+        // Creator's end; *fdOut is the memfd to hand to the other side.
+        static std::unique_ptr<ShmTransport> create(socket_t sock, size_t ringBytes, int* fdOut);
+        // The other end, from the received memfd. Takes ownership of both.
+        static std::unique_ptr<ShmTransport> attach(socket_t sock, int memfd);
+        ~ShmTransport() override;
+
+        bool sendAll(const uint8_t* data, size_t n) override;
+        bool recvAll(uint8_t* data, size_t n) override;
+        int waitReadable(int timeoutMs) override;
+        void shutdown() override;
+
+        struct Ring;
+
+    private:
+        ShmTransport(socket_t sock, void* base, size_t mapLen, size_t ringBytes, bool creator);
+
+        socket_t sock_;
+        void* base_;
+        size_t mapLen_;
+        size_t cap_;
+        Ring* out_;
+        Ring* in_;
+        uint8_t* outData_;
+        uint8_t* inData_;
+
+        bool peerGone_();
+    };
+
+    // Accepts the other side's Unix-socket connects for offers we've made.
+    class LocalListener {
+    public:
+        // Called with the ready transport (listener thread).
+        using Attach = std::function<void(std::unique_ptr<Transport>)>;
+
+        ~LocalListener();
+
+        // Throws std::runtime_error if the socket can't be set up. ringBytes: per direction.
+        void start(int selfId, size_t ringBytes = 1u << 20);
+        void stop();
+        bool running() const { return running_.load(); }
+
+        // Where the other side connects (goes in LOCAL_OFFER).
+        const std::string& address() const { return addr_; }
+
+        // Register an offer; the nonce goes in LOCAL_OFFER. forget() before the
+        // callback's target goes away (waits out a callback in progress).
+        uint64_t expect(Attach fn);
+        void forget(uint64_t nonce);
+
+        // Is `address` one a LocalListener would listen on (start() above)?
+        // Anything else in an offer is refused: a peer mustn't point us at an
+        // arbitrary local socket.
+        static bool isListenerAddress(const std::string& address);
+
+        // The answering side: connect to `address` for `nonce`. Null on failure,
+        // or if it isn't a listener address.
+        static std::unique_ptr<Transport> connect(const std::string& address, uint64_t nonce);
+
+        // Same string on two processes = same machine (hostname + boot id).
+        static const std::string& hostId();
+
+    private:
+        std::atomic<bool> running_{false};
+        socket_t srv_ = -1;
+        std::string addr_;
+        size_t ringBytes_ = 0;
+        std::thread thr_;
+        std::mutex mtx_;
+        std::map<uint64_t, Attach> pending_;
+        std::mt19937_64 rng_{std::random_device{}()};
+
+        void acceptLoop_();
+        void serve_(socket_t s);
+    };
+
+    // Started by peerProcess when LocalTransport is on.
+    extern LocalListener gLocalListener;
+
+} // namespace p2p
+
+#endif // P2P_LOCAL_TRANSPORT_HPP
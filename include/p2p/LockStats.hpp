@@ -0,0 +1,64 @@
+#ifndef P2P_LOCK_STATS_HPP
+#define P2P_LOCK_STATS_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace p2p {
+
+    // A mutex that can tell us whether it's a problem. Configure with
+    // -DP2P_LOCK_STATS=ON and every ProfiledMutex records, per name: acquires,
+    // how many had to wait, total and worst wait and hold times, and the call
+    // stacks that waited most. lockStatsReport() prints them. Without the
+    // option it is a plain std::mutex and the name is thrown away.
+    //
+    // Lock it with std::lock_guard<ProfiledMutex>, or ProfiledLock where a
+    // ProfiledCondVar has to wait on it.
+
+#if defined(P2P_LOCK_STATS)
+
+    struct LockCounters;
+
+    class ProfiledMutex {
+    public:
+        // Mutexes with the same name (one per swarm, per connection, ...) are
+        // counted together. name must outlive the program (a string literal).
+        explicit ProfiledMutex(const char* name);
+        ProfiledMutex(const ProfiledMutex&) = delete;
+        ProfiledMutex& operator=(const ProfiledMutex&) = delete;
+
+        void lock();
+        bool try_lock();
+        void unlock();
+
+    private:
+        std::mutex m_;
+        LockCounters* stats_;
+        int64_t since_ = 0; // when the current holder got it (steady clock ns)
+    };
+
+    using ProfiledLock = std::unique_lock<ProfiledMutex>;
+    using ProfiledCondVar = std::condition_variable_any;
+
+#else
+
+    class ProfiledMutex : public std::mutex {
+    public:
+        constexpr explicit ProfiledMutex(const char*) noexcept {}
+    };
+
+    using ProfiledLock = std::unique_lock<std::mutex>;
+    using ProfiledCondVar = std::condition_variable;
+
+#endif
+
+    // Every named lock, most total wait first, each with its topSites most
+    // contended call sites. Says so if lock stats weren't compiled in.
+    std::string lockStatsReport(size_t topSites = 5);
+
+} // namespace p2p
+
+#endif // P2P_LOCK_STATS_HPP
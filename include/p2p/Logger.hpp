@@ -7,6 +7,8 @@
 #include <chrono>
 #include <ctime>
 
+#include "p2p/LockStats.hpp"
+
 namespace p2p {
 
     class Logger {
@@ -29,7 +31,7 @@ namespace p2p {
 
     private:
         std::ofstream out_;
-        std::mutex mtx_;
+        ProfiledMutex mtx_{"Logger::mtx_"};
         static std::string nowTs();
         void write(const std::string& level, const std::string& msg);
     };
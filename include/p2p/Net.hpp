@@ -9,41 +9,100 @@
 #include <memory>
 #include <optional>
 #include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
 
 #include "Protocol.hpp"
 #include "Logger.hpp"
 #include "p2p/PieceManager.hpp"
-
-// POSIX sockets (Linux/macOS). Windows: stubs only.
-#if defined(_WIN32)
-#include <winsock2.h>
-using socket_t = SOCKET;
-#else
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <netdb.h>
-#include <unistd.h>
-using socket_t = int;
-#endif
+#include "p2p/Swarm.hpp"
+#include "p2p/CompactBitfield.hpp"
+#include "p2p/AlignedBuffer.hpp"
+#include "p2p/Scheduler.hpp"
+#include "p2p/Transport.hpp"
+#include "p2p/UdpTransport.hpp"
+#include "p2p/Recorder.hpp"
+#include "p2p/LockStats.hpp"
 
 namespace p2p {
 
     struct Endpoint { std::string host; int port = 0; };
 
+    // Process-wide networking knobs, filled from Common.cfg in peerProcess.cpp.
+    struct NetOptions {
+        bool compressPieces = true;
+        size_t sendQueueBytes = 4u << 20; // piece bytes read for a peer but not yet sent; more REQUESTs wait
+        bool pex = true;                  // offer peer exchange
+        int listenPort = 0;               // advertised to others in PEX
+        int keepAliveSec = 30;            // send a keep-alive after this long with nothing to say; 0: never
+        int deadPeerSec = 120;            // drop a connection that's been silent this long; 0: never
+        bool localTransport = true;       // move same-host connections off TCP (LocalTransport.hpp)
+        bool udpTransport = false;        // offer / accept UDP with LEDBAT (UdpTransport.hpp)
+        std::map<int, Endpoint> udpRoutes; // reach this peer's UDP here instead (e.g. a delay proxy)
+        std::map<int, Endpoint> tcpRoutes; // dial this peer here instead and keep it on TCP (e.g. p2pfault)
+        bool zeroPieces = true;           // announce / accept all-zero pieces instead of sending them
+    };
+    extern NetOptions gNetOptions;
+
+    class ConnectionManager;
+
     class ConnectionHandler {
     public:
+        // swarmId: which file an outgoing connection is for. Incoming connections
+        // learn it from the remote's handshake.
         ConnectionHandler(int selfId, Logger& logger, socket_t sock, bool incoming,
-                      std::vector<uint8_t> selfBitfield);
+                      uint32_t swarmId = 0);
+        // Same over any byte stream (e.g. a MemoryTransport for replay).
+        ConnectionHandler(int selfId, Logger& logger, std::unique_ptr<Transport> io, bool incoming,
+                      uint32_t swarmId = 0);
         ~ConnectionHandler();
 
         void start();
         void join();
 
-        //int remotePeerId() const { return remotePeerId_; }
+        // Ask the connection to stop: unblocks the receive loop via shutdown().
+        void close();
+        // close() because this side is done with the connection (eviction, idle,
+        // a slower neighbor, a duplicate), so nobody should dial it again.
+        void retire();
+        bool retired() const { return retired_.load(); }
+
+        // True once run_() has returned (socket closed, handshake failed, ...).
+        bool finished() const { return finished_.load(); }
+
+        int remotePeerId() const { return remotePeerId_.load(); }
+        uint32_t swarmId() const { return swarmId_; }
+        bool incoming() const { return incoming_; }
+        bool amInterested() const { return amInterested_.load(); }
+        bool peerInterested() const { return peerInterested_.load(); }
+
+        // Piece payload bytes moved on this connection so far.
+        uint64_t bytesDownloaded() const { return bytesDown_.load(); }
+        uint64_t bytesUploaded() const { return bytesUp_.load(); }
+
+        // REQUESTs to this peer that ran past their deadline.
+        uint32_t requestTimeouts() const { return timeouts_.load(); }
+
+        // Last time a real message (or the handshake) arrived from the remote.
+        // Keep-alives don't count, so idle reaping still sees an idle link.
+        std::chrono::steady_clock::time_point lastActivity() const;
+
+        // Super-seeding: offer this peer its next piece (any thread). No-op unless
+        // we're super-seeding this connection's swarm.
+        void superSeedOffer();
+        // Periodic: re-offer if the peer has been holding a piece nobody fetched.
+        void superSeedTick();
+
+        // Tell the remote about peers we know (and our own listen port), if it
+        // negotiated PEX. Called right after the handshake and then periodically.
+        void sendPex();
 
-        // Send message (thread-safe)
+        // Set before start(): the manager vets the remote peer id after the handshake.
+        void setManager(ConnectionManager* mgr) { mgr_ = mgr; }
+
+        // Queue a message for the writer thread (thread-safe, never blocks).
         void send(const Message& m);
 
         // disable copy
@@ -53,30 +112,135 @@ namespace p2p {
     private:
         int selfId_;
         Logger& logger_;
-        socket_t sock_;
+        std::unique_ptr<Transport> io_;
+        Transport* rx_;               // receive thread's transport: io_, then alt_ after TRANSPORT_SWITCH
+        Transport* tx_;               // writer's (handshakes: receive thread, before the writer starts)
         std::thread thr_;
-        std::mutex sendMtx_;
         std::atomic<bool> running_{false};
-        std::vector<uint8_t> selfBitfield_;
+        std::atomic<bool> finished_{false};
+        std::atomic<bool> retired_{false};
+        std::atomic<int64_t> lastActivityNs_{0}; // messages only (lastActivity())
+        std::atomic<int64_t> lastHeardNs_{0};    // any frame, keep-alives too (dead-peer check)
+        std::atomic<uint64_t> bytesDown_{0};
+        std::atomic<uint64_t> bytesUp_{0};
+        ConnectionManager* mgr_ = nullptr;
+
+        // The swarm (file) this connection exchanges pieces for.
+        uint32_t swarmId_ = 0;
+        std::shared_ptr<PieceManager> pm_;
+        std::shared_ptr<SuperSeed> superSeed_; // set after the handshake if we super-seed this swarm
+        std::shared_ptr<DeltaSync> delta_;     // the swarm's; null for swarms set up without one
 
         // Track what the remote peer has, as learned from BITFIELD / HAVE.
-        std::vector<uint8_t> remoteBitfield_;
+        // Compact form: seeders and empty peers cost a few bytes each.
+        CompactBitfield remoteBitfield_;
+        bool remoteKnown_ = false; // got BITFIELD / HAVE_* / HAVE from them yet
+        int inFlight_ = -1;        // piece we've REQUESTed from them and not received, or -1
+
+        // Request deadlines (receive thread only). The deadline follows this
+        // peer's observed request-to-PIECE time, TCP-RTO style, and backs off
+        // while it keeps timing out.
+        std::chrono::steady_clock::time_point reqSentAt_{};
+        std::chrono::steady_clock::time_point reqDeadline_{};
+        double srttMs_ = 0, rttVarMs_ = 0;
+        bool haveRtt_ = false;
+        int strikes_ = 0;                  // timeouts since the last piece from them
+        std::deque<uint32_t> timedOut_;    // recent pieces they didn't deliver; asked elsewhere
+        std::atomic<uint32_t> timeouts_{0};
 
-        // Whether WE are currently interested in this remote peer.
-        bool amInterested_ = false;
+        // Keep-alives and dead-peer checks on gTimers.
+        std::atomic<int64_t> lastSendNs_{0};
+        TimerWheel::TimerId liveTimer_ = 0;
 
-        int remotePeerId_ = -1;
+        // Whether WE are currently interested in this remote peer, and vice versa.
+        std::atomic<bool> amInterested_{false};
+        std::atomic<bool> peerInterested_{false};
+
+        std::atomic<int> remotePeerId_{-1};
         bool incoming_ = false;   // new: indicates if this is an incoming connection
 
+        // Capabilities both sides advertised in the handshake.
+        std::atomic<uint32_t> caps_{0};
+
+        std::chrono::steady_clock::time_point lastPexIn_{}; // receive thread only
+
+        // Wire recording (gRecorder): this connection's id in the file, 0 if off.
+        std::atomic<uint32_t> recId_{0};
+        std::shared_ptr<AlignedBuffer> lastPieceIn_; // receive thread: data of the PIECE just read
+
+        // Outbound queue, drained by writer_ so the receive loop never waits on a
+        // full socket. Control messages are coalesced into one buffer and go out
+        // ahead of any queued PIECE.
+        struct OutPiece {
+            std::vector<uint8_t> bytes; // serialized message
+            size_t raw = 0;             // piece bytes it carries (counted in uploadBytes_)
+        };
+        std::thread writer_;
+        ProfiledMutex qMtx_{"ConnectionHandler::qMtx_"};
+        ProfiledCondVar qCv_;
+        std::vector<uint8_t> ctrlOut_;
+        std::deque<OutPiece> pieceOut_;
+        bool writerStop_ = false;
+
+        // Negotiated replacement for io_ (local or UDP), set once under qMtx_.
+        // switchOut_: the writer still owes the TRANSPORT_SWITCH marker before it
+        // moves over. udpPending_: ours while waiting to hear from the other end.
+        std::shared_ptr<Transport> alt_;
+        bool switchOut_ = false;
+        std::shared_ptr<UdpTransport> udpPending_;
+        uint64_t localNonce_ = 0; // our offer in gLocalListener (receive thread)
+
+        // Disk and codec work for this connection runs on gWorkPool; everything
+        // below is guarded by qMtx_. The destructor waits for tasks_ to reach 0.
+        size_t tasks_ = 0;
+        size_t uploadBytes_ = 0;   // pieces being read for the remote or waiting to be sent
+        std::deque<std::pair<uint32_t, size_t>> deferredReqs_; // (piece, size) over the upload budget
+        std::vector<std::shared_ptr<AlignedBuffer>> freeBufs_; // spare PIECE receive buffers
+
         void run_();
+        void runSession_();
+        void writeLoop_();
+        void stopWriter_();
+        void touch_();
+        void heard_();
+        void liveTick_();
+        int waitReadable_(int timeoutMs) const;
+        std::chrono::milliseconds requestTimeout_() const;
+        void onRtt_(double ms);
+        void sendInitialHaves_();
+        void serveRequest_(uint32_t idx);
+        void postUpload_(uint32_t idx, size_t raw);
+        void queuePiece_(std::vector<uint8_t> bytes, size_t raw);
+        void storePiece_(PieceManager& pm, uint32_t idx, PieceCodec codec,
+                         const AlignedBuffer& wire, size_t size);
+        void announceHave_(uint32_t idx);
+        void offerTo_(const std::vector<int>& peers);
+        void onPex_(const uint8_t* data, size_t n);
+        void offerLocal_();
+        void onLocalOffer_(const uint8_t* data, size_t n);
+        void offerUdp_();
+        void onUdpOffer_(const uint8_t* data, size_t n);
+        void onManifest_(const uint8_t* data, size_t n);
+        void sendZeroPieces_();
+        void onZeroPieces_(const uint8_t* data, size_t n);
+        void watchUdp_(std::shared_ptr<UdpTransport> t);
+        void attachTransport_(std::shared_ptr<Transport> t);
+        std::string remoteHost_() const;
+        void taskDone_();
         bool sendAll_(const uint8_t* data, size_t n) const;
         bool recvAll_(uint8_t* data, size_t n) const;
+        bool skip_(size_t n);
+        bool recvPiece_(uint32_t idx, PieceCodec codec, size_t n);
+        void record_(Recorder::Dir dir, uint8_t type, uint32_t len,
+                     const uint8_t* a, size_t an, const uint8_t* b = nullptr, size_t bn = 0);
+        void recordOut_(const std::vector<uint8_t>& bytes);
     };
 
 
     class PeerServer {
     public:
-        PeerServer(int selfId, Logger& logger, int listenPort, std::vector<uint8_t> selfBitfield);
+        // Accepted connections are handed to `conns`, which owns them.
+        PeerServer(int selfId, Logger& logger, int listenPort, ConnectionManager& conns);
         ~PeerServer();
 
         void start();
@@ -86,9 +250,9 @@ namespace p2p {
         int selfId_;
         Logger& logger_;
         int port_;
+        ConnectionManager& conns_;
         std::thread thr_;
         std::atomic<bool> running_{false};
-        std::vector<uint8_t> selfBitfield_;
         #if defined(_WIN32)
             socket_t srv_ = INVALID_SOCKET;
         #else
@@ -102,7 +266,7 @@ namespace p2p {
             int selfId,
             Logger& logger,
             const Endpoint& ep,
-            const std::vector<uint8_t>& selfBitfield);
+            uint32_t swarmId = 0);
     };
 
 
@@ -0,0 +1,53 @@
+#ifndef P2P_PEER_BOOK_HPP
+#define P2P_PEER_BOOK_HPP
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "p2p/Config.hpp"
+
+namespace p2p {
+
+    // Every peer endpoint we know about: PeerInfo.cfg plus whatever PEX gossip
+    // taught us. Connections read it to build PEX messages and feed it what
+    // they learn; new entries are handed to onNew so someone can dial them.
+    class PeerBook {
+    public:
+        using OnNew = std::function<void(const PeerInfoRow&)>;
+
+        // Our own id is never stored or handed out.
+        void setSelf(int selfId);
+
+        // Set once at startup; called outside the book's lock.
+        void setOnNew(OnNew fn);
+
+        // Returns true if the peer was new. First endpoint wins: gossip can't
+        // redirect a peer we already know (PeerInfo.cfg entries are added first).
+        bool add(const PeerInfoRow& row);
+
+        // Up to n random entries, skipping `exclude`.
+        std::vector<PeerInfoRow> sample(size_t n, int exclude) const;
+
+        // The entry for this peer, if we know it.
+        std::optional<PeerInfoRow> find(int peerId) const;
+
+        size_t size() const;
+
+    private:
+        mutable std::mutex mtx_;
+        int selfId_ = -1;
+        OnNew onNew_;
+        std::map<int, PeerInfoRow> peers_;
+        mutable std::mt19937 rng_{std::random_device{}()};
+    };
+
+    // Set up in peerProcess.cpp, used in Net.cpp.
+    extern PeerBook gPeerBook;
+
+} // namespace p2p
+
+#endif // P2P_PEER_BOOK_HPP
@@ -6,6 +6,13 @@
 #include <cstdint>
 #include <mutex>
 #include <memory>
+#include <atomic>
+#include <functional>
+#include <utility>
+
+#include "p2p/CompactBitfield.hpp"
+#include "p2p/ErasureCode.hpp"
+#include "p2p/LockStats.hpp"
 
 namespace p2p {
 
@@ -18,14 +25,61 @@ namespace p2p {
                      long long fileSizeBytes,
                      int pieceSizeBytes,
                      bool hasCompleteFile);
-
-        // Number of pieces for this file.
+        ~PieceManager();
+
+        PieceManager(const PieceManager&) = delete;
+        PieceManager& operator=(const PieceManager&) = delete;
+
+        // Optional erasure coding: every `stripe` consecutive pieces get `parity`
+        // Reed-Solomon parity pieces, numbered after the file's own pieces, so
+        // pieceCount() grows and nothing on the wire changes. Any `stripe` of a
+        // stripe's pieces rebuild the rest, so a download never waits on one
+        // particular rare piece. Parity is kept in <file>.parity. Call right after
+        // construction; every peer in the swarm must use the same numbers.
+        // Throws std::invalid_argument if stripe + parity > 256.
+        void enableErasure(int stripe, int parity);
+        bool erasure() const { return rs_ != nullptr; }
+
+        // Call once at startup, before any transfers. Preallocates the file to its
+        // full size when we don't have it yet, so pieces written out of order don't
+        // leave it sparse and fragmented. With directIO, aligned piece writes bypass
+        // the page cache (the cache stays warm for what we seed). A seed with
+        // erasure coding on writes its parity here unless <file>.parity is newer
+        // than the file. Throws std::runtime_error if the disk can't hold the file.
+        void prepareStorage(bool directIO);
+
+        // True if prepareStorage got an O_DIRECT descriptor (not every filesystem allows it).
+        bool directIO() const { return dfd_ >= 0; }
+
+        // Number of pieces for this file, parity included.
         size_t pieceCount() const { return pieceCount_; }
 
+        // Pieces of the file itself: [0, dataPieceCount()). The rest are parity.
+        size_t dataPieceCount() const { return dataPieces_; }
+
+        // Size in bytes of a given piece (the last data piece may be short).
+        long long pieceSize(size_t index) const { return pieceOffsetAndSize_(index).second; }
+
         // True if we have this piece fully.
         bool havePiece(size_t index) const;
 
-        // True if we have all pieces.
+        // First piece in [begin, end) we neither have nor are writing, or `end` if none.
+        // With erasure coding, pieces of a stripe that already has enough don't count.
+        size_t firstMissingIn(size_t begin, size_t end) const;
+
+        // Like firstMissingIn, also skipping pieces some connection has an
+        // outstanding REQUEST for, so each connection fetches something different.
+        size_t firstUnrequestedIn(size_t begin, size_t end) const;
+
+        // Outstanding REQUESTs per piece across all connections. A request that
+        // times out is cleared so another holder picks the piece up.
+        void noteRequested(size_t index);
+        void clearRequested(size_t index);
+
+        // Number of pieces we currently have.
+        size_t haveCount() const;
+
+        // True if we have every piece of the file (parity doesn't matter).
         bool isComplete() const;
 
         // Mark a piece as "have" (used when seeder starts with full file).
@@ -34,9 +88,49 @@ namespace p2p {
         // Read a piece (for serving REQUESTs). Throws std::runtime_error on failure.
         std::vector<uint8_t> readPiece(size_t index) const;
 
+        // Claim a received piece before handing its write to another thread, so no
+        // connection requests it again meanwhile. False if we have it or it's
+        // already being written. writePiece() ends the claim; abortWrite() drops it.
+        bool beginWrite(size_t index);
+        void abortWrite(size_t index);
+
         // Write a piece from network. Returns true if this piece was newly completed.
+        // The write that brings a stripe to enough pieces also rebuilds the rest
+        // of it (see takeRecovered).
         bool writePiece(size_t index, const std::vector<uint8_t>& data);
 
+        // Same, straight from a receive buffer (no intermediate copy).
+        bool writePiece(size_t index, const uint8_t* data, size_t n);
+
+        // Pieces rebuilt from parity (or parity computed) since the last call,
+        // for the caller to announce.
+        std::vector<size_t> takeRecovered();
+
+        // All-zero pieces (disk images, preallocated datasets). A seed finds them
+        // with scanZeroPieces(); the rest of the swarm hears about them (ZERO_PIECES)
+        // and takes them with markZero() instead of downloading them.
+
+        // Reads every data piece, skipping whatever the filesystem already knows
+        // is a hole. Returns how many are all zeros. Throws std::runtime_error if
+        // a read fails.
+        size_t scanZeroPieces();
+        // Data pieces known to be all zeros (sized dataPieceCount()).
+        CompactBitfield zeroPieces() const;
+        // Take every data piece in `zeros` we're missing as present, leaving a hole
+        // in the file where it goes. Returns the pieces that are newly ours, for
+        // the caller to announce. Throws std::runtime_error if the file can't be
+        // written.
+        std::vector<size_t> markZero(const CompactBitfield& zeros);
+
+        // Streaming: pieces in [begin, end) are requested before any others.
+        // (0, 0) clears it.
+        void setPriorityWindow(size_t begin, size_t end);
+        std::pair<size_t, size_t> priorityWindow() const;
+
+        // Called (on whatever thread wrote it) each time a piece is newly completed.
+        // Set before transfers start.
+        void setOnPieceDone(std::function<void(size_t)> fn) { onPieceDone_ = std::move(fn); }
+
         // Convert our have[] into a compact byte bitfield (bit 7..0 = pieces 0..7 etc).
         std::vector<uint8_t> toBitfieldBytes() const;
 
@@ -45,20 +139,53 @@ namespace p2p {
         long long fileSizeBytes_;
         int pieceSizeBytes_;
         size_t pieceCount_;
+        size_t dataPieces_;
 
         // One entry per piece: true if we have it.
         std::vector<bool> have_;
+        std::vector<bool> writing_; // claimed by beginWrite(), not yet on disk
+        std::vector<uint16_t> requested_; // outstanding REQUESTs for each piece
+
+        std::atomic<size_t> windowBegin_{0};
+        std::atomic<size_t> windowEnd_{0};
+        std::function<void(size_t)> onPieceDone_;
+
+        // Erasure coding (null rs_ = off).
+        std::unique_ptr<ReedSolomon> rs_;
+        size_t stripe_ = 0, parity_ = 0;
+        std::string parityPath_;
+        std::vector<bool> rebuilding_;     // per stripe
+        std::vector<size_t> recovered_;    // for takeRecovered()
 
-        mutable std::mutex mtx_; // protect have_ during writes
+        CompactBitfield zero_; // all-zero data pieces we know of
+
+        mutable ProfiledMutex mtx_{"PieceManager::mtx_"}; // protect have_ during writes
+
+        // File kept open for positional reads/writes; opened on first use.
+        mutable std::mutex fdMtx_;
+        mutable int fd_ = -1;
+        mutable int pfd_ = -1; // parity file
+        int dfd_ = -1;  // O_DIRECT descriptor, or -1
+        int openFile_(bool parity = false) const;
 
         void computePieceCount_();
+        // Offset within the data file, or within the parity file for parity pieces.
         std::pair<long long,long long> pieceOffsetAndSize_(size_t index) const;
+        void writeRaw_(size_t index, const uint8_t* data, size_t n);
+        void zeroRaw_(size_t index); // punch a hole (or write zeros) where a piece goes
+        bool finishWrite_(size_t index);
+
+        // Caller holds mtx_.
+        size_t stripeOf_(size_t index) const;
+        size_t stripeData_(size_t s) const;       // data pieces in stripe s (the last may be short)
+        size_t stripeRunEnd_(size_t index) const; // end of the index run of index's stripe
+        // Pieces of stripe s we have, optionally counting ones being written or on order.
+        size_t stripeHeld_(size_t s, bool writing, bool requested) const;
+
+        void rebuildStripe_(size_t s);
+        void encodeParity_();
     };
 
-    // Global pointer to this process's PieceManager instance.
-    // Set in peerProcess.cpp, used in Net.cpp.
-    extern std::shared_ptr<PieceManager> gPieceManager;
-
 } // namespace p2p
 
 #endif // P2P_PIECEMANAGER_HPP
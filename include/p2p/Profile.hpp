@@ -0,0 +1,77 @@
+#ifndef P2P_PROFILE_HPP
+#define P2P_PROFILE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace p2p {
+
+    // Built-in profiling, compiled in with -DP2P_PROFILE=ON (the macros are
+    // empty otherwise).
+    //
+    // P2P_SCOPE("name") times the rest of the enclosing block. Scopes nest into
+    // a call tree per thread, and a thread only ever writes its own.
+    // profileCollapsed() merges the trees into flamegraph.pl's collapsed-stack
+    // input, "a;b;c <self time in us>".
+    //
+    // P2P_PROFILE_PEER(id) says which peer the rest of the block works for. With
+    // sampling on, SIGPROF at `hz` per second of CPU time notes each running
+    // thread's innermost scope and peer. profileSamples() gives "peer N;a;b
+    // <samples>": which connection, and which message type, the CPU went to.
+    // That's what perf can't tell apart.
+
+    // Every thread's tree, merged by path.
+    std::string profileCollapsed();
+
+    // Start sampling (process-wide ITIMER_PROF). False if it can't be set up.
+    bool startProfileSampling(int hz);
+    // Move samples out of the per-thread rings; call every second or so.
+    void collectProfileSamples();
+    // Samples so far, collapsed, with the peer as the first frame.
+    std::string profileSamples();
+
+#if defined(P2P_PROFILE)
+
+    void* profileEnter(const char* name);
+    void profileLeave(void* node, int64_t ns);
+    int64_t profileNowNs();
+    std::atomic<int>& profilePeerSlot();
+
+    class ProfileScope {
+    public:
+        // name must outlive the program (a string literal).
+        explicit ProfileScope(const char* name) : node_(profileEnter(name)), start_(profileNowNs()) {}
+        ~ProfileScope(){ profileLeave(node_, profileNowNs() - start_); }
+        ProfileScope(const ProfileScope&) = delete;
+        ProfileScope& operator=(const ProfileScope&) = delete;
+    private:
+        void* node_;
+        int64_t start_;
+    };
+
+    class ProfilePeer {
+    public:
+        explicit ProfilePeer(int peer) : prev_(profilePeerSlot().exchange(peer, std::memory_order_relaxed)) {}
+        ~ProfilePeer(){ profilePeerSlot().store(prev_, std::memory_order_relaxed); }
+        ProfilePeer(const ProfilePeer&) = delete;
+        ProfilePeer& operator=(const ProfilePeer&) = delete;
+    private:
+        int prev_;
+    };
+
+#define P2P_PROFILE_CAT2(a, b) a##b
+#define P2P_PROFILE_CAT(a, b) P2P_PROFILE_CAT2(a, b)
+#define P2P_SCOPE(name) ::p2p::ProfileScope P2P_PROFILE_CAT(p2pScope_, __LINE__)(name)
+#define P2P_PROFILE_PEER(id) ::p2p::ProfilePeer P2P_PROFILE_CAT(p2pPeer_, __LINE__)(id)
+
+#else
+
+#define P2P_SCOPE(name) ((void)0)
+#define P2P_PROFILE_PEER(id) ((void)0)
+
+#endif
+
+} // namespace p2p
+
+#endif // P2P_PROFILE_HPP
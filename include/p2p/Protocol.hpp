@@ -17,7 +17,40 @@ namespace p2p {
         HAVE = 4,
         BITFIELD = 5,
         REQUEST = 6,
-        PIECE = 7
+        PIECE = 7,
+        // Extensions, only sent when negotiated in the handshake.
+        HAVE_ALL = 8,  // CAP_FAST_HAVE: sender has every piece (replaces BITFIELD)
+        HAVE_NONE = 9, // CAP_FAST_HAVE: sender has no pieces yet
+        BITFIELD_RUNS = 10, // CAP_COMPACT_BITFIELD: run-length encoded bitfield
+        PEX = 11, // CAP_PEX: endpoints of other peers the sender knows
+        LOCAL_OFFER = 12, // CAP_LOCAL: same-host transport offer (LocalTransport.hpp)
+        TRANSPORT_SWITCH = 13, // CAP_LOCAL / CAP_UDP: last message on TCP; the rest follows on the new transport
+        UDP_OFFER = 14, // CAP_UDP: connection id and UDP port to reach the sender on (UdpTransport.hpp)
+        MANIFEST_REQUEST = 15, // CAP_MANIFEST: send me your piece checksums
+        MANIFEST = 16, // CAP_MANIFEST: per-piece checksums of the sender's copy (DeltaSync.hpp)
+        ZERO_PIECES = 17 // CAP_ZERO_PIECES: run-length set of data pieces that are all zeros
+    };
+
+    // "PIECE", "HAVE", ... ("UNKNOWN" past the last type), for logs and profiles.
+    const char* messageTypeName(uint8_t type);
+
+    // Capability bits carried in the handshake's reserved bytes.
+    // A feature is used on a connection only if both sides advertise it.
+    enum Capability : uint32_t {
+        CAP_COMPRESSION = 1u << 0, // LZ4 PIECE payloads (codec byte after the index)
+        CAP_FAST_HAVE   = 1u << 1, // HAVE_ALL / HAVE_NONE instead of BITFIELD
+        CAP_COMPACT_BITFIELD = 1u << 2, // BITFIELD_RUNS when it is smaller than BITFIELD
+        CAP_PEX         = 1u << 3, // peer exchange (PEX messages)
+        CAP_LOCAL       = 1u << 4, // same-host shared-memory / Unix socket transport
+        CAP_UDP         = 1u << 5, // UDP with delay-based congestion control
+        CAP_MANIFEST    = 1u << 6, // piece checksum manifests, for updating from an old copy
+        CAP_ZERO_PIECES = 1u << 7  // all-zero pieces are announced once and never transferred
+    };
+
+    // Codec byte carried in PIECE payloads once both sides negotiated compression.
+    enum class PieceCodec : uint8_t {
+        RAW = 0,
+        LZ4 = 1
     };
 
     struct Handshake {
@@ -26,8 +59,17 @@ namespace p2p {
         //static constexpr size_t ZERO_LEN = 10;
         static const std::array<uint8_t, HDR_LEN> HEADER;
 
-        static std::array<uint8_t, LEN> encode(int peerId);
+        // Bytes 18..21 carry capability bits: bit n lives in byte 18 + n/8,
+        // mask 1 << (n%8). Bytes 22..23 stay zero. Old peers send all zeros.
+        static constexpr size_t CAPS_OFF = HDR_LEN;
+        static constexpr size_t CAPS_LEN = 4;
+        // Bytes 24..27: swarm id (big-endian). 0 = the default file.
+        static constexpr size_t SWARM_OFF = 24;
+
+        static std::array<uint8_t, LEN> encode(int peerId, uint32_t caps = 0, uint32_t swarmId = 0);
         static int decodePeerId(const std::array<uint8_t, LEN>& msg);
+        static uint32_t decodeCaps(const std::array<uint8_t, LEN>& msg);
+        static uint32_t decodeSwarmId(const std::array<uint8_t, LEN>& msg);
     };
 
     struct Message {
@@ -41,6 +83,27 @@ namespace p2p {
         [[maybe_unused]] static Message parse(const std::vector<uint8_t>& buf);
     };
 
+    // One PEX entry. An empty host means "the address you see this connection
+    // coming from" (how a peer advertises its own listen port).
+    struct PexEntry {
+        int peerId = 0;
+        std::string host;
+        uint16_t port = 0;
+    };
+
+    // PEX payload: repeated [peerId(4) | port(2) | hostLen(1) | host].
+    // Throws std::runtime_error if malformed; stops after maxEntries.
+    std::vector<PexEntry> decodePex(const uint8_t* data, size_t n, size_t maxEntries);
+
+    // LOCAL_OFFER payload: nonce(8) | hostIdLen(1) | hostId | addrLen(1) | address.
+    struct LocalOffer {
+        uint64_t nonce = 0;
+        std::string hostId;
+        std::string address;
+    };
+    // Throws std::runtime_error if malformed.
+    LocalOffer decodeLocalOffer(const uint8_t* data, size_t n);
+
     namespace msg {
 
         // Control messages (no payload)
@@ -52,9 +115,24 @@ namespace p2p {
         // Data-related messages (with payloads)
         Message have(uint32_t pieceIndex);
         Message bitfield(const std::vector<uint8_t>& bits);
+        Message bitfieldRuns(const std::vector<uint8_t>& runs);
+        Message haveAll();
+        Message haveNone();
         Message request(uint32_t pieceIndex);
         Message piece(uint32_t pieceIndex, const std::vector<uint8_t>& data);
 
+        Message pex(const std::vector<PexEntry>& entries);
+        Message localOffer(const LocalOffer& offer);
+        Message transportSwitch();
+        Message udpOffer(uint32_t connId, uint16_t port);
+        Message manifestRequest();
+        Message manifest(std::vector<uint8_t> payload);
+        // Payload is CompactBitfield::encodeRuns() over the data pieces.
+        Message zeroPieces(const std::vector<uint8_t>& runs);
+
+        // PIECE with a codec byte after the index (only when compression was negotiated).
+        Message piece(uint32_t pieceIndex, PieceCodec codec, const std::vector<uint8_t>& data);
+
     }
 
 
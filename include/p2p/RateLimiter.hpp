@@ -0,0 +1,35 @@
+#ifndef P2P_RATE_LIMITER_HPP
+#define P2P_RATE_LIMITER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+namespace p2p {
+
+    // Byte budget shared by every connection that draws from it.
+    // Callers are served in arrival order, so swarms get a fair share of the
+    // link no matter which file the bytes belong to.
+    class RateLimiter {
+    public:
+        // bytesPerSec <= 0 means unlimited.
+        void setRate(long long bytesPerSec, double burstSec = 1.0);
+
+        // Blocks until n bytes may be sent.
+        void acquire(size_t n);
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        std::mutex mtx_;
+        long long rate_ = 0;
+        clock::duration burst_{};
+        clock::time_point next_{}; // when the budget is next free
+    };
+
+    // Upload budget for the whole process (all swarms). Set in peerProcess.cpp.
+    extern RateLimiter gUploadBudget;
+
+} // namespace p2p
+
+#endif // P2P_RATE_LIMITER_HPP
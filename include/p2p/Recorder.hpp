@@ -0,0 +1,117 @@
+#ifndef P2P_RECORDER_HPP
+#define P2P_RECORDER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace p2p {
+
+    // Wire recorder: every connection's message stream, decoded just enough to
+    // be useful (time, direction, type, piece index, length), in one compact
+    // file per process. Control payloads are always kept so the stream can be
+    // replayed; PIECE data only if asked for (otherwise replay sends zeros).
+    //
+    // File: "P2PREC1\n", then varints: flags, selfId, swarm count and
+    // (id, fileSize, pieceSize) per swarm. Then records, each a kind byte and
+    // varints; times are microseconds since the previous record.
+    //   OPEN  conn dt remotePeer swarm incoming(byte) caps
+    //   MSG   conn dt dir(byte) type(byte) len index+1 payloadLen payload
+    //   CLOSE conn dt
+    // `len` is the message's length field; type 255 is a keep-alive.
+    class Recorder {
+    public:
+        enum Kind : uint8_t { OPEN = 1, MSG = 2, CLOSE = 3 };
+        enum Dir : uint8_t { IN = 0, OUT = 1 };
+        static constexpr uint8_t KEEP_ALIVE = 255;
+        static constexpr uint32_t FLAG_PAYLOADS = 1;
+
+        struct SwarmInfo { uint32_t id; long long fileSize; int pieceSize; };
+
+        ~Recorder();
+
+        // Start recording to `path` (truncates). Throws std::runtime_error if it can't.
+        void open(const std::string& path, int selfId, bool piecePayloads,
+                  const std::vector<SwarmInfo>& swarms);
+        void close();
+
+        // Push buffered records to disk. peerProcess usually ends with a signal,
+        // so it calls this every second rather than relying on close().
+        void flush();
+
+        bool enabled() const { return f_ != nullptr; }
+        bool piecePayloads() const { return payloads_; }
+
+        // Returns the connection's id in the file (never 0).
+        uint32_t onOpen(int remotePeer, uint32_t swarm, bool incoming, uint32_t caps);
+        // body = everything after the type byte, as up to two spans.
+        void onMessage(uint32_t conn, Dir dir, uint8_t type, uint32_t len,
+                       const uint8_t* a, size_t an, const uint8_t* b = nullptr, size_t bn = 0);
+        void onClose(uint32_t conn);
+
+    private:
+        std::mutex mtx_;
+        std::FILE* f_ = nullptr;
+        bool payloads_ = false;
+        uint32_t nextConn_ = 1;
+        std::chrono::steady_clock::time_point last_{}; // time of the last record
+        std::vector<uint8_t> buf_;
+
+        uint64_t dtUs_(); // caller holds mtx_
+        void flush_();    // caller holds mtx_
+    };
+
+    // Off unless RecordTo is set in Common.cfg.
+    extern Recorder gRecorder;
+
+    // Reads a recording back (the replay tool, analysis).
+    class RecordReader {
+    public:
+        struct Record {
+            Recorder::Kind kind{};
+            uint32_t conn = 0;
+            uint64_t tUs = 0;          // since the start of the recording
+            // OPEN
+            int remotePeer = -1;
+            uint32_t swarm = 0;
+            bool incoming = false;
+            uint32_t caps = 0;
+            // MSG
+            Recorder::Dir dir{};
+            uint8_t type = 0;
+            uint32_t len = 0;
+            int64_t index = -1;        // HAVE / REQUEST / PIECE, else -1
+            std::vector<uint8_t> payload;
+        };
+
+        // Throws std::runtime_error if it isn't a recording.
+        explicit RecordReader(const std::string& path);
+        ~RecordReader();
+
+        int selfId() const { return selfId_; }
+        bool piecePayloads() const { return flags_ & Recorder::FLAG_PAYLOADS; }
+        const std::vector<Recorder::SwarmInfo>& swarms() const { return swarms_; }
+
+        // False at the end. Throws std::runtime_error on a truncated record.
+        bool next(Record& r);
+
+        RecordReader(const RecordReader&) = delete;
+        RecordReader& operator=(const RecordReader&) = delete;
+
+    private:
+        std::FILE* f_ = nullptr;
+        uint32_t flags_ = 0;
+        int selfId_ = 0;
+        std::vector<Recorder::SwarmInfo> swarms_;
+        uint64_t t_ = 0;
+
+        uint64_t varint_();
+        uint8_t byte_();
+    };
+
+} // namespace p2p
+
+#endif // P2P_RECORDER_HPP
@@ -5,9 +5,110 @@
 #include <atomic>
 #include <functional>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
 
 namespace p2p {
 
+    // Hierarchical timing wheel run by a single timer thread. Four levels of 256
+    // slots; a level-0 slot is one tick (1ms by default), so the wheel spans 2^32
+    // ticks and anything further out is parked in the top level and re-placed
+    // when it comes round. Timers live in intrusive lists, so adding and
+    // cancelling are O(1) no matter how many are pending.
+    //
+    // The wheel only decides which tick a timer belongs to; the exact deadline is
+    // kept, and a timer whose tick has come is held back until that deadline, so
+    // short timers fire to the microsecond (as far as the OS wakes us).
+    //
+    // Callbacks run on the timer thread and should be short; post anything heavy
+    // to gWorkPool.
+    class TimerWheel {
+    public:
+        using clock = std::chrono::steady_clock;
+        using Fn = std::function<void()>;
+        using TimerId = uint64_t; // 0 is never a valid id
+
+        explicit TimerWheel(clock::duration tick = std::chrono::milliseconds(1));
+        ~TimerWheel();
+
+        // Both are idempotent. Timers added before start() fire once it's running.
+        void start();
+        void stop();
+
+        TimerId at(clock::time_point due, Fn fn);
+        TimerId after(clock::duration delay, Fn fn);
+        // First run after firstDelay, then every period. Beats missed while the
+        // callback (or the machine) was busy are skipped, not bunched up.
+        TimerId every(clock::duration period, Fn fn);
+        TimerId every(clock::duration period, Fn fn, clock::duration firstDelay);
+
+        // False if it already fired (one-shot) or was cancelled. If the callback is
+        // running on the timer thread right now, waits for it to return, so the
+        // callback's captures can go away as soon as this does.
+        bool cancel(TimerId id);
+
+        size_t size() const;
+
+        TimerWheel(const TimerWheel&) = delete;
+        TimerWheel& operator=(const TimerWheel&) = delete;
+
+    private:
+        static constexpr unsigned SLOT_BITS = 8;
+        static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+        static constexpr size_t LEVELS = 4;
+        static constexpr size_t NEAR_LIST = LEVELS * SLOTS; // due this tick, waiting on the exact time
+
+        enum State : uint8_t { FREE, QUEUED, FIRING };
+
+        struct Node {
+            clock::time_point due{};
+            clock::duration period{0}; // zero: one-shot
+            uint64_t tick = 0;
+            Fn fn;
+            uint32_t gen = 1;
+            int32_t prev = -1, next = -1;
+            int32_t list = -1;
+            State state = FREE;
+            bool cancelled = false; // cancelled while firing
+        };
+
+        const clock::duration tick_;
+        const clock::time_point origin_;
+
+        mutable std::mutex mtx_;
+        std::condition_variable cv_;     // timer thread sleeps here
+        std::condition_variable doneCv_; // cancel() waits here for a running callback
+        std::thread thr_;
+        bool running_ = false;
+        bool stop_ = false;
+
+        std::vector<Node> nodes_;
+        std::vector<int32_t> heads_;     // LEVELS*SLOTS slots + the near list
+        int32_t freeHead_ = -1;
+        size_t count_ = 0;
+        uint64_t cur_ = 0;               // last tick processed
+        int32_t firing_ = -1;
+        clock::time_point wakeAt_ = clock::time_point::max();
+        std::vector<int32_t> due_;       // scratch for run_
+
+        TimerId add_(clock::time_point due, clock::duration period, Fn fn);
+        uint64_t tickOf_(clock::time_point t) const;
+        void place_(int32_t i);
+        void link_(int32_t i, size_t list);
+        void unlink_(int32_t i);
+        void free_(int32_t i);
+        void cascade_(size_t level);
+        void advance_();
+        clock::time_point nextWake_() const;
+        void run_();
+    };
+
+    // Shared by the whole process. Started in peerProcess.cpp.
+    extern TimerWheel gTimers;
+
+    // Periodic task on gTimers; runs once at start() and then every interval.
     class RepeatingTask {
     public:
         template<class F>
@@ -15,28 +116,23 @@ namespace p2p {
         ~RepeatingTask() { stop(); }
 
         void start() {
-            running_.store(true);
-            thr_ = std::thread([this]{
-                while (running_.load()) {
-                    auto next = std::chrono::steady_clock::now() + std::chrono::seconds(interval_);
-                    try { fn_(); } catch (...) { /* swallow for midpoint */ }
-                    std::this_thread::sleep_until(next);
-                }
-            });
+            if (id_) return;
+            id_ = gTimers.every(std::chrono::seconds(interval_), [this]{
+                try { fn_(); } catch (...) { /* swallow for midpoint */ }
+            }, TimerWheel::clock::duration::zero());
         }
 
         void stop() {
-            running_.store(false);
-            if (thr_.joinable()) thr_.join();
+            if (id_) gTimers.cancel(id_);
+            id_ = 0;
         }
 
     private:
         int interval_;
         std::function<void()> fn_;
-        std::atomic<bool> running_{false};
-        std::thread thr_;
+        TimerWheel::TimerId id_ = 0;
     };
 
 } // namespace p2p
 
-#endif // P2P_SCHEDULER_HPP
\ No newline at end of file
+#endif // P2P_SCHEDULER_HPP
@@ -0,0 +1,34 @@
+#ifndef P2P_SHA256_HPP
+#define P2P_SHA256_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace p2p {
+
+    // FIPS 180-4 SHA-256, plain C++ (no dependency on a crypto library).
+    class Sha256 {
+    public:
+        using Digest = std::array<uint8_t, 32>;
+
+        Sha256();
+        void update(const uint8_t* data, size_t n);
+        Digest finish();
+
+        static Digest hash(const uint8_t* data, size_t n);
+        static std::string hex(const Digest& d);
+
+    private:
+        uint32_t h_[8];
+        uint8_t block_[64];
+        size_t used_ = 0;
+        uint64_t total_ = 0;
+
+        void compress_(const uint8_t* block);
+    };
+
+} // namespace p2p
+
+#endif // P2P_SHA256_HPP
@@ -0,0 +1,61 @@
+#ifndef P2P_STREAM_SINK_HPP
+#define P2P_STREAM_SINK_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "p2p/Logger.hpp"
+#include "p2p/PieceManager.hpp"
+
+namespace p2p {
+
+    // Streaming mode: hands the file to a consumer in order while it downloads.
+    // As soon as the next piece after what's been delivered lands, it (and any
+    // complete pieces after it) go to the consumer. The pieces just ahead of the
+    // consumer are flagged to the PieceManager as a priority window, which
+    // connections request before anything else.
+    class StreamSink {
+    public:
+        // Gets contiguous file bytes in order. Return false to stop streaming.
+        using Consumer = std::function<bool(const uint8_t* data, size_t n)>;
+
+        StreamSink(Logger& logger, std::shared_ptr<PieceManager> pm, Consumer out, size_t window);
+        ~StreamSink();
+
+        // Writes to a path on the sink thread: "-" is stdout; a FIFO blocks until a
+        // reader opens it; anything else is created/truncated as a plain file.
+        static Consumer toPath(const std::string& path);
+
+        void start();
+        void stop();
+
+        // Pieces handed to the consumer so far.
+        size_t delivered() const { return cursor_.load(); }
+
+        StreamSink(const StreamSink&) = delete;
+        StreamSink& operator=(const StreamSink&) = delete;
+
+    private:
+        Logger& logger_;
+        std::shared_ptr<PieceManager> pm_;
+        Consumer out_;
+        size_t window_;
+
+        std::thread thr_;
+        std::mutex mtx_;
+        std::condition_variable cv_;
+        bool stop_ = false;
+        std::atomic<size_t> cursor_{0}; // next piece to deliver
+
+        void run_();
+    };
+
+} // namespace p2p
+
+#endif // P2P_STREAM_SINK_HPP
@@ -0,0 +1,62 @@
+#ifndef P2P_SUPER_SEED_HPP
+#define P2P_SUPER_SEED_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "p2p/CompactBitfield.hpp"
+
+namespace p2p {
+
+    // Super-seeding for an initial seed. The seed hides its bitfield and offers
+    // each leecher one piece at a time with a targeted HAVE, preferring pieces it
+    // has offered least. A leecher gets its next offer once the piece it was given
+    // shows up at some other peer, so the seed's uplink goes to pieces the swarm
+    // doesn't have yet instead of the same ones over and over.
+    //
+    // One per swarm, shared by all of that swarm's connections (thread-safe).
+    class SuperSeed {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        explicit SuperSeed(size_t pieceCount);
+
+        // Pick and record the next piece to offer this peer; -1 if it has them all
+        // (or still holds an offer that hasn't spread).
+        int offer(int peer);
+
+        // A peer told us about its pieces (BITFIELD / HAVE_ALL) or one piece (HAVE).
+        // Returns peers that should now get another offer.
+        std::vector<int> onBitfield(int peer, const CompactBitfield& has);
+        std::vector<int> onHave(int peer, size_t piece);
+
+        // If the peer got its piece but nobody has picked it up from them in a while,
+        // drop the offer so offer() gives it another rather than leaving it idle.
+        bool releaseIfStalled(int peer, clock::time_point now);
+
+        void forget(int peer);
+
+    private:
+        struct Peer {
+            CompactBitfield has;
+            int offered = -1;          // piece offered and not yet spread, or -1
+            bool gotIt = false;        // the peer itself has the offered piece
+            clock::time_point gotAt{};
+        };
+
+        mutable std::mutex mtx_;
+        size_t pieces_;
+        std::vector<uint32_t> offers_; // times each piece has been offered
+        std::vector<uint32_t> seen_;   // peers known to have each piece
+        std::map<int, Peer> peers_;
+
+        Peer& peer_(int id); // caller holds mtx_
+        void noteHave_(int peer, size_t piece, std::vector<int>& ready); // caller holds mtx_
+    };
+
+} // namespace p2p
+
+#endif // P2P_SUPER_SEED_HPP
@@ -0,0 +1,49 @@
+#ifndef P2P_SWARM_HPP
+#define P2P_SWARM_HPP
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "p2p/DeltaSync.hpp"
+#include "p2p/PieceManager.hpp"
+#include "p2p/SuperSeed.hpp"
+
+namespace p2p {
+
+    // One file being shared, identified on the wire by the swarm id in the handshake.
+    // Swarm 0 is the file from Common.cfg; older peers always send 0.
+    struct Swarm {
+        uint32_t id = 0;
+        std::string fileName;
+        std::shared_ptr<PieceManager> pieces;
+        std::shared_ptr<SuperSeed> superSeed; // set when we super-seed this file
+        std::shared_ptr<DeltaSync> delta;     // manifests, and the update from an old copy
+    };
+
+    // All swarms hosted by this process. Connections look theirs up after the handshake.
+    class SwarmRegistry {
+    public:
+        void add(Swarm s);
+
+        // nullptr if we don't serve this swarm.
+        std::shared_ptr<PieceManager> find(uint32_t id) const;
+        std::optional<Swarm> get(uint32_t id) const;
+
+        std::vector<Swarm> all() const;
+
+    private:
+        mutable std::mutex mtx_;
+        std::map<uint32_t, Swarm> swarms_;
+    };
+
+    // Set up in peerProcess.cpp, used in Net.cpp.
+    extern SwarmRegistry gSwarms;
+
+} // namespace p2p
+
+#endif // P2P_SWARM_HPP
@@ -0,0 +1,59 @@
+#ifndef P2P_TOPOLOGY_HPP
+#define P2P_TOPOLOGY_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "p2p/Config.hpp"
+#include "p2p/Connector.hpp"
+#include "p2p/ConnectionManager.hpp"
+#include "p2p/Logger.hpp"
+#include "p2p/Swarm.hpp"
+
+namespace p2p {
+
+    // Partial-mesh neighbor selection for large PeerInfo files.
+    // Instead of dialing every earlier peer (N^2 connections swarm-wide), each peer
+    // dials a bounded random subset. Every refresh it drops the slowest neighbor it
+    // dialed and dials a fresh random candidate, so faster peers get a chance in.
+    class Topology {
+    public:
+        Topology(int selfId, Logger& logger, ConnectionManager& conns, Connector& connector,
+                 std::vector<PeerInfoRow> candidates, size_t maxNeighbors, int refreshSec);
+
+        // Dial the initial random subset.
+        void start();
+
+        // Called every NeighborRefreshSec.
+        void refresh();
+
+        // Add a peer we learned about later (e.g. from gossip).
+        void addCandidate(const PeerInfoRow& row);
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        int selfId_;
+        Logger& logger_;
+        ConnectionManager& conns_;
+        Connector& connector_;
+        size_t maxNeighbors_;
+        std::chrono::seconds cooldown_;                // don't redial a peer sooner than this
+
+        std::mutex mtx_;
+        std::vector<PeerInfoRow> candidates_;
+        std::map<int, clock::time_point> dialed_;      // peerId -> last dial
+        std::map<int, uint64_t> lastDown_;             // peerId -> bytes at last refresh
+        std::mt19937 rng_{std::random_device{}()};
+
+        void dial_(const PeerInfoRow& row); // caller holds mtx_
+        void topUp_(const std::map<int, bool>& current); // caller holds mtx_
+    };
+
+} // namespace p2p
+
+#endif // P2P_TOPOLOGY_HPP
@@ -0,0 +1,98 @@
+#ifndef P2P_TRANSPORT_HPP
+#define P2P_TRANSPORT_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// POSIX sockets (Linux/macOS). Windows: stubs only.
+#if defined(_WIN32)
+#include <winsock2.h>
+using socket_t = SOCKET;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+using socket_t = int;
+#endif
+
+namespace p2p {
+
+    // The byte stream under a ConnectionHandler. One thread receives and one
+    // sends; shutdown() may come from anywhere and unblocks both.
+    class Transport {
+    public:
+        virtual ~Transport() = default;
+
+        // All n bytes or false (closed / failed).
+        virtual bool sendAll(const uint8_t* data, size_t n) = 0;
+        virtual bool recvAll(uint8_t* data, size_t n) = 0;
+
+        // >0 readable (or closed), 0 timed out, <0 error. timeoutMs < 0 waits forever.
+        virtual int waitReadable(int timeoutMs) = 0;
+
+        virtual void shutdown() = 0;
+
+        // Numeric address of the other end ("" if there isn't one).
+        virtual std::string remoteHost() const { return ""; }
+    };
+
+    // TCP (or any stream socket). Owns the descriptor.
+    class SocketTransport : public Transport {
+    public:
+        explicit SocketTransport(socket_t s) : sock_(s) {}
+        ~SocketTransport() override;
+
+        bool sendAll(const uint8_t* data, size_t n) override;
+        bool recvAll(uint8_t* data, size_t n) override;
+        int waitReadable(int timeoutMs) override;
+        void shutdown() override;
+        std::string remoteHost() const override;
+
+        socket_t fd() const { return sock_; }
+
+    private:
+        socket_t sock_;
+    };
+
+    // In-process pipe, for driving a ConnectionHandler without sockets (replay,
+    // benchmarks). pair() returns the two connected ends.
+    class MemoryTransport : public Transport {
+    public:
+        static std::pair<std::unique_ptr<MemoryTransport>, std::unique_ptr<MemoryTransport>>
+        pair(size_t capacity = 1u << 20);
+
+        bool sendAll(const uint8_t* data, size_t n) override;
+        bool recvAll(uint8_t* data, size_t n) override;
+        int waitReadable(int timeoutMs) override;
+        void shutdown() override; // closes both directions, like a socket
+
+        // Like shutdown(SHUT_WR): the other end reads what's buffered, then EOF.
+        void closeWrite();
+
+    private:
+        // One direction: a bounded ring; writers block while it's full.
+        struct Pipe {
+            std::mutex mtx;
+            std::condition_variable cv;
+            std::vector<uint8_t> ring;
+            size_t head = 0, size = 0;
+            bool closed = false;
+        };
+
+        MemoryTransport(std::shared_ptr<Pipe> in, std::shared_ptr<Pipe> out)
+        : in_(std::move(in)), out_(std::move(out)) {}
+
+        std::shared_ptr<Pipe> in_, out_;
+    };
+
+} // namespace p2p
+
+#endif // P2P_TRANSPORT_HPP
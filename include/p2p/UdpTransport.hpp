@@ -0,0 +1,183 @@
+#ifndef P2P_UDP_TRANSPORT_HPP
+#define P2P_UDP_TRANSPORT_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "p2p/Transport.hpp"
+
+namespace p2p {
+
+    class UdpMux;
+
+    // Reliable, ordered byte stream over UDP with LEDBAT congestion control
+    // (RFC 6817): the window grows while the one-way queuing delay stays under
+    // a target and shrinks as it rises past it, so a bulk transfer backs off
+    // before the bottleneck queue fills and other traffic on the link keeps
+    // its latency. Loss halves the window as in TCP.
+    //
+    // Packet: type(1) connId(4) seq(4) ack(4) sack(4) tsUs(4) tsDiffUs(4) wnd(4) payload.
+    // ack is the next sequence the receiver expects; sack bit i covers ack+1+i.
+    // tsDiffUs echoes the receiver's latest (arrival - send timestamp); the two
+    // clocks' offset cancels against the lowest such delay seen (base delay).
+    //
+    // Negotiated like the local transport (CAP_UDP, UDP_OFFER, then
+    // TRANSPORT_SWITCH): the dialing side waits for a SYN on its UdpMux, the
+    // other side sends one and both move over once they've heard each other.
+    class UdpTransport : public Transport {
+    public:
+        using OnEstablished = std::function<void()>;
+
+        ~UdpTransport() override;
+
+        bool sendAll(const uint8_t* data, size_t n) override;
+        bool recvAll(uint8_t* data, size_t n) override;
+        int waitReadable(int timeoutMs) override;
+        void shutdown() override;
+        std::string remoteHost() const override;
+
+        // Called once, on the mux thread, when the exchange is confirmed both
+        // ways: the dialer once its SYN is answered, the listening side once
+        // the dialer sends anything after that (or confirm()).
+        void setOnEstablished(OnEstablished fn);
+        // Drop the callback; waits for one in progress.
+        void disarm();
+        // The side that was given an address: start sending SYNs.
+        void connect();
+        // Listening side, SYN seen: the dialer said on another channel that it
+        // got our answer (its STATE back may have been lost). Establishes now;
+        // the callback runs on this thread. False if there's no SYN to confirm.
+        bool confirm();
+
+        // For logs.
+        size_t cwnd() const;
+        double queuingDelayMs() const;
+
+    private:
+        friend class UdpMux;
+        UdpTransport(UdpMux& mux, uint32_t connId, const sockaddr_storage* to, socklen_t toLen);
+        void fireEstablished_();
+
+        struct Packet {
+            uint32_t seq = 0;
+            std::vector<uint8_t> data;
+            int64_t sentUs = 0;
+            int tx = 0;           // times sent
+            bool sacked = false;
+            bool fastRetx = false;
+        };
+
+        UdpMux& mux_;
+        const uint32_t connId_;
+        mutable std::mutex mtx_;
+        std::condition_variable cv_;
+        sockaddr_storage peer_{};
+        socklen_t peerLen_ = 0;        // 0 until the SYN tells us (listening side)
+        bool connecting_ = false, established_ = false;
+        bool closed_ = false, peerClosed_ = false, failed_ = false;
+        int64_t synAtUs_ = 0;
+        int synTries_ = 0;
+
+        // Send side. sendQ_ holds every unacked packet in order; [0, sendNext_) went out.
+        std::deque<Packet> sendQ_;
+        size_t sendNext_ = 0;
+        size_t queuedBytes_ = 0;
+        size_t flight_ = 0;            // sent, neither acked nor sacked
+        uint32_t nextSeq_ = 1;
+        uint32_t peerWnd_;
+        double cwnd_, ssthresh_;
+        bool inRecovery_ = false;
+        uint32_t recoverSeq_ = 0;
+        double srttUs_ = 0, rttVarUs_ = 0;
+        bool haveRtt_ = false;
+        int64_t rtoUs_;
+
+        // LEDBAT delay filters: per-minute minima (base) and the last few samples (current).
+        std::vector<uint32_t> baseDelays_;
+        int64_t baseMinuteUs_ = 0;
+        std::deque<uint32_t> curDelays_;
+        uint32_t queuingUs_ = 0;
+
+        // Receive side.
+        uint32_t ackNext_ = 1;
+        std::map<uint32_t, std::vector<uint8_t>> ooo_;
+        size_t oooBytes_ = 0;
+        std::deque<std::vector<uint8_t>> rq_;
+        size_t rqOff_ = 0, rqBytes_ = 0;
+        uint32_t lastDelayUs_ = 0;     // arrival - ts of the latest DATA, echoed back
+        uint32_t advertised_ = 0;      // last window we told them
+
+        std::mutex cbMtx_;
+        OnEstablished onEstablished_;
+
+        // Mux thread.
+        void onPacket_(const uint8_t* p, size_t n, const sockaddr_storage& from, socklen_t fromLen);
+        void tick_(int64_t nowUs);
+
+        // Caller holds mtx_.
+        uint32_t recvWindow_() const;
+        void sendCtl_(uint8_t type, int64_t nowUs);
+        void transmit_(Packet& p, int64_t nowUs);
+        void trySend_(int64_t nowUs);
+        void onAck_(uint32_t ack, uint32_t sack, uint32_t wnd, uint32_t tsDiff, int64_t nowUs);
+        void onData_(uint32_t seq, const uint8_t* p, size_t n);
+        void onDelay_(uint32_t sample, int64_t nowUs);
+        void onRtt_(int64_t us);
+        void fail_();
+    };
+
+    // One UDP socket per process, shared by every UdpTransport (demultiplexed
+    // by connection id), with one thread for receive and retransmit timers.
+    class UdpMux {
+    public:
+        ~UdpMux();
+
+        // Binds `port` on all IPv4 addresses. Throws std::runtime_error on failure.
+        void start(int port, int targetDelayMs = 100);
+        void stop();
+        bool running() const { return running_.load(); }
+        int port() const { return port_; }
+        int targetDelayUs() const { return targetUs_; }
+
+        // Listening end for connId (learns the address from the SYN), or the
+        // connecting end aimed at host:port. Null if the id is taken or host
+        // doesn't resolve.
+        std::shared_ptr<UdpTransport> open(uint32_t connId);
+        std::shared_ptr<UdpTransport> open(uint32_t connId, const std::string& host, int port);
+
+        uint32_t newConnId();
+
+    private:
+        friend class UdpTransport;
+
+        std::atomic<bool> running_{false};
+        socket_t sock_ = -1;
+        int port_ = 0;
+        int targetUs_ = 100000;
+        std::thread thr_;
+        std::mutex mtx_;
+        std::map<uint32_t, std::weak_ptr<UdpTransport>> conns_;
+        std::mt19937 rng_{std::random_device{}()};
+
+        void loop_();
+        void send_(const uint8_t* p, size_t n, const sockaddr_storage& to, socklen_t toLen);
+        void remove_(uint32_t connId, const UdpTransport* t);
+        std::shared_ptr<UdpTransport> register_(std::shared_ptr<UdpTransport> t);
+    };
+
+    // Started by peerProcess when UdpTransport is on.
+    extern UdpMux gUdpMux;
+
+} // namespace p2p
+
+#endif // P2P_UDP_TRANSPORT_HPP
@@ -0,0 +1,73 @@
+#ifndef P2P_WORK_POOL_HPP
+#define P2P_WORK_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace p2p {
+
+    // Work-stealing thread pool for disk and CPU work (piece reads/writes, codec).
+    // Each worker has its own deque: tasks posted from a worker go on the front of
+    // that worker's deque and are popped LIFO (cache-warm); tasks from other threads
+    // are spread round-robin on the back. An idle worker steals from the back of
+    // the others, so one busy connection can use every core.
+    class WorkPool {
+    public:
+        using Task = std::function<void()>;
+
+        ~WorkPool();
+
+        // threads == 0: one per core.
+        void start(size_t threads = 0);
+
+        // Runs whatever is still queued, then joins the workers.
+        void stop();
+
+        // Tasks must not block for long (no socket waits): they share a few threads.
+        // Before start() (or after stop()) the task runs inline on the caller.
+        void post(Task t);
+
+        // Like post(), with the result (or exception) delivered through a future.
+        template<class F>
+        auto submit(F&& f) -> std::future<decltype(f())> {
+            using R = decltype(f());
+            auto job = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+            auto fut = job->get_future();
+            post([job]{ (*job)(); });
+            return fut;
+        }
+
+        size_t size() const { return threads_.size(); }
+
+    private:
+        struct Worker {
+            std::mutex mtx;
+            std::deque<Task> q;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers_;
+        std::vector<std::thread> threads_;
+        std::atomic<bool> running_{false};
+
+        std::atomic<size_t> pending_{0}; // queued, not yet picked up
+        std::atomic<size_t> next_{0};    // round-robin for outside posts
+        std::mutex sleepMtx_;
+        std::condition_variable sleepCv_;
+
+        bool tryPop_(size_t self, Task& out);
+        void run_(size_t self);
+    };
+
+    // Shared by every connection and swarm. Started in peerProcess.cpp.
+    extern WorkPool gWorkPool;
+
+} // namespace p2p
+
+#endif // P2P_WORK_POOL_HPP
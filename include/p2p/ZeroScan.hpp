@@ -0,0 +1,19 @@
+#ifndef P2P_ZERO_SCAN_HPP
+#define P2P_ZERO_SCAN_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace p2p {
+
+    // True if all n bytes are zero. ORs whole vectors together (AVX2, SSE2 or
+    // NEON, picked at startup) and gives up at the first block with a set bit,
+    // so pieces with data in them cost next to nothing.
+    bool allZero(const uint8_t* p, size_t n);
+
+    // Kernel in use: "avx2", "sse2", "neon" or "scalar", for logging.
+    const char* allZeroBackend();
+
+} // namespace p2p
+
+#endif // P2P_ZERO_SCAN_HPP
@@ -0,0 +1,250 @@
+#include "p2p/CompactBitfield.hpp"
+
+#include <algorithm>
+
+namespace p2p {
+
+    void CompactBitfield::reset(size_t pieces){
+        pieces_ = pieces;
+        chunks_.assign((pieces + CHUNK_SIZE - 1) / CHUNK_SIZE, Chunk{});
+    }
+
+    size_t CompactBitfield::chunkWidth_(size_t c) const{
+        return std::min(CHUNK_SIZE, pieces_ - c * CHUNK_SIZE);
+    }
+
+    bool CompactBitfield::has(size_t idx) const{
+        if (idx >= pieces_) throw std::out_of_range("bitfield index");
+        const Chunk& ch = chunks_[idx >> CHUNK_BITS];
+        uint32_t off = static_cast<uint32_t>(idx & (CHUNK_SIZE - 1));
+        switch (ch.kind) {
+            case Chunk::EMPTY: return false;
+            case Chunk::FULL: return true;
+            case Chunk::BITMAP: return (ch.bits[off >> 6] >> (off & 63)) & 1U;
+            case Chunk::RUNS: {
+                // last run starting at or before off
+                auto it = std::upper_bound(ch.runs.begin(), ch.runs.end(), off,
+                    [](uint32_t v, const Run& r){ return v < r.first; });
+                if (it == ch.runs.begin()) return false;
+                --it;
+                return off <= it->last;
+            }
+        }
+        return false;
+    }
+
+    size_t CompactBitfield::count() const{
+        size_t n = 0;
+        for (const auto& ch : chunks_) n += ch.count;
+        return n;
+    }
+
+    void CompactBitfield::setRange(size_t begin, size_t end){
+        if (begin >= end) return;
+        if (end > pieces_) throw std::out_of_range("bitfield index");
+        while (begin < end) {
+            size_t c = begin >> CHUNK_BITS;
+            size_t chunkEnd = std::min(end, (c + 1) * CHUNK_SIZE);
+            setInChunk_(c, static_cast<uint32_t>(begin - c * CHUNK_SIZE),
+                           static_cast<uint32_t>(chunkEnd - 1 - c * CHUNK_SIZE));
+            begin = chunkEnd;
+        }
+    }
+
+    void CompactBitfield::toBitmap_(Chunk& ch){
+        ch.bits.assign(CHUNK_SIZE / 64, 0);
+        for (const auto& r : ch.runs) {
+            for (uint32_t i = r.first; i <= r.last; ++i) ch.bits[i >> 6] |= uint64_t(1) << (i & 63);
+        }
+        ch.runs.clear();
+        ch.runs.shrink_to_fit();
+        ch.kind = Chunk::BITMAP;
+    }
+
+    void CompactBitfield::setInChunk_(size_t c, uint32_t first, uint32_t last){
+        Chunk& ch = chunks_[c];
+        uint32_t width = static_cast<uint32_t>(chunkWidth_(c));
+
+        if (ch.kind == Chunk::FULL) return;
+
+        if (first == 0 && last + 1 == width) {
+            ch = Chunk{};
+            ch.kind = Chunk::FULL;
+            ch.count = width;
+            return;
+        }
+
+        if (ch.kind == Chunk::BITMAP) {
+            for (uint32_t i = first; i <= last; ++i) {
+                uint64_t& w = ch.bits[i >> 6];
+                uint64_t m = uint64_t(1) << (i & 63);
+                if (!(w & m)) { w |= m; ++ch.count; }
+            }
+        } else {
+            // EMPTY or RUNS: merge [first, last] with any overlapping/adjacent runs.
+            ch.kind = Chunk::RUNS;
+            auto& runs = ch.runs;
+            auto lo = std::lower_bound(runs.begin(), runs.end(), first,
+                [](const Run& r, uint32_t v){ return uint32_t(r.last) + 1 < v; });
+            auto hi = lo;
+            uint32_t f = first, l = last;
+            while (hi != runs.end() && hi->first <= l + 1) {
+                f = std::min<uint32_t>(f, hi->first);
+                l = std::max<uint32_t>(l, hi->last);
+                ch.count -= uint32_t(hi->last) - hi->first + 1;
+                ++hi;
+            }
+            ch.count += l - f + 1;
+            auto at = runs.erase(lo, hi);
+            runs.insert(at, Run{static_cast<uint16_t>(f), static_cast<uint16_t>(l)});
+
+            if (runs.size() > MAX_RUNS) toBitmap_(ch);
+        }
+
+        if (ch.count == width) {
+            ch = Chunk{};
+            ch.kind = Chunk::FULL;
+            ch.count = width;
+        }
+    }
+
+    void CompactBitfield::forEachRange(const std::function<bool(size_t, size_t)>& fn) const{
+        // Ranges are coalesced across chunk boundaries before being reported.
+        size_t pendBegin = 0, pendEnd = 0;
+        bool pending = false;
+        bool stopped = false;
+        auto emit = [&](size_t b, size_t e){
+            if (pending && pendEnd == b) { pendEnd = e; return; }
+            if (pending && !fn(pendBegin, pendEnd)) { stopped = true; return; }
+            pendBegin = b; pendEnd = e; pending = true;
+        };
+
+        for (size_t c = 0; c < chunks_.size() && !stopped; ++c) {
+            const Chunk& ch = chunks_[c];
+            size_t base = c * CHUNK_SIZE;
+            size_t width = chunkWidth_(c);
+            switch (ch.kind) {
+                case Chunk::EMPTY:
+                    break;
+                case Chunk::FULL:
+                    emit(base, base + width);
+                    break;
+                case Chunk::RUNS:
+                    for (const auto& r : ch.runs) {
+                        emit(base + r.first, base + r.last + 1);
+                        if (stopped) break;
+                    }
+                    break;
+                case Chunk::BITMAP: {
+                    size_t i = 0;
+                    while (i < width && !stopped) {
+                        // skip clear bits
+                        uint64_t w = ch.bits[i >> 6] >> (i & 63);
+                        if (w == 0) { i = ((i >> 6) + 1) << 6; continue; }
+                        i += size_t(__builtin_ctzll(w));
+                        if (i >= width) break;
+                        size_t s = i;
+                        // skip set bits
+                        while (i < width) {
+                            uint64_t x = ~ch.bits[i >> 6] >> (i & 63);
+                            if (x == 0) { i = ((i >> 6) + 1) << 6; continue; }
+                            i += size_t(__builtin_ctzll(x));
+                            break;
+                        }
+                        emit(base + s, base + std::min(i, width));
+                    }
+                    break;
+                }
+            }
+        }
+        if (pending && !stopped) fn(pendBegin, pendEnd);
+    }
+
+    size_t CompactBitfield::memoryBytes() const{
+        size_t n = sizeof(*this) + chunks_.capacity() * sizeof(Chunk);
+        for (const auto& ch : chunks_) {
+            n += ch.runs.capacity() * sizeof(Run) + ch.bits.capacity() * sizeof(uint64_t);
+        }
+        return n;
+    }
+
+    CompactBitfield CompactBitfield::fromBytes(const std::vector<uint8_t>& bytes, size_t pieces){
+        CompactBitfield bf(pieces);
+        auto bitAt = [&](size_t i) -> bool {
+            size_t byte = i / 8;
+            return byte < bytes.size() && ((bytes[byte] >> (7 - (i % 8))) & 1U);
+        };
+        size_t i = 0;
+        while (i < pieces) {
+            // whole 0x00 bytes are skipped at once, likewise 0xFF below
+            while (i < pieces) {
+                if (i % 8 == 0 && (i / 8 >= bytes.size() || bytes[i / 8] == 0x00)) { i += 8; continue; }
+                if (bitAt(i)) break;
+                ++i;
+            }
+            if (i >= pieces) break;
+            size_t s = i;
+            while (i < pieces) {
+                if (i % 8 == 0 && i / 8 < bytes.size() && bytes[i / 8] == 0xFF) { i += 8; continue; }
+                if (!bitAt(i)) break;
+                ++i;
+            }
+            bf.setRange(s, std::min(i, pieces));
+        }
+        return bf;
+    }
+
+    std::vector<uint8_t> CompactBitfield::toBytes() const{
+        std::vector<uint8_t> out((pieces_ + 7) / 8, 0);
+        forEachRange([&](size_t b, size_t e){
+            for (size_t i = b; i < e; ++i) out[i / 8] |= static_cast<uint8_t>(1u << (7 - (i % 8)));
+            return true;
+        });
+        return out;
+    }
+
+    static void putVarint(std::vector<uint8_t>& out, uint64_t v){
+        while (v >= 0x80) { out.push_back(static_cast<uint8_t>(v | 0x80)); v >>= 7; }
+        out.push_back(static_cast<uint8_t>(v));
+    }
+
+    static uint64_t getVarint(const uint8_t* data, size_t n, size_t& pos){
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= n) throw std::runtime_error("Truncated run-length bitfield");
+            uint8_t b = data[pos++];
+            v |= uint64_t(b & 0x7F) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        throw std::runtime_error("Bad varint in run-length bitfield");
+    }
+
+    std::vector<uint8_t> CompactBitfield::encodeRuns() const{
+        std::vector<uint8_t> out;
+        size_t pos = 0;
+        forEachRange([&](size_t b, size_t e){
+            putVarint(out, b - pos);
+            putVarint(out, e - b);
+            pos = e;
+            return true;
+        });
+        return out;
+    }
+
+    CompactBitfield CompactBitfield::decodeRuns(const uint8_t* data, size_t n, size_t pieces){
+        CompactBitfield bf(pieces);
+        size_t pos = 0, p = 0;
+        while (p < n) {
+            uint64_t clear = getVarint(data, n, p);
+            if (clear > pieces - pos) throw std::runtime_error("Run-length bitfield too long");
+            pos += size_t(clear);
+            if (p >= n) break;
+            uint64_t set = getVarint(data, n, p);
+            if (set > pieces - pos) throw std::runtime_error("Run-length bitfield too long");
+            bf.setRange(pos, pos + size_t(set));
+            pos += size_t(set);
+        }
+        return bf;
+    }
+
+} // namespace p2p
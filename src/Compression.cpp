@@ -0,0 +1,164 @@
+#include "p2p/Compression.hpp"
+
+#include <cstring>
+
+#if defined(P2P_HAVE_LZ4)
+#include <lz4.h>
+#endif
+
+namespace p2p {
+namespace lz4 {
+
+#if defined(P2P_HAVE_LZ4)
+
+    std::vector<uint8_t> compress(const uint8_t* src, size_t n){
+        if (n < 2) return {};
+        // Capacity n-1: liblz4 returns 0 when the output doesn't fit,
+        // which is exactly our "didn't shrink" case.
+        std::vector<uint8_t> out(n - 1);
+        int r = LZ4_compress_default(reinterpret_cast<const char*>(src),
+                                     reinterpret_cast<char*>(out.data()),
+                                     int(n), int(out.size()));
+        if (r <= 0) return {};
+        out.resize(size_t(r));
+        return out;
+    }
+
+    bool decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t dstSize){
+        int r = LZ4_decompress_safe(reinterpret_cast<const char*>(src),
+                                    reinterpret_cast<char*>(dst),
+                                    int(n), int(dstSize));
+        return r >= 0 && size_t(r) == dstSize;
+    }
+
+    const char* backend(){ return "system"; }
+
+#else
+
+    // Minimal greedy LZ4 block encoder. Not as tight as liblz4, but
+    // the output is a valid LZ4 block that either side can decode.
+    static constexpr size_t MINMATCH = 4;
+    static constexpr size_t LASTLITERALS = 5;
+    static constexpr size_t MFLIMIT = 12;
+    static constexpr size_t MAX_OFFSET = 65535;
+    static constexpr int HASH_LOG = 12;
+
+    static uint32_t read32(const uint8_t* p){ uint32_t v; std::memcpy(&v, p, 4); return v; }
+    static uint32_t hash4(uint32_t v){ return (v * 2654435761u) >> (32 - HASH_LOG); }
+
+    static void putLen(std::vector<uint8_t>& out, size_t len){
+        while (len >= 255) { out.push_back(255); len -= 255; }
+        out.push_back(static_cast<uint8_t>(len));
+    }
+
+    static void emitSequence(std::vector<uint8_t>& out, const uint8_t* lit, size_t litLen,
+                             size_t offset, size_t matchLen){
+        size_t ml = matchLen - MINMATCH;
+        uint8_t token = static_cast<uint8_t>((litLen >= 15 ? 15 : litLen) << 4);
+        token |= static_cast<uint8_t>(ml >= 15 ? 15 : ml);
+        out.push_back(token);
+        if (litLen >= 15) putLen(out, litLen - 15);
+        out.insert(out.end(), lit, lit + litLen);
+        out.push_back(static_cast<uint8_t>(offset & 0xFF));
+        out.push_back(static_cast<uint8_t>((offset >> 8) & 0xFF));
+        if (ml >= 15) putLen(out, ml - 15);
+    }
+
+    static void emitLast(std::vector<uint8_t>& out, const uint8_t* lit, size_t litLen){
+        out.push_back(static_cast<uint8_t>((litLen >= 15 ? 15 : litLen) << 4));
+        if (litLen >= 15) putLen(out, litLen - 15);
+        out.insert(out.end(), lit, lit + litLen);
+    }
+
+    std::vector<uint8_t> compress(const uint8_t* src, size_t n){
+        if (n <= MFLIMIT) return {};
+
+        std::vector<uint8_t> out;
+        out.reserve(n);
+        // table stores position+1 so that 0 means "empty"
+        std::vector<uint32_t> table(size_t(1) << HASH_LOG, 0);
+
+        size_t ip = 0, anchor = 0;
+        const size_t matchLimit = n - LASTLITERALS;
+        const size_t lastStart = n - MFLIMIT;
+
+        while (ip <= lastStart) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = hash4(seq);
+            size_t cand = table[h];
+            table[h] = static_cast<uint32_t>(ip + 1);
+
+            if (cand == 0 || ip - (cand - 1) > MAX_OFFSET || read32(src + cand - 1) != seq) {
+                ++ip;
+                continue;
+            }
+
+            size_t ref = cand - 1;
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) { --ip; --ref; }
+
+            size_t m = ip + MINMATCH, r = ref + MINMATCH;
+            while (m < matchLimit && src[m] == src[r]) { ++m; ++r; }
+
+            emitSequence(out, src + anchor, ip - anchor, ip - ref, m - ip);
+            if (out.size() >= n) return {};
+
+            ip = m;
+            anchor = ip;
+        }
+
+        emitLast(out, src + anchor, n - anchor);
+        if (out.size() >= n) return {};
+        return out;
+    }
+
+    bool decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t dstSize){
+        size_t ip = 0, op = 0;
+        while (ip < n) {
+            uint8_t token = src[ip++];
+
+            size_t litLen = token >> 4;
+            if (litLen == 15) {
+                uint8_t b;
+                do {
+                    if (ip >= n) return false;
+                    b = src[ip++];
+                    litLen += b;
+                } while (b == 255);
+            }
+            if (litLen > n - ip || litLen > dstSize - op) return false;
+            std::memcpy(dst + op, src + ip, litLen);
+            ip += litLen; op += litLen;
+
+            if (ip == n) break; // last sequence has no match part
+
+            if (n - ip < 2) return false;
+            size_t offset = size_t(src[ip]) | (size_t(src[ip + 1]) << 8);
+            ip += 2;
+            if (offset == 0 || offset > op) return false;
+
+            size_t matchLen = token & 0x0F;
+            if (matchLen == 15) {
+                uint8_t b;
+                do {
+                    if (ip >= n) return false;
+                    b = src[ip++];
+                    matchLen += b;
+                } while (b == 255);
+            }
+            matchLen += MINMATCH;
+            if (matchLen > dstSize - op) return false;
+
+            // byte copy: source and destination may overlap
+            const uint8_t* from = dst + op - offset;
+            for (size_t i = 0; i < matchLen; ++i) dst[op + i] = from[i];
+            op += matchLen;
+        }
+        return op == dstSize;
+    }
+
+    const char* backend(){ return "builtin"; }
+
+#endif
+
+} // namespace lz4
+} // namespace p2p
@@ -33,6 +33,38 @@ namespace p2p {
             else if (key=="FileName") c.fileName = val;
             else if (key=="FileSize") c.fileSizeBytes = std::stoll(val);
             else if (key=="PieceSize") c.pieceSizeBytes = std::stoi(val);
+            else if (key=="CompressPieces") c.compressPieces = (std::stoi(val) != 0);
+            else if (key=="MaxUploadRate") c.maxUploadRate = std::stoll(val);
+            else if (key=="ConnectTimeoutMs") c.connectTimeoutMs = std::stoi(val);
+            else if (key=="ConnectRetries") c.connectRetries = std::stoi(val);
+            else if (key=="ConnectBackoffMs") c.connectBackoffMs = std::stoi(val);
+            else if (key=="ConnectBackoffMaxMs") c.connectBackoffMaxMs = std::stoi(val);
+            else if (key=="MaxConnections") c.maxConnections = std::stoi(val);
+            else if (key=="IdleTimeoutSec") c.idleTimeoutSec = std::stoi(val);
+            else if (key=="MaxNeighbors") c.maxNeighbors = std::stoi(val);
+            else if (key=="NeighborRefreshSec") c.neighborRefreshSec = std::stoi(val);
+            else if (key=="SendQueueKB") c.sendQueueKB = std::stoi(val);
+            else if (key=="DirectIO") c.directIO = (std::stoi(val) != 0);
+            else if (key=="WorkerThreads") c.workerThreads = std::stoi(val);
+            else if (key=="StreamTo") c.streamTo = val;
+            else if (key=="StreamWindow") c.streamWindow = std::stoi(val);
+            else if (key=="SuperSeed") c.superSeed = (std::stoi(val) != 0);
+            else if (key=="ErasureStripe") c.erasureStripe = std::stoi(val);
+            else if (key=="ErasureParity") c.erasureParity = std::stoi(val);
+            else if (key=="DeltaFrom") c.deltaFrom = val;
+            else if (key=="DeltaWaitSec") c.deltaWaitSec = std::stoi(val);
+            else if (key=="ZeroPieces") c.zeroPieces = (std::stoi(val) != 0);
+            else if (key=="PexIntervalSec") c.pexIntervalSec = std::stoi(val);
+            else if (key=="KeepAliveSec") c.keepAliveSec = std::stoi(val);
+            else if (key=="DeadPeerSec") c.deadPeerSec = std::stoi(val);
+            else if (key=="LocalTransport") c.localTransport = (std::stoi(val) != 0);
+            else if (key=="UdpTransport") c.udpTransport = (std::stoi(val) != 0);
+            else if (key=="LedbatTargetMs") c.ledbatTargetMs = std::stoi(val);
+            else if (key=="UdpRoute") { std::string via; iss >> via; c.udpRoutes[std::stoi(val)] = via; }
+            else if (key=="TcpRoute") { std::string via; iss >> via; c.tcpRoutes[std::stoi(val)] = via; }
+            else if (key=="RecordTo") c.recordTo = val;
+            else if (key=="RecordPayloads") c.recordPayloads = (std::stoi(val) != 0);
+            else if (key=="ProfileSampleHz") c.profileSampleHz = std::stoi(val);
         }
         return c;
     }
@@ -51,27 +83,60 @@ namespace p2p {
             r.hasFile = (has==1);
             cfg.rows.push_back(std::move(r));
         }
+        cfg.reindex();
+        return cfg;
+    }
+
+    void PeerInfoCfg::reindex() {
+        byId.clear();
+        byId.reserve(rows.size());
+        for (size_t i=0;i<rows.size();++i) byId.emplace(rows[i].peerId, i);
+    }
+
+    SwarmCfg SwarmCfg::fromFile(const std::string& path) {
+        SwarmCfg cfg;
+        std::ifstream in(path);
+        if (!in) return cfg;
+        std::string line;
+        while (std::getline(in, line)) {
+            line = trim(line);
+            if (line.empty() || line[0]=='#') continue;
+            std::istringstream iss(line);
+            SwarmRow r; long long id = 0;
+            iss >> id >> r.fileName >> r.fileSizeBytes >> r.pieceSizeBytes;
+            if (!iss || id <= 0) throw std::runtime_error("Bad line in Swarms.cfg: " + line);
+            r.swarmId = static_cast<uint32_t>(id);
+            cfg.rows.push_back(std::move(r));
+        }
         return cfg;
     }
 
     std::optional<PeerInfoRow> PeerInfoCfg::findById(int peerId) const {
-        for (const auto& r: rows) if (r.peerId==peerId) return r;
-        return std::nullopt;
+        auto it = byId.find(peerId);
+        if (it==byId.end()) return std::nullopt;
+        return rows[it->second];
     }
 
     std::vector<PeerInfoRow> PeerInfoCfg::earlierPeers(int peerId) const {
-        std::vector<PeerInfoRow> out;
-        size_t idx=0, selfIdx=rows.size();
-        for (; idx<rows.size(); ++idx) if (rows[idx].peerId==peerId){ selfIdx=idx; break; }
-        for (size_t i=0;i<rows.size() && i<selfIdx;++i) out.push_back(rows[i]);
-        return out;
+        auto it = byId.find(peerId);
+        size_t selfIdx = (it==byId.end()) ? rows.size() : it->second;
+        return std::vector<PeerInfoRow>(rows.begin(), rows.begin() + static_cast<long>(selfIdx));
     }
 
-    ConfigBundle ConfigBundle::load(int selfId, const std::string& commonPath, const std::string& peersPath, const std::string& workDir) {
+    ConfigBundle ConfigBundle::load(int selfId, const std::string& commonPath, const std::string& peersPath, const std::string& workDir,
+                                    int joinPort) {
         ConfigBundle b; b.selfId = selfId; b.common = CommonConfig::fromFile(commonPath); b.peers = PeerInfoCfg::fromFile(peersPath);
         auto me = b.peers.findById(selfId);
-        if (!me) throw std::runtime_error("Self peerId not found in PeerInfo.cfg");
-        b.self = *me;
+        if (me) {
+            b.self = *me;
+        } else if (joinPort > 0) {
+            b.self.peerId = selfId;
+            b.self.port = joinPort;
+            b.self.hasFile = false;
+        } else {
+            throw std::runtime_error("Self peerId not found in PeerInfo.cfg (give a listen port to join via PEX)");
+        }
+        b.swarms = SwarmCfg::fromFile((fs::path(commonPath).parent_path() / "Swarms.cfg").string());
 
         fs::path root = workDir;
         b.paths.workDir = root.string();
@@ -0,0 +1,202 @@
+#include "p2p/ConnectionManager.hpp"
+
+#include <algorithm>
+#include <set>
+
+namespace p2p {
+
+    // A connection this young hasn't had a chance to exchange interest yet.
+    static constexpr std::chrono::seconds EVICT_GRACE{10};
+
+    ConnectionManager::ConnectionManager(int selfId, Logger& logger, ConnectionLimits limits)
+    : selfId_(selfId),
+      logger_(logger),
+      limits_(limits) {}
+
+    ConnectionManager::~ConnectionManager(){ closeAll(); }
+
+    void ConnectionManager::setOnLost(OnLost fn){
+        std::lock_guard<std::mutex> lk(mtx_);
+        onLost_ = std::move(fn);
+    }
+
+    bool ConnectionManager::adopt(std::unique_ptr<ConnectionHandler> h){
+        std::unique_ptr<ConnectionHandler> refused;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            size_t live = static_cast<size_t>(std::count_if(conns_.begin(), conns_.end(),
+                [](const auto& c){ return !c->finished(); }));
+
+            if (live >= limits_.maxConnections) {
+                ConnectionHandler* victim = pickVictim_();
+                if (victim) {
+                    logger_.info("Connection limit reached; evicting idle peer " +
+                                 std::to_string(victim->remotePeerId()) + ".");
+                    victim->retire();
+                } else {
+                    refused = std::move(h);
+                }
+            }
+
+            if (!refused) {
+                h->setManager(this);
+                h->start();
+                conns_.push_back(std::move(h));
+                return true;
+            }
+        }
+        logger_.info("Connection limit reached; refusing new connection.");
+        return false; // `refused` closes its socket on the way out
+    }
+
+    // Prefer peers neither side is interested in; otherwise whoever has been
+    // silent longest, as long as it's been silent a while.
+    ConnectionHandler* ConnectionManager::pickVictim_() const{
+        auto now = std::chrono::steady_clock::now();
+        ConnectionHandler* useless = nullptr;
+        ConnectionHandler* idlest = nullptr;
+        for (const auto& c : conns_) {
+            if (c->finished() || c->remotePeerId() < 0) continue;
+            auto idle = now - c->lastActivity();
+            if (idle < EVICT_GRACE) continue;
+            if (!c->amInterested() && !c->peerInterested()) {
+                if (!useless || c->lastActivity() < useless->lastActivity()) useless = c.get();
+            }
+            if (idle >= std::chrono::seconds(limits_.idleTimeoutSec) / 2) {
+                if (!idlest || c->lastActivity() < idlest->lastActivity()) idlest = c.get();
+            }
+        }
+        return useless ? useless : idlest;
+    }
+
+    bool ConnectionManager::registerPeer(ConnectionHandler& h){
+        int remote = h.remotePeerId();
+        std::lock_guard<std::mutex> lk(mtx_);
+
+        if (remote == selfId_) {
+            logger_.info("Dropping connection to ourselves.");
+            return false;
+        }
+
+        auto key = std::make_pair(h.swarmId(), remote);
+        auto it = byPeer_.find(key);
+        if (it == byPeer_.end() || it->second->finished()) {
+            byPeer_[key] = &h;
+            return true;
+        }
+
+        // Duplicate. Both ends apply the same rule so they agree on the survivor:
+        // keep the connection opened by the lower peer id; if both were opened
+        // by the same side (a reconnect), keep the newer one.
+        ConnectionHandler* old = it->second;
+        auto initiator = [&](const ConnectionHandler& c){ return c.incoming() ? remote : selfId_; };
+        bool keepNew = initiator(h) == initiator(*old) || initiator(h) == std::min(selfId_, remote);
+
+        logger_.info("Duplicate connection with peer " + std::to_string(remote) + "; keeping the " +
+                     (keepNew ? "new" : "existing") + " one.");
+        if (!keepNew) return false;
+
+        old->retire();
+        byPeer_[key] = &h;
+        return true;
+    }
+
+    bool ConnectionManager::connectedTo(int peerId, uint32_t swarmId) const{
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = byPeer_.find(std::make_pair(swarmId, peerId));
+        return it != byPeer_.end() && !it->second->finished();
+    }
+
+    void ConnectionManager::forEach(const std::function<void(ConnectionHandler&)>& fn) const{
+        std::vector<ConnectionHandler*> live;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            for (const auto& c : conns_) if (!c->finished()) live.push_back(c.get());
+            ++walkers_;
+        }
+        struct Done {
+            const ConnectionManager& m;
+            ~Done(){
+                std::lock_guard<std::mutex> lk(m.mtx_);
+                if (--m.walkers_ == 0) m.walkersCv_.notify_all();
+            }
+        } done{*this};
+        for (ConnectionHandler* h : live) fn(*h);
+    }
+
+    void ConnectionManager::unregister_(ConnectionHandler* h){
+        auto it = byPeer_.find(std::make_pair(h->swarmId(), h->remotePeerId()));
+        if (it != byPeer_.end() && it->second == h) byPeer_.erase(it);
+    }
+
+    void ConnectionManager::reap(){
+        std::vector<std::unique_ptr<ConnectionHandler>> dead;
+        std::set<std::pair<uint32_t, int>> lost; // (swarm, peer)
+        OnLost onLost;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            auto now = std::chrono::steady_clock::now();
+            auto idleLimit = std::chrono::seconds(limits_.idleTimeoutSec);
+            for (auto& c : conns_) {
+                if (c->finished()) {
+                    unregister_(c.get());
+                    int peer = c->remotePeerId();
+                    if (!c->incoming() && !c->retired() && peer >= 0 && peer != selfId_) {
+                        lost.insert(std::make_pair(c->swarmId(), peer));
+                    }
+                    dead.push_back(std::move(c));
+                } else if (limits_.idleTimeoutSec > 0 && now - c->lastActivity() > idleLimit &&
+                           !c->amInterested() && !c->peerInterested()) {
+                    logger_.info("Closing idle, uninterested connection to peer " +
+                                 std::to_string(c->remotePeerId()) + ".");
+                    c->retire(); // freed on a later reap, once its thread exits
+                }
+            }
+            conns_.erase(std::remove(conns_.begin(), conns_.end(), nullptr), conns_.end());
+            // Not lost if a newer connection already took its place.
+            for (auto it = lost.begin(); it != lost.end();) {
+                auto live = byPeer_.find(*it);
+                if (live != byPeer_.end() && !live->second->finished()) it = lost.erase(it);
+                else ++it;
+            }
+            onLost = onLost_;
+            // A forEach may still be using them; free them on a reap when none is.
+            if (walkers_ > 0) {
+                for (auto& d : dead) graveyard_.push_back(std::move(d));
+                dead.clear();
+            } else {
+                for (auto& d : graveyard_) dead.push_back(std::move(d));
+                graveyard_.clear();
+            }
+        }
+        // Joining threads and waiting on uploads happens outside the lock.
+        dead.clear();
+        if (onLost) {
+            for (const auto& [swarm, peer] : lost) onLost(peer, swarm);
+        }
+    }
+
+    void ConnectionManager::closeAll(){
+        std::vector<std::unique_ptr<ConnectionHandler>> all;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            all.swap(conns_);
+            for (auto& d : graveyard_) all.push_back(std::move(d));
+            graveyard_.clear();
+            byPeer_.clear();
+        }
+        for (auto& c : all) c->close();
+        {
+            // Closed sockets make any send in a forEach fail fast.
+            std::unique_lock<std::mutex> lk(mtx_);
+            walkersCv_.wait(lk, [this]{ return walkers_ == 0; });
+        }
+        all.clear();
+    }
+
+    size_t ConnectionManager::size() const{
+        std::lock_guard<std::mutex> lk(mtx_);
+        return conns_.size();
+    }
+
+} // namespace p2p
@@ -0,0 +1,254 @@
+#include "p2p/Connector.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <random>
+#include <set>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <poll.h>
+#include <cerrno>
+#endif
+
+namespace p2p {
+
+    Connector::Connector(Logger& logger, ConnectOptions opts, OnConnected onConnected)
+    : logger_(logger),
+      opts_(opts),
+      onConnected_(std::move(onConnected)) {}
+
+    Connector::~Connector(){ stop(); }
+
+#if defined(_WIN32)
+
+    // Midpoint: not implemented on Windows.
+    void Connector::start(){}
+    void Connector::stop(){}
+    void Connector::add(const Target&){}
+    void Connector::run_(){}
+    void Connector::resolvePending_(clock::time_point){}
+    void Connector::begin_(Attempt&){}
+    void Connector::fail_(Attempt&, const std::string&){}
+    void Connector::finish_(Attempt&){}
+    std::string Connector::key_(const Endpoint& ep){ return ep.host + ":" + std::to_string(ep.port); }
+
+#else
+
+    static bool setBlocking(int fd, bool blocking){
+        int fl = fcntl(fd, F_GETFL, 0);
+        if (fl < 0) return false;
+        fl = blocking ? (fl & ~O_NONBLOCK) : (fl | O_NONBLOCK);
+        return fcntl(fd, F_SETFL, fl) == 0;
+    }
+
+    std::string Connector::key_(const Endpoint& ep){
+        return ep.host + ":" + std::to_string(ep.port);
+    }
+
+    void Connector::start(){
+        if (running_.load()) return;
+        if (::pipe(wake_) != 0) throw std::runtime_error("Connector: pipe failed");
+        setBlocking(wake_[0], false);
+        setBlocking(wake_[1], false);
+        running_.store(true);
+        thr_ = std::thread(&Connector::run_, this);
+    }
+
+    void Connector::stop(){
+        if (!running_.exchange(false)) return;
+        char c = 0;
+        (void)!::write(wake_[1], &c, 1);
+        if (thr_.joinable()) thr_.join();
+        for (auto& a : attempts_) if (a.fd >= 0) ::close(a.fd);
+        attempts_.clear();
+        resolving_.clear(); // waits for lookups still out; they write to wake_[1]
+        ::close(wake_[0]); ::close(wake_[1]);
+        wake_[0] = wake_[1] = -1;
+    }
+
+    void Connector::add(const Target& t){
+        std::lock_guard<std::mutex> lk(mtx_);
+        incoming_.push_back(t);
+        auto route = gNetOptions.tcpRoutes.find(t.peerId);
+        if (route != gNetOptions.tcpRoutes.end()) incoming_.back().ep = route->second;
+        if (wake_[1] >= 0) { char c = 0; (void)!::write(wake_[1], &c, 1); }
+    }
+
+    // getaddrinfo blocks, so every host not yet in the cache is looked up on
+    // its own thread, and the answers are picked up here on later passes.
+    // Attempts for a host still being looked up wait (see resolving_).
+    void Connector::resolvePending_(clock::time_point now){
+        // Answers that are in. A failed lookup leaves no cache entry, so its
+        // attempts fail in begin_ and back off before we ask again.
+        std::set<std::string> justFailed;
+        for (auto it = resolving_.begin(); it != resolving_.end();) {
+            if (it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) { ++it; continue; }
+            auto addrs = it->second.get();
+            if (addrs.empty()) { cache_.erase(it->first); justFailed.insert(it->first); }
+            else cache_[it->first] = Resolved{std::move(addrs), now + RESOLVE_TTL};
+            it = resolving_.erase(it);
+        }
+
+        for (const auto& a : attempts_) {
+            if (a.done || a.fd >= 0 || a.nextAt > now) continue;
+            auto k = key_(a.target.ep);
+            if (resolving_.count(k) || justFailed.count(k)) continue;
+            auto it = cache_.find(k);
+            if (it != cache_.end() && it->second.expires > now) continue;
+            Endpoint ep = a.target.ep;
+            int wakeFd = wake_[1];
+            resolving_[k] = std::async(std::launch::async, [ep, wakeFd]{
+                std::vector<Addr> out;
+                addrinfo hints{}; hints.ai_family = AF_UNSPEC; hints.ai_socktype = SOCK_STREAM;
+                addrinfo* res = nullptr;
+                std::string port = std::to_string(ep.port);
+                if (getaddrinfo(ep.host.c_str(), port.c_str(), &hints, &res) == 0) {
+                    for (addrinfo* rp = res; rp; rp = rp->ai_next) {
+                        Addr ad{rp->ai_family, rp->ai_socktype, rp->ai_protocol, {}};
+                        auto* p = reinterpret_cast<const uint8_t*>(rp->ai_addr);
+                        ad.sa.assign(p, p + rp->ai_addrlen);
+                        out.push_back(std::move(ad));
+                    }
+                    freeaddrinfo(res);
+                }
+                char c = 0;
+                (void)!::write(wakeFd, &c, 1);
+                return out;
+            });
+        }
+    }
+
+    void Connector::begin_(Attempt& a){
+        auto it = cache_.find(key_(a.target.ep));
+        if (it == cache_.end()) { fail_(a, "could not resolve host"); return; }
+
+        const auto& addrs = it->second.addrs;
+        int lastErr = 0;
+        while (a.addrIdx < addrs.size()) {
+            const Addr& ad = addrs[a.addrIdx];
+            int fd = ::socket(ad.family, ad.socktype, ad.protocol);
+            if (fd < 0) { lastErr = errno; ++a.addrIdx; continue; }
+            setBlocking(fd, false);
+            int r = ::connect(fd, reinterpret_cast<const sockaddr*>(ad.sa.data()), socklen_t(ad.sa.size()));
+            if (r == 0 || errno == EINPROGRESS) {
+                a.fd = fd;
+                a.deadline = clock::now() + std::chrono::milliseconds(opts_.timeoutMs);
+                if (r == 0) finish_(a);
+                return;
+            }
+            lastErr = errno;
+            ::close(fd);
+            ++a.addrIdx;
+        }
+        fail_(a, std::strerror(lastErr));
+    }
+
+    void Connector::fail_(Attempt& a, const std::string& why){
+        if (a.fd >= 0) { ::close(a.fd); a.fd = -1; }
+
+        // Another address for this host? Try it right away.
+        auto it = cache_.find(key_(a.target.ep));
+        if (it != cache_.end() && a.addrIdx + 1 < it->second.addrs.size()) {
+            ++a.addrIdx;
+            begin_(a);
+            return;
+        }
+        a.addrIdx = 0;
+        ++a.tries;
+
+        std::string who = "peer " + std::to_string(a.target.peerId) + " (" + key_(a.target.ep) + ")";
+        if (opts_.maxRetries >= 0 && a.tries > opts_.maxRetries) {
+            logger_.error("Giving up connecting to " + who + ": " + why + ".");
+            a.done = true;
+            return;
+        }
+
+        // Exponential backoff with +/-25% jitter so a restarted swarm doesn't stampede.
+        static thread_local std::mt19937 rng{std::random_device{}()};
+        long long delay = opts_.backoffMs;
+        for (int i = 1; i < a.tries && delay < opts_.backoffMaxMs; ++i) delay *= 2;
+        delay = std::min<long long>(delay, opts_.backoffMaxMs);
+        std::uniform_int_distribution<long long> jitter(-delay / 4, delay / 4);
+        delay = std::max<long long>(0, delay + jitter(rng));
+
+        logger_.info("Connect to " + who + " failed (" + why + "); retry in " +
+                     std::to_string(delay) + " ms.");
+        a.nextAt = clock::now() + std::chrono::milliseconds(delay);
+    }
+
+    void Connector::finish_(Attempt& a){
+        int fd = a.fd;
+        a.fd = -1;
+        a.done = true;
+        // Handlers use blocking I/O.
+        setBlocking(fd, true);
+        onConnected_(fd, a.target);
+    }
+
+    void Connector::run_(){
+        while (running_.load()) {
+            {
+                std::lock_guard<std::mutex> lk(mtx_);
+                for (auto& t : incoming_) {
+                    Attempt a;
+                    a.target = t;
+                    a.nextAt = clock::now();
+                    attempts_.push_back(std::move(a));
+                }
+                incoming_.clear();
+            }
+
+            auto now = clock::now();
+            resolvePending_(now);
+
+            for (auto& a : attempts_) {
+                if (!a.done && a.fd < 0 && a.nextAt <= now && !resolving_.count(key_(a.target.ep))) begin_(a);
+            }
+
+            attempts_.erase(std::remove_if(attempts_.begin(), attempts_.end(),
+                                           [](const Attempt& a){ return a.done; }),
+                            attempts_.end());
+
+            // Wait for any connect to complete, a deadline, a retry, or a new target.
+            std::vector<pollfd> pfds;
+            std::vector<Attempt*> owners;
+            pfds.push_back({wake_[0], POLLIN, 0});
+            owners.push_back(nullptr);
+            auto wakeAt = now + std::chrono::seconds(1);
+            for (auto& a : attempts_) {
+                if (a.fd >= 0) {
+                    pfds.push_back({a.fd, POLLOUT, 0});
+                    owners.push_back(&a);
+                    wakeAt = std::min(wakeAt, a.deadline);
+                } else if (!resolving_.count(key_(a.target.ep))) {
+                    wakeAt = std::min(wakeAt, a.nextAt); // else the lookup wakes us
+                }
+            }
+            auto waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(wakeAt - clock::now()).count();
+            ::poll(pfds.data(), nfds_t(pfds.size()), int(std::max<long long>(0, waitMs)));
+
+            if (pfds[0].revents & POLLIN) {
+                char drain[64];
+                while (::read(wake_[0], drain, sizeof(drain)) > 0) {}
+            }
+
+            now = clock::now();
+            for (size_t i = 1; i < pfds.size(); ++i) {
+                Attempt& a = *owners[i];
+                if (pfds[i].revents) {
+                    int err = 0; socklen_t len = sizeof(err);
+                    getsockopt(a.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                    if (err == 0) finish_(a);
+                    else fail_(a, std::strerror(err));
+                } else if (now >= a.deadline) {
+                    fail_(a, "timed out");
+                }
+            }
+        }
+    }
+
+#endif
+
+} // namespace p2p
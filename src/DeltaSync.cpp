@@ -0,0 +1,244 @@
+#include "p2p/DeltaSync.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "p2p/WorkPool.hpp"
+
+namespace p2p {
+
+    uint32_t rollingChecksum(const uint8_t* p, size_t n){
+        uint32_t a = 0, b = 0;
+        for (size_t i = 0; i < n; ++i) {
+            a += p[i];
+            b += static_cast<uint32_t>(n - i) * p[i];
+        }
+        return (a & 0xffff) | (b << 16);
+    }
+
+    static void put32(std::vector<uint8_t>& out, uint32_t v){
+        out.push_back(static_cast<uint8_t>(v >> 24));
+        out.push_back(static_cast<uint8_t>(v >> 16));
+        out.push_back(static_cast<uint8_t>(v >> 8));
+        out.push_back(static_cast<uint8_t>(v));
+    }
+
+    static uint32_t get32(const uint8_t* p){
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+
+    std::vector<uint8_t> PieceManifest::encode() const{
+        std::vector<uint8_t> out;
+        out.reserve(8 + weak.size() * 36);
+        put32(out, pieceSize);
+        put32(out, static_cast<uint32_t>(weak.size()));
+        for (size_t i = 0; i < weak.size(); ++i) {
+            put32(out, weak[i]);
+            out.insert(out.end(), strong[i].begin(), strong[i].end());
+        }
+        return out;
+    }
+
+    PieceManifest PieceManifest::decode(const uint8_t* p, size_t n){
+        if (n < 8) throw std::runtime_error("Truncated MANIFEST");
+        PieceManifest m;
+        m.pieceSize = get32(p);
+        size_t count = get32(p + 4);
+        if ((n - 8) / 36 != count || (n - 8) % 36 != 0) throw std::runtime_error("Truncated MANIFEST");
+        m.weak.resize(count);
+        m.strong.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            const uint8_t* e = p + 8 + i * 36;
+            m.weak[i] = get32(e);
+            std::copy(e + 4, e + 36, m.strong[i].begin());
+        }
+        return m;
+    }
+
+    DeltaSync::DeltaSync(std::shared_ptr<PieceManager> pm, std::string oldPath)
+    : pm_(std::move(pm)), oldPath_(std::move(oldPath)) {
+        std::error_code ec;
+        if (!oldPath_.empty() && std::filesystem::is_regular_file(oldPath_, ec) && !pm_->isComplete()) {
+            state_.store(WAITING);
+        }
+    }
+
+    // Pieces read and hashed per pool task (16 MB at the default piece size).
+    static constexpr size_t MANIFEST_BATCH = 64;
+
+    void DeltaSync::manifest(ManifestReady done){
+        std::vector<uint8_t> payload;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (!manifest_.empty()) {
+                payload = manifest_;
+            } else if (!pm_->isComplete()) {
+                PieceManifest none;
+                none.pieceSize = pm_->dataPieceCount() ? static_cast<uint32_t>(pm_->pieceSize(0)) : 0;
+                payload = none.encode();
+            } else {
+                waiting_.push_back(std::move(done));
+                if (building_) return;
+                building_ = true;
+            }
+        }
+        if (!payload.empty()) { done(payload, ""); return; }
+
+        auto m = std::make_shared<PieceManifest>();
+        size_t n = pm_->dataPieceCount();
+        m->pieceSize = n ? static_cast<uint32_t>(pm_->pieceSize(0)) : 0;
+        m->weak.reserve(n);
+        m->strong.reserve(n);
+        buildFrom_(m, 0);
+    }
+
+    // One batch, then the next one goes to the back of the pool so uploads
+    // and disk writes get a turn in between.
+    void DeltaSync::buildFrom_(std::shared_ptr<PieceManifest> m, size_t from){
+        gWorkPool.post([self = shared_from_this(), m, from]{
+            size_t n = self->pm_->dataPieceCount();
+            size_t end = std::min(n, from + MANIFEST_BATCH);
+            try {
+                for (size_t i = from; i < end; ++i) {
+                    auto data = self->pm_->readPiece(i);
+                    m->weak.push_back(rollingChecksum(data.data(), data.size()));
+                    m->strong.push_back(Sha256::hash(data.data(), data.size()));
+                }
+            } catch (const std::exception& e) {
+                self->finishBuild_({}, e.what());
+                return;
+            }
+            if (end < n) self->buildFrom_(m, end);
+            else self->finishBuild_(m->encode(), "");
+        });
+    }
+
+    void DeltaSync::finishBuild_(std::vector<uint8_t> payload, const std::string& error){
+        std::vector<ManifestReady> waiting;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (error.empty()) manifest_ = payload;
+            building_ = false;
+            waiting.swap(waiting_);
+        }
+        for (auto& done : waiting) done(payload, error);
+    }
+
+    std::optional<std::vector<size_t>> DeltaSync::apply(const uint8_t* p, size_t n){
+        if (state_.load() != WAITING) return std::nullopt;
+        PieceManifest m = PieceManifest::decode(p, n);
+        if (m.weak.empty()) return std::nullopt;
+        if (m.weak.size() != pm_->dataPieceCount() || m.pieceSize != static_cast<uint32_t>(pm_->pieceSize(0))) {
+            throw std::runtime_error("MANIFEST doesn't match this file's pieces");
+        }
+
+        int expect = WAITING;
+        if (!state_.compare_exchange_strong(expect, SCANNING)) return std::nullopt;
+        try {
+            auto reused = scan_(m);
+            state_.store(DONE);
+            return reused;
+        } catch (...) {
+            state_.store(DONE); // fetch whatever the scan didn't get to
+            throw;
+        }
+    }
+
+    bool DeltaSync::giveUp(){
+        int expect = WAITING;
+        return state_.compare_exchange_strong(expect, DONE);
+    }
+
+    // Hash-table filter: 16 bits of the weak sum, as in rsync.
+    static size_t tagOf(uint32_t weak){ return (weak ^ (weak >> 16)) & 0xffff; }
+
+    // Slide a piece-sized window over the old copy one byte at a time. A window
+    // whose weak sum and then SHA-256 match a piece we lack is written as that
+    // piece, and the window jumps past it. A short last piece would need its
+    // own pass with a different window; it's one piece, so it's just fetched.
+    std::vector<size_t> DeltaSync::scan_(const PieceManifest& m){
+        const size_t w = m.pieceSize;
+        std::unordered_map<uint32_t, std::vector<size_t>> byWeak;
+        std::vector<bool> tags(1u << 16, false);
+        for (size_t i = 0; i < m.weak.size(); ++i) {
+            if (static_cast<size_t>(pm_->pieceSize(i)) != w || pm_->havePiece(i)) continue;
+            byWeak[m.weak[i]].push_back(i);
+            tags[tagOf(m.weak[i])] = true;
+        }
+        std::vector<size_t> reused;
+        if (byWeak.empty() || w == 0) return reused;
+
+        std::ifstream in(oldPath_, std::ios::binary);
+        if (!in) throw std::runtime_error("Failed to open " + oldPath_);
+
+        // buf holds the file from some offset on; the window starts at buf[pos].
+        const size_t chunk = std::max<size_t>(4u << 20, 2 * w);
+        std::vector<uint8_t> buf;
+        size_t pos = 0;
+        bool eof = false;
+        auto have = [&](size_t need){
+            while (buf.size() - pos < need && !eof) {
+                if (pos >= chunk) {
+                    buf.erase(buf.begin(), buf.begin() + static_cast<std::ptrdiff_t>(pos));
+                    pos = 0;
+                }
+                size_t old = buf.size();
+                buf.resize(old + chunk);
+                in.read(reinterpret_cast<char*>(buf.data() + old), static_cast<std::streamsize>(chunk));
+                size_t got = static_cast<size_t>(in.gcount());
+                buf.resize(old + got);
+                if (got < chunk) eof = true;
+            }
+            return buf.size() - pos >= need;
+        };
+
+        uint32_t a = 0, b = 0;
+        bool fresh = true; // a, b need computing from scratch
+        while (have(w)) {
+            const uint8_t* win = buf.data() + pos;
+            if (fresh) {
+                uint32_t weak = rollingChecksum(win, w);
+                a = weak & 0xffff;
+                b = weak >> 16;
+                fresh = false;
+            }
+            uint32_t weak = (a & 0xffff) | (b << 16);
+            if (tags[tagOf(weak)]) {
+                auto it = byWeak.find(weak);
+                if (it != byWeak.end()) {
+                    Sha256::Digest d = Sha256::hash(win, w);
+                    bool hit = false;
+                    // Identical pieces (all zeros, say) all come from this one window.
+                    for (size_t idx : it->second) {
+                        if (m.strong[idx] != d || !pm_->beginWrite(idx)) continue;
+                        try {
+                            pm_->writePiece(idx, win, w);
+                        } catch (...) {
+                            pm_->abortWrite(idx);
+                            throw;
+                        }
+                        reused.push_back(idx);
+                        hit = true;
+                    }
+                    if (hit) {
+                        pos += w;
+                        fresh = true;
+                        continue;
+                    }
+                }
+            }
+
+            if (!have(w + 1)) break;
+            win = buf.data() + pos;
+            uint32_t out = win[0], next = win[w];
+            a = a - out + next;
+            b = b - static_cast<uint32_t>(w) * out + a;
+            ++pos;
+        }
+        return reused;
+    }
+
+} // namespace p2p
@@ -0,0 +1,294 @@
+#include "p2p/ErasureCode.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define P2P_GF_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define P2P_GF_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace p2p {
+namespace gf256 {
+
+    // log/exp over generator 2, plus the full product table for the scalar kernel.
+    struct Tables {
+        uint8_t exp[512];
+        uint8_t log[256];
+        uint8_t mul[256][256];
+
+        Tables(){
+            unsigned x = 1;
+            for (int i = 0; i < 255; ++i) {
+                exp[i] = exp[i + 255] = static_cast<uint8_t>(x);
+                log[x] = static_cast<uint8_t>(i);
+                x <<= 1;
+                if (x & 0x100) x ^= 0x11d;
+            }
+            exp[510] = exp[511] = exp[0];
+            log[0] = 0;
+            for (int a = 0; a < 256; ++a) {
+                for (int b = 0; b < 256; ++b) {
+                    mul[a][b] = (a && b) ? exp[log[a] + log[b]] : 0;
+                }
+            }
+        }
+    };
+
+    static const Tables& tables(){
+        static const Tables t;
+        return t;
+    }
+
+    uint8_t mul(uint8_t a, uint8_t b){ return tables().mul[a][b]; }
+
+    uint8_t inv(uint8_t a){
+        if (a == 0) throw std::domain_error("gf256::inv(0)");
+        const Tables& t = tables();
+        return t.exp[255 - t.log[a]];
+    }
+
+    // c * x = lo[x & 15] ^ hi[x >> 4]
+    static void nibbleTables(uint8_t c, uint8_t lo[16], uint8_t hi[16]){
+        const Tables& t = tables();
+        for (int i = 0; i < 16; ++i) {
+            lo[i] = t.mul[c][i];
+            hi[i] = t.mul[c][i << 4];
+        }
+    }
+
+    static void mulAddScalar(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n){
+        const uint8_t* row = tables().mul[c];
+        for (size_t i = 0; i < n; ++i) dst[i] ^= row[src[i]];
+    }
+
+    static void mulSetScalar(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n){
+        const uint8_t* row = tables().mul[c];
+        for (size_t i = 0; i < n; ++i) dst[i] = row[src[i]];
+    }
+
+#if defined(P2P_GF_X86)
+
+    template <bool Add>
+    __attribute__((target("ssse3")))
+    static void mulSsse3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n){
+        alignas(16) uint8_t lo[16], hi[16];
+        nibbleTables(c, lo, hi);
+        const __m128i tlo = _mm_load_si128(reinterpret_cast<const __m128i*>(lo));
+        const __m128i thi = _mm_load_si128(reinterpret_cast<const __m128i*>(hi));
+        const __m128i mask = _mm_set1_epi8(0x0f);
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i p = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(s, mask)),
+                                      _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+            if (Add) p = _mm_xor_si128(p, _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), p);
+        }
+        if (Add) mulAddScalar(dst + i, src + i, c, n - i);
+        else mulSetScalar(dst + i, src + i, c, n - i);
+    }
+
+    template <bool Add>
+    __attribute__((target("avx2")))
+    static void mulAvx2(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n){
+        alignas(16) uint8_t lo[16], hi[16];
+        nibbleTables(c, lo, hi);
+        // vpshufb looks up within each 128-bit lane, so both lanes get the table.
+        const __m256i tlo = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(lo)));
+        const __m256i thi = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(hi)));
+        const __m256i mask = _mm256_set1_epi8(0x0f);
+        size_t i = 0;
+        for (; i + 64 <= n; i += 64) {
+            __m256i s0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m256i s1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+            __m256i p0 = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(s0, mask)),
+                                          _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(s0, 4), mask)));
+            __m256i p1 = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(s1, mask)),
+                                          _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(s1, 4), mask)));
+            if (Add) {
+                p0 = _mm256_xor_si256(p0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i)));
+                p1 = _mm256_xor_si256(p1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i + 32)));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), p0);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 32), p1);
+        }
+        if (Add) mulAddScalar(dst + i, src + i, c, n - i);
+        else mulSetScalar(dst + i, src + i, c, n - i);
+    }
+
+#elif defined(P2P_GF_NEON)
+
+    template <bool Add>
+    static void mulNeon(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n){
+        uint8_t lo[16], hi[16];
+        nibbleTables(c, lo, hi);
+        const uint8x16_t tlo = vld1q_u8(lo);
+        const uint8x16_t thi = vld1q_u8(hi);
+        const uint8x16_t mask = vdupq_n_u8(0x0f);
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            uint8x16_t s = vld1q_u8(src + i);
+            uint8x16_t p = veorq_u8(vqtbl1q_u8(tlo, vandq_u8(s, mask)), vqtbl1q_u8(thi, vshrq_n_u8(s, 4)));
+            if (Add) p = veorq_u8(p, vld1q_u8(dst + i));
+            vst1q_u8(dst + i, p);
+        }
+        if (Add) mulAddScalar(dst + i, src + i, c, n - i);
+        else mulSetScalar(dst + i, src + i, c, n - i);
+    }
+
+#endif
+
+    using Kernel = void (*)(uint8_t*, const uint8_t*, uint8_t, size_t);
+
+    struct Backend {
+        const char* name;
+        Kernel add;
+        Kernel set;
+    };
+
+    static std::vector<Backend> available(){
+        std::vector<Backend> v;
+#if defined(P2P_GF_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) v.push_back({"avx2", mulAvx2<true>, mulAvx2<false>});
+        if (__builtin_cpu_supports("ssse3")) v.push_back({"ssse3", mulSsse3<true>, mulSsse3<false>});
+#elif defined(P2P_GF_NEON)
+        v.push_back({"neon", mulNeon<true>, mulNeon<false>});
+#endif
+        v.push_back({"scalar", mulAddScalar, mulSetScalar});
+        return v;
+    }
+
+    static Backend& current(){
+        static Backend b = available().front();
+        return b;
+    }
+
+    void mulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n){
+        if (c == 0) return;
+        current().add(dst, src, c, n);
+    }
+
+    void mulSet(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n){
+        if (c == 0) { std::memset(dst, 0, n); return; }
+        if (c == 1) { if (dst != src) std::memmove(dst, src, n); return; }
+        current().set(dst, src, c, n);
+    }
+
+    const char* backend(){ return current().name; }
+
+    std::vector<const char*> backends(){
+        std::vector<const char*> names;
+        for (const auto& b : available()) names.push_back(b.name);
+        return names;
+    }
+
+    bool useBackend(const char* name){
+        for (const auto& b : available()) {
+            if (std::strcmp(b.name, name) == 0) { current() = b; return true; }
+        }
+        return false;
+    }
+
+} // namespace gf256
+
+    // Blocks are coded a slice at a time so the output slice stays in L1
+    // while all k inputs stream through it.
+    static constexpr size_t TILE = 16u << 10;
+
+    ReedSolomon::ReedSolomon(int k, int m) : k_(k), m_(m) {
+        if (k < 1 || m < 1 || k + m > 256) {
+            throw std::invalid_argument("Reed-Solomon needs k >= 1, m >= 1, k + m <= 256 (got " +
+                                        std::to_string(k) + "+" + std::to_string(m) + ")");
+        }
+        // y_i = i for data columns, x_j = k + j for parity rows: all distinct, so x_j ^ y_i != 0.
+        coef_.resize(static_cast<size_t>(k) * m);
+        for (int j = 0; j < m; ++j) {
+            for (int i = 0; i < k; ++i) {
+                coef_[static_cast<size_t>(j) * k + i] = gf256::inv(static_cast<uint8_t>((k + j) ^ i));
+            }
+        }
+    }
+
+    void ReedSolomon::encode(const uint8_t* const* data, int dataCount, uint8_t* const* parity, size_t size) const{
+        if (dataCount < 1 || dataCount > k_) throw std::invalid_argument("Reed-Solomon: bad data block count");
+        for (size_t off = 0; off < size; off += TILE) {
+            size_t n = std::min(TILE, size - off);
+            for (int j = 0; j < m_; ++j) {
+                if (!parity[j]) continue;
+                gf256::mulSet(parity[j] + off, data[0] + off, coefAt_(j, 0), n);
+                for (int i = 1; i < dataCount; ++i) gf256::mulAdd(parity[j] + off, data[i] + off, coefAt_(j, i), n);
+            }
+        }
+    }
+
+    bool ReedSolomon::reconstruct(uint8_t* const* blocks, const uint8_t* present, int dataCount, size_t size) const{
+        if (dataCount < 1 || dataCount > k_) throw std::invalid_argument("Reed-Solomon: bad data block count");
+
+        std::vector<int> lost, rows;
+        for (int i = 0; i < dataCount; ++i) if (!present[i]) lost.push_back(i);
+        if (lost.empty()) return true;
+        for (int j = 0; j < m_ && rows.size() < lost.size(); ++j) {
+            if (present[dataCount + j]) rows.push_back(j);
+        }
+        if (rows.size() < lost.size()) return false;
+        const size_t e = lost.size();
+
+        // Invert the e x e Cauchy submatrix (rows x lost columns), Gauss-Jordan.
+        std::vector<uint8_t> a(e * e), b(e * e, 0);
+        for (size_t r = 0; r < e; ++r) {
+            for (size_t c = 0; c < e; ++c) a[r * e + c] = coefAt_(rows[r], lost[c]);
+            b[r * e + r] = 1;
+        }
+        for (size_t col = 0; col < e; ++col) {
+            size_t piv = col;
+            while (piv < e && a[piv * e + col] == 0) ++piv;
+            if (piv == e) return false; // can't happen for a Cauchy matrix
+            if (piv != col) {
+                for (size_t c = 0; c < e; ++c) {
+                    std::swap(a[piv * e + c], a[col * e + c]);
+                    std::swap(b[piv * e + c], b[col * e + c]);
+                }
+            }
+            uint8_t f = gf256::inv(a[col * e + col]);
+            for (size_t c = 0; c < e; ++c) {
+                a[col * e + c] = gf256::mul(a[col * e + c], f);
+                b[col * e + c] = gf256::mul(b[col * e + c], f);
+            }
+            for (size_t r = 0; r < e; ++r) {
+                uint8_t g = a[r * e + col];
+                if (r == col || g == 0) continue;
+                for (size_t c = 0; c < e; ++c) {
+                    a[r * e + c] ^= gf256::mul(g, a[col * e + c]);
+                    b[r * e + c] ^= gf256::mul(g, b[col * e + c]);
+                }
+            }
+        }
+
+        // Each chosen parity minus what the surviving data contributes leaves
+        // a combination of the lost blocks only.
+        std::vector<std::vector<uint8_t>> syn(e, std::vector<uint8_t>(std::min(TILE, size)));
+        for (size_t off = 0; off < size; off += TILE) {
+            size_t n = std::min(TILE, size - off);
+            for (size_t r = 0; r < e; ++r) {
+                std::memcpy(syn[r].data(), blocks[dataCount + rows[r]] + off, n);
+                for (int i = 0; i < dataCount; ++i) {
+                    if (present[i]) gf256::mulAdd(syn[r].data(), blocks[i] + off, coefAt_(rows[r], i), n);
+                }
+            }
+            for (size_t c = 0; c < e; ++c) {
+                uint8_t* out = blocks[lost[c]] + off;
+                gf256::mulSet(out, syn[0].data(), b[c * e + 0], n);
+                for (size_t r = 1; r < e; ++r) gf256::mulAdd(out, syn[r].data(), b[c * e + r], n);
+            }
+        }
+        return true;
+    }
+
+} // namespace p2p
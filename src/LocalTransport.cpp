@@ -0,0 +1,471 @@
+#include "p2p/LocalTransport.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#endif
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+namespace p2p {
+
+    LocalListener gLocalListener;
+
+    // "p2p-local-<id>-<pid>", what start() names its socket.
+    static bool isListenerName(const std::string& name){
+        static const std::string prefix = "p2p-local-";
+        if (name.compare(0, prefix.size(), prefix) != 0) return false;
+        size_t dash = name.find('-', prefix.size());
+        auto digits = [&](size_t b, size_t e){
+            if (e <= b || e - b > 10) return false;
+            for (size_t i = b; i < e; ++i) if (name[i] < '0' || name[i] > '9') return false;
+            return true;
+        };
+        return dash != std::string::npos && digits(prefix.size(), dash) && digits(dash + 1, name.size());
+    }
+
+    bool LocalListener::isListenerAddress(const std::string& address){
+        if (!address.empty() && address[0] == '@') return isListenerName(address.substr(1));
+        static const std::string suffix = ".sock";
+        if (address.size() <= suffix.size() ||
+            address.compare(address.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            return false;
+        }
+        std::filesystem::path p(address);
+        std::error_code ec;
+        // tmp / "x" so a trailing separator on the temp dir doesn't matter.
+        auto tmp = std::filesystem::temp_directory_path(ec);
+        if (ec || p.parent_path() != (tmp / "x").parent_path()) return false;
+        std::string stem = p.filename().string();
+        return isListenerName(stem.substr(0, stem.size() - suffix.size()));
+    }
+
+    // Reply byte on the Unix socket after the nonce.
+    enum : uint8_t { MODE_SOCKET = 0, MODE_SHM = 1, MODE_UNKNOWN = 2 };
+
+    // Longest a sleeping side goes without re-checking for a dead peer.
+    static constexpr int WAIT_SLICE_MS = 100;
+    // Setup exchange on the Unix socket (nonce, reply) shouldn't take longer.
+    static constexpr int SETUP_TIMEOUT_MS = 2000;
+
+    // Shared header of one direction. head/tail only grow; the data index is
+    // mod the ring size. Each side sleeps on a sequence word the other bumps.
+    struct ShmTransport::Ring {
+        alignas(64) std::atomic<uint64_t> head;  // bytes written (producer)
+        alignas(64) std::atomic<uint64_t> tail;  // bytes read (consumer)
+        alignas(64) std::atomic<uint32_t> dataSeq;
+        std::atomic<uint32_t> spaceSeq;
+        std::atomic<uint32_t> readerWaiting;
+        std::atomic<uint32_t> writerWaiting;
+        std::atomic<uint32_t> closed;
+    };
+    static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+                  "shared-memory rings need address-free atomics");
+
+#if defined(__linux__)
+    // True if it timed out. Not FUTEX_PRIVATE: the word is shared between processes.
+    static bool futexWait(std::atomic<uint32_t>& w, uint32_t seen, int ms){
+        timespec ts{ms / 1000, (ms % 1000) * 1000000L};
+        long r = syscall(SYS_futex, reinterpret_cast<uint32_t*>(&w), FUTEX_WAIT, seen, &ts, nullptr, 0);
+        return r != 0 && errno == ETIMEDOUT;
+    }
+    static void futexWake(std::atomic<uint32_t>& w){
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&w), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+#else
+    // Never used: create() returns null and the Unix socket carries the data.
+    static bool futexWait(std::atomic<uint32_t>&, uint32_t, int ms){
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::min(ms, 1)));
+        return true;
+    }
+    static void futexWake(std::atomic<uint32_t>&){}
+#endif
+
+#if !defined(_WIN32)
+    static size_t pageRound(size_t n){
+        size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        return (n + page - 1) / page * page;
+    }
+
+    static void setRecvTimeout(socket_t s, int ms){
+        timeval tv{ms / 1000, (ms % 1000) * 1000};
+        ::setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    // "@name" is Linux's abstract namespace (no file to clean up); else a path.
+    static socklen_t fillAddr(const std::string& addr, sockaddr_un& a){
+        a = sockaddr_un{};
+        a.sun_family = AF_UNIX;
+        if (addr.empty() || addr.size() >= sizeof(a.sun_path)) return 0;
+        std::memcpy(a.sun_path, addr.data(), addr.size());
+        if (addr[0] == '@') a.sun_path[0] = '\0';
+        return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + addr.size() + (addr[0] == '@' ? 0 : 1));
+    }
+
+    // One byte, plus a descriptor if fd >= 0.
+    static bool sendMode(socket_t s, uint8_t mode, int fd){
+        iovec iov{&mode, 1};
+        msghdr mh{};
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        alignas(cmsghdr) char ctl[CMSG_SPACE(sizeof(int))] = {};
+        if (fd >= 0) {
+            mh.msg_control = ctl;
+            mh.msg_controllen = sizeof(ctl);
+            cmsghdr* c = CMSG_FIRSTHDR(&mh);
+            c->cmsg_level = SOL_SOCKET;
+            c->cmsg_type = SCM_RIGHTS;
+            c->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(c), &fd, sizeof(int));
+        }
+        return ::sendmsg(s, &mh, MSG_NOSIGNAL) == 1;
+    }
+
+    static bool recvMode(socket_t s, uint8_t& mode, int& fd){
+        fd = -1;
+        iovec iov{&mode, 1};
+        msghdr mh{};
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        alignas(cmsghdr) char ctl[CMSG_SPACE(sizeof(int))] = {};
+        mh.msg_control = ctl;
+        mh.msg_controllen = sizeof(ctl);
+        if (::recvmsg(s, &mh, 0) != 1) return false;
+        for (cmsghdr* c = CMSG_FIRSTHDR(&mh); c; c = CMSG_NXTHDR(&mh, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+                std::memcpy(&fd, CMSG_DATA(c), sizeof(int));
+            }
+        }
+        return true;
+    }
+#endif
+
+    // ---- ShmTransport ----
+
+#if defined(__linux__)
+    std::unique_ptr<ShmTransport> ShmTransport::create(socket_t sock, size_t ringBytes, int* fdOut){
+        size_t half = pageRound(sizeof(Ring)) + pageRound(std::max<size_t>(ringBytes, 1));
+        int fd = ::memfd_create("p2p-local", MFD_CLOEXEC);
+        if (fd < 0) return nullptr;
+        if (::ftruncate(fd, static_cast<off_t>(2 * half)) != 0) { ::close(fd); return nullptr; }
+        void* base = ::mmap(nullptr, 2 * half, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) { ::close(fd); return nullptr; }
+        // Fresh memfd pages are zero, which is what every field starts at.
+        new (base) Ring();
+        new (static_cast<uint8_t*>(base) + half) Ring();
+        *fdOut = fd;
+        return std::unique_ptr<ShmTransport>(new ShmTransport(sock, base, 2 * half, half - pageRound(sizeof(Ring)), true));
+    }
+
+    std::unique_ptr<ShmTransport> ShmTransport::attach(socket_t sock, int memfd){
+        struct stat st{};
+        size_t hdr = pageRound(sizeof(Ring));
+        if (::fstat(memfd, &st) != 0 || st.st_size <= 0 || static_cast<size_t>(st.st_size) % 2 != 0 ||
+            static_cast<size_t>(st.st_size) / 2 <= hdr) {
+            ::close(memfd);
+            return nullptr;
+        }
+        size_t len = static_cast<size_t>(st.st_size);
+        void* base = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        ::close(memfd);
+        if (base == MAP_FAILED) return nullptr;
+        return std::unique_ptr<ShmTransport>(new ShmTransport(sock, base, len, len / 2 - hdr, false));
+    }
+#else
+    std::unique_ptr<ShmTransport> ShmTransport::create(socket_t, size_t, int*){ return nullptr; }
+    std::unique_ptr<ShmTransport> ShmTransport::attach(socket_t, int memfd){
+    #if !defined(_WIN32)
+        ::close(memfd);
+    #endif
+        return nullptr;
+    }
+#endif
+
+    // The creator writes the first ring and reads the second.
+    ShmTransport::ShmTransport(socket_t sock, void* base, size_t mapLen, size_t ringBytes, bool creator)
+    : sock_(sock), base_(base), mapLen_(mapLen), cap_(ringBytes) {
+        auto* p = static_cast<uint8_t*>(base);
+        size_t half = mapLen / 2, hdr = half - ringBytes;
+        auto* first = reinterpret_cast<Ring*>(p);
+        auto* second = reinterpret_cast<Ring*>(p + half);
+        out_ = creator ? first : second;
+        in_ = creator ? second : first;
+        outData_ = reinterpret_cast<uint8_t*>(out_) + hdr;
+        inData_ = reinterpret_cast<uint8_t*>(in_) + hdr;
+    }
+
+    ShmTransport::~ShmTransport(){
+    #if !defined(_WIN32)
+        ::munmap(base_, mapLen_);
+        ::close(sock_);
+    #endif
+    }
+
+    // Nothing is sent on the Unix socket after setup, so readable means EOF:
+    // the other process closed it or died.
+    bool ShmTransport::peerGone_(){
+    #if defined(_WIN32)
+        return false;
+    #else
+        pollfd p{}; p.fd = sock_; p.events = POLLIN;
+        if (::poll(&p, 1, 0) <= 0) return false;
+        if (p.revents & (POLLHUP | POLLERR)) return true;
+        char c;
+        return ::recv(sock_, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+    #endif
+    }
+
+    bool ShmTransport::sendAll(const uint8_t* data, size_t n){
+        Ring& r = *out_;
+        while (n > 0) {
+            if (r.closed.load()) return false;
+            uint64_t h = r.head.load(std::memory_order_relaxed);
+            uint64_t t = r.tail.load(std::memory_order_acquire);
+            size_t room = cap_ - static_cast<size_t>(h - t);
+            if (room == 0) {
+                // Announce, then re-check, so a read in between can't be missed.
+                uint32_t seq = r.spaceSeq.load();
+                r.writerWaiting.store(1);
+                bool timedOut = false;
+                if (r.tail.load() == t && !r.closed.load()) timedOut = futexWait(r.spaceSeq, seq, WAIT_SLICE_MS);
+                r.writerWaiting.store(0);
+                if (timedOut && peerGone_()) return false;
+                continue;
+            }
+            size_t off = static_cast<size_t>(h % cap_);
+            size_t k = std::min(n, std::min(room, cap_ - off));
+            std::memcpy(outData_ + off, data, k);
+            r.head.store(h + k);
+            r.dataSeq.fetch_add(1);
+            if (r.readerWaiting.load()) futexWake(r.dataSeq);
+            data += k;
+            n -= k;
+        }
+        return true;
+    }
+
+    bool ShmTransport::recvAll(uint8_t* data, size_t n){
+        Ring& r = *in_;
+        while (n > 0) {
+            uint64_t t = r.tail.load(std::memory_order_relaxed);
+            uint64_t h = r.head.load();
+            size_t avail = static_cast<size_t>(h - t);
+            if (avail == 0) {
+                if (r.closed.load()) return false; // closed and drained
+                uint32_t seq = r.dataSeq.load();
+                r.readerWaiting.store(1);
+                bool timedOut = false;
+                if (r.head.load() == h && !r.closed.load()) timedOut = futexWait(r.dataSeq, seq, WAIT_SLICE_MS);
+                r.readerWaiting.store(0);
+                if (timedOut && peerGone_()) return false;
+                continue;
+            }
+            size_t off = static_cast<size_t>(t % cap_);
+            size_t k = std::min(n, std::min(avail, cap_ - off));
+            std::memcpy(data, inData_ + off, k);
+            r.tail.store(t + k);
+            r.spaceSeq.fetch_add(1);
+            if (r.writerWaiting.load()) futexWake(r.spaceSeq);
+            data += k;
+            n -= k;
+        }
+        return true;
+    }
+
+    int ShmTransport::waitReadable(int timeoutMs){
+        using namespace std::chrono;
+        Ring& r = *in_;
+        auto deadline = steady_clock::now() + milliseconds(std::max(timeoutMs, 0));
+        for (;;) {
+            uint64_t h = r.head.load();
+            if (h != r.tail.load(std::memory_order_relaxed) || r.closed.load()) return 1;
+            int slice = WAIT_SLICE_MS;
+            if (timeoutMs >= 0) {
+                auto left = ceil<milliseconds>(deadline - steady_clock::now()).count();
+                if (left <= 0) return 0;
+                slice = static_cast<int>(std::min<int64_t>(slice, left));
+            }
+            uint32_t seq = r.dataSeq.load();
+            r.readerWaiting.store(1);
+            bool timedOut = false;
+            if (r.head.load() == h && !r.closed.load()) timedOut = futexWait(r.dataSeq, seq, slice);
+            r.readerWaiting.store(0);
+            if (timedOut && peerGone_()) return 1; // recvAll reports it
+        }
+    }
+
+    // Both directions, for both processes (like a reset), and wake anyone asleep.
+    void ShmTransport::shutdown(){
+        for (Ring* r : {out_, in_}) {
+            r->closed.store(1);
+            futexWake(r->dataSeq);
+            futexWake(r->spaceSeq);
+        }
+    #if !defined(_WIN32)
+        ::shutdown(sock_, SHUT_RDWR);
+    #endif
+    }
+
+    // ---- LocalListener ----
+
+    LocalListener::~LocalListener(){ stop(); }
+
+#if defined(_WIN32)
+    void LocalListener::start(int, size_t){ throw std::runtime_error("Local transport is not supported on Windows"); }
+    void LocalListener::stop(){}
+    void LocalListener::acceptLoop_(){}
+    void LocalListener::serve_(socket_t){}
+    std::unique_ptr<Transport> LocalListener::connect(const std::string&, uint64_t){ return nullptr; }
+#else
+    void LocalListener::start(int selfId, size_t ringBytes){
+        if (running_) return;
+    #if defined(__linux__)
+        addr_ = "@p2p-local-" + std::to_string(selfId) + "-" + std::to_string(::getpid());
+    #else
+        addr_ = (std::filesystem::temp_directory_path() /
+                 ("p2p-local-" + std::to_string(selfId) + "-" + std::to_string(::getpid()) + ".sock")).string();
+        ::unlink(addr_.c_str());
+    #endif
+        sockaddr_un a{};
+        socklen_t len = fillAddr(addr_, a);
+        srv_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (srv_ < 0 || len == 0 || ::bind(srv_, reinterpret_cast<sockaddr*>(&a), len) != 0 ||
+            ::listen(srv_, 16) != 0) {
+            if (srv_ >= 0) ::close(srv_);
+            srv_ = -1;
+            throw std::runtime_error("Cannot listen on local socket " + addr_);
+        }
+        ringBytes_ = ringBytes;
+        running_ = true;
+        thr_ = std::thread(&LocalListener::acceptLoop_, this);
+    }
+
+    void LocalListener::stop(){
+        if (!running_.exchange(false)) return;
+        ::shutdown(srv_, SHUT_RDWR); // wakes accept()
+        if (thr_.joinable()) thr_.join();
+        ::close(srv_);
+        srv_ = -1;
+        if (addr_[0] != '@') ::unlink(addr_.c_str());
+    }
+
+    void LocalListener::acceptLoop_(){
+        while (running_) {
+            socket_t s = ::accept(srv_, nullptr, nullptr);
+            if (s < 0) {
+                if (errno == EINTR) continue;
+                if (!running_) break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            serve_(s);
+        }
+    }
+
+    // The other side sends the nonce from our offer; we answer with how the
+    // connection continues (and the memfd if it's shared memory).
+    void LocalListener::serve_(socket_t s){
+        setRecvTimeout(s, SETUP_TIMEOUT_MS);
+        uint8_t nb[8];
+        if (::recv(s, nb, sizeof(nb), MSG_WAITALL) != static_cast<ssize_t>(sizeof(nb))) { ::close(s); return; }
+        uint64_t nonce = 0;
+        for (uint8_t b : nb) nonce = (nonce << 8) | b;
+        setRecvTimeout(s, 0);
+
+        // Held through the callback so forget() can't return mid-attach.
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = pending_.find(nonce);
+        if (it == pending_.end()) {
+            sendMode(s, MODE_UNKNOWN, -1);
+            ::close(s);
+            return;
+        }
+        Attach fn = std::move(it->second);
+        pending_.erase(it);
+
+        int memfd = -1;
+        std::unique_ptr<Transport> t = ShmTransport::create(s, ringBytes_, &memfd); // owns s if non-null
+        bool ok = sendMode(s, t ? MODE_SHM : MODE_SOCKET, memfd);
+        if (memfd >= 0) ::close(memfd); // the mapping stays
+        if (!t) t = std::make_unique<SocketTransport>(s);
+        if (ok) fn(std::move(t));
+    }
+
+    std::unique_ptr<Transport> LocalListener::connect(const std::string& address, uint64_t nonce){
+        if (!isListenerAddress(address)) return nullptr;
+        sockaddr_un a{};
+        socklen_t len = fillAddr(address, a);
+        if (len == 0) return nullptr;
+        socket_t s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s < 0) return nullptr;
+        if (::connect(s, reinterpret_cast<sockaddr*>(&a), len) != 0) { ::close(s); return nullptr; }
+
+        uint8_t nb[8];
+        for (int i = 0; i < 8; ++i) nb[i] = static_cast<uint8_t>(nonce >> (56 - 8 * i));
+        setRecvTimeout(s, SETUP_TIMEOUT_MS);
+        uint8_t mode = MODE_UNKNOWN;
+        int memfd = -1;
+        if (::send(s, nb, sizeof(nb), MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(nb)) ||
+            !recvMode(s, mode, memfd)) {
+            ::close(s);
+            return nullptr;
+        }
+        setRecvTimeout(s, 0);
+
+        if (mode == MODE_SHM && memfd >= 0) {
+            auto t = ShmTransport::attach(s, memfd);
+            if (!t) ::close(s);
+            return t;
+        }
+        if (memfd >= 0) ::close(memfd);
+        if (mode == MODE_SOCKET) return std::make_unique<SocketTransport>(s);
+        ::close(s);
+        return nullptr;
+    }
+#endif
+
+    uint64_t LocalListener::expect(Attach fn){
+        std::lock_guard<std::mutex> lk(mtx_);
+        uint64_t nonce;
+        do { nonce = rng_(); } while (nonce == 0 || pending_.count(nonce));
+        pending_[nonce] = std::move(fn);
+        return nonce;
+    }
+
+    void LocalListener::forget(uint64_t nonce){
+        std::lock_guard<std::mutex> lk(mtx_);
+        pending_.erase(nonce);
+    }
+
+    const std::string& LocalListener::hostId(){
+        static const std::string id = []{
+            std::string h;
+        #if !defined(_WIN32)
+            char name[256] = {0};
+            if (::gethostname(name, sizeof(name) - 1) == 0) h = name;
+        #endif
+            std::ifstream in("/proc/sys/kernel/random/boot_id");
+            std::string boot;
+            if (in >> boot) h += "/" + boot;
+            return h;
+        }();
+        return id;
+    }
+
+} // namespace p2p
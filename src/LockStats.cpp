@@ -0,0 +1,212 @@
+#include "p2p/LockStats.hpp"
+
+#if defined(P2P_LOCK_STATS)
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+
+#if __has_include(<execinfo.h>) && __has_include(<dlfcn.h>) && __has_include(<cxxabi.h>)
+#define P2P_LOCK_SITES 1
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#endif
+
+namespace p2p {
+
+    // Return addresses above ProfiledMutex::lock() for one contended acquire.
+    // Deep enough to get past std::lock_guard / unique_lock / condition_variable_any.
+    static constexpr int SITE_FRAMES = 8;
+    using Site = std::array<void*, SITE_FRAMES>;
+
+    struct SiteCounters {
+        uint64_t waits = 0;
+        int64_t waitNs = 0;
+    };
+
+    struct LockCounters {
+        const char* name = "";
+        std::atomic<uint64_t> acquires{0};
+        std::atomic<uint64_t> contended{0};
+        std::atomic<int64_t> waitNs{0};
+        std::atomic<int64_t> maxWaitNs{0};
+        std::atomic<int64_t> holdNs{0};
+        std::atomic<int64_t> maxHoldNs{0};
+
+        std::mutex sitesMtx; // only taken after a wait, never on the fast path
+        std::map<Site, SiteCounters> sites;
+    };
+
+    static int64_t nowNs(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static void raiseMax(std::atomic<int64_t>& max, int64_t v){
+        int64_t cur = max.load(std::memory_order_relaxed);
+        while (v > cur && !max.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {}
+    }
+
+    // One set of counters per name, alive until exit.
+    static std::mutex& registryMtx(){ static std::mutex m; return m; }
+    static std::map<std::string, std::unique_ptr<LockCounters>>& registry(){
+        static std::map<std::string, std::unique_ptr<LockCounters>> r;
+        return r;
+    }
+
+    ProfiledMutex::ProfiledMutex(const char* name){
+        std::lock_guard<std::mutex> lk(registryMtx());
+        auto& slot = registry()[name];
+        if (!slot) {
+            slot = std::make_unique<LockCounters>();
+            slot->name = name;
+        }
+        stats_ = slot.get();
+    }
+
+    bool ProfiledMutex::try_lock(){
+        if (!m_.try_lock()) return false;
+        stats_->acquires.fetch_add(1, std::memory_order_relaxed);
+        since_ = nowNs();
+        return true;
+    }
+
+    // noinline so the stack captured below always starts in here.
+    __attribute__((noinline)) void ProfiledMutex::lock(){
+        if (try_lock()) return;
+
+        int64_t start = nowNs();
+        m_.lock();
+        since_ = nowNs();
+        int64_t waited = since_ - start;
+
+        auto& s = *stats_;
+        s.acquires.fetch_add(1, std::memory_order_relaxed);
+        s.contended.fetch_add(1, std::memory_order_relaxed);
+        s.waitNs.fetch_add(waited, std::memory_order_relaxed);
+        raiseMax(s.maxWaitNs, waited);
+
+#if defined(P2P_LOCK_SITES)
+        void* frames[SITE_FRAMES + 1] = {};
+        int n = ::backtrace(frames, SITE_FRAMES + 1);
+        Site site{};
+        for (int i = 1; i < n; ++i) site[static_cast<size_t>(i - 1)] = frames[i];
+        std::lock_guard<std::mutex> lk(s.sitesMtx);
+        auto& c = s.sites[site];
+        ++c.waits;
+        c.waitNs += waited;
+#endif
+    }
+
+    void ProfiledMutex::unlock(){
+        int64_t held = nowNs() - since_;
+        stats_->holdNs.fetch_add(held, std::memory_order_relaxed);
+        raiseMax(stats_->maxHoldNs, held);
+        m_.unlock();
+    }
+
+#if defined(P2P_LOCK_SITES)
+    // The first frame that isn't the standard library or ProfiledMutex itself,
+    // as function+offset, or module+offset for addr2line when there's no symbol
+    // (static functions, or a binary built without exported symbols).
+    static std::string describe(const Site& site){
+        std::string fallback;
+        for (void* addr : site) {
+            if (!addr) break;
+            Dl_info info{};
+            if (!::dladdr(addr, &info)) continue;
+            char buf[64];
+            if (!info.dli_sname) {
+                if (fallback.empty()) {
+                    const char* mod = info.dli_fname ? std::strrchr(info.dli_fname, '/') : nullptr;
+                    std::snprintf(buf, sizeof(buf), "(+0x%zx)",
+                                  static_cast<size_t>(static_cast<char*>(addr) - static_cast<char*>(info.dli_fbase)));
+                    fallback = std::string(mod ? mod + 1 : (info.dli_fname ? info.dli_fname : "?")) + buf;
+                }
+                continue;
+            }
+            int status = 0;
+            char* dem = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            std::string name = (status == 0 && dem) ? dem : info.dli_sname;
+            std::free(dem);
+            if (name.rfind("std::", 0) == 0 || name.rfind("p2p::ProfiledMutex::", 0) == 0 ||
+                name.rfind("__gthread", 0) == 0) {
+                continue;
+            }
+            std::snprintf(buf, sizeof(buf), "+0x%zx",
+                          static_cast<size_t>(static_cast<char*>(addr) - static_cast<char*>(info.dli_saddr)));
+            return name + buf;
+        }
+        return fallback.empty() ? "?" : fallback;
+    }
+#endif
+
+    std::string lockStatsReport(size_t topSites){
+        std::vector<LockCounters*> locks;
+        {
+            std::lock_guard<std::mutex> lk(registryMtx());
+            for (auto& [name, c] : registry()) locks.push_back(c.get());
+        }
+        std::sort(locks.begin(), locks.end(), [](LockCounters* a, LockCounters* b){
+            return a->waitNs.load() > b->waitNs.load();
+        });
+
+        auto ms = [](int64_t ns){ return static_cast<double>(ns) / 1e6; };
+        auto us = [](int64_t ns){ return static_cast<double>(ns) / 1e3; };
+        std::string out;
+        char line[256];
+        std::snprintf(line, sizeof(line), "%-28s %12s %10s %11s %12s %11s %12s\n", "lock", "acquires",
+                      "contended", "wait ms", "max wait us", "hold ms", "max hold us");
+        out += line;
+        for (LockCounters* c : locks) {
+            uint64_t acq = c->acquires.load(), cont = c->contended.load();
+            std::snprintf(line, sizeof(line), "%-28s %12llu %9.2f%% %11.1f %12.1f %11.1f %12.1f\n", c->name,
+                          static_cast<unsigned long long>(acq), acq ? 100.0 * static_cast<double>(cont) / static_cast<double>(acq) : 0.0,
+                          ms(c->waitNs.load()), us(c->maxWaitNs.load()), ms(c->holdNs.load()), us(c->maxHoldNs.load()));
+            out += line;
+
+#if defined(P2P_LOCK_SITES)
+            // Stacks that resolve to the same call site are added up.
+            std::map<std::string, SiteCounters> bySite;
+            {
+                std::lock_guard<std::mutex> lk(c->sitesMtx);
+                for (const auto& [site, sc] : c->sites) {
+                    auto& agg = bySite[describe(site)];
+                    agg.waits += sc.waits;
+                    agg.waitNs += sc.waitNs;
+                }
+            }
+            std::vector<std::pair<std::string, SiteCounters>> top(bySite.begin(), bySite.end());
+            std::sort(top.begin(), top.end(), [](const auto& a, const auto& b){ return a.second.waitNs > b.second.waitNs; });
+            if (top.size() > topSites) top.resize(topSites);
+            for (const auto& [where, sc] : top) {
+                std::snprintf(line, sizeof(line), "    %10llu waits %11.1f ms  ",
+                              static_cast<unsigned long long>(sc.waits), ms(sc.waitNs));
+                out += line + where + "\n";
+            }
+#endif
+        }
+        return out;
+    }
+
+} // namespace p2p
+
+#else
+
+namespace p2p {
+
+    std::string lockStatsReport(size_t){
+        return "Lock stats aren't compiled in (configure with -DP2P_LOCK_STATS=ON).\n";
+    }
+
+} // namespace p2p
+
+#endif
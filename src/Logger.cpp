@@ -23,7 +23,7 @@ namespace p2p {
     }
 
     void Logger::write(const std::string& level, const std::string& msg){
-        std::lock_guard<std::mutex> lk(mtx_);
+        std::lock_guard<ProfiledMutex> lk(mtx_);
         out_ << "[" << nowTs() << "] [" << level << "] " << msg << "\n";
         out_.flush();
     }
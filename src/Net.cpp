@@ -1,11 +1,70 @@
 #include "p2p/Net.hpp"
+#include "p2p/Compression.hpp"
+#include "p2p/RateLimiter.hpp"
+#include "p2p/ConnectionManager.hpp"
+#include "p2p/WorkPool.hpp"
+#include "p2p/PeerBook.hpp"
+#include "p2p/LocalTransport.hpp"
+#include "p2p/Profile.hpp"
 
 #include <vector>
+#include <algorithm>
 #include <cstring>
+#include <cmath>
 #include <stdexcept>
 
 namespace p2p {
 
+    NetOptions gNetOptions;
+
+    // Control bytes a peer may leave unread before we give up on it.
+    static constexpr size_t CTRL_QUEUE_MAX = 1u << 20;
+
+    // REQUESTs kept waiting for upload budget; past this they're dropped.
+    static constexpr size_t MAX_DEFERRED_REQUESTS = 256;
+
+    // PEX limits: entries per message either way, and the fastest a peer may
+    // gossip at us (faster messages are ignored).
+    static constexpr size_t MAX_PEX_ENTRIES = 50;
+    static constexpr std::chrono::seconds PEX_MIN_GAP{10};
+
+    // Received pieces waiting on the pool per connection; past this the
+    // receive thread writes them itself (a flood slows that peer, not us).
+    static constexpr size_t MAX_CONN_TASKS = 16;
+
+    // REQUEST deadlines: the first few go by INITIAL, then by the peer's measured
+    // latency, always within [MIN, MAX]. Each timeout in a row doubles it.
+    static constexpr std::chrono::milliseconds REQUEST_TIMEOUT_INITIAL{5000};
+    static constexpr std::chrono::milliseconds REQUEST_TIMEOUT_MIN{500};
+    static constexpr std::chrono::milliseconds REQUEST_TIMEOUT_MAX{30000};
+
+    // After this many timeouts in a row a peer only gets pieces nobody else is
+    // fetching (no end-game duplicates), until it delivers again.
+    static constexpr int DEMOTE_AFTER_STRIKES = 2;
+
+    // Pieces a peer failed to deliver that we won't ask it for again soon.
+    static constexpr size_t MAX_TIMED_OUT_PIECES = 32;
+
+    // Interested but nothing to request (all of it is on order elsewhere):
+    // look again this often.
+    static constexpr int IDLE_RETRY_MS = 1000;
+    // Held for a delta scan, which runs on the pool: look this often instead.
+    static constexpr int HOLD_POLL_MS = 50;
+
+    // TRANSPORT_SWITCH can beat our end of the new transport being ready; wait this long for it.
+    static constexpr std::chrono::seconds TRANSPORT_SWITCH_WAIT{2};
+
+    // Capabilities this process advertises in every handshake.
+    static uint32_t localCaps(){
+        uint32_t caps = CAP_FAST_HAVE | CAP_COMPACT_BITFIELD | CAP_MANIFEST;
+        if (gNetOptions.compressPieces) caps |= CAP_COMPRESSION;
+        if (gNetOptions.pex) caps |= CAP_PEX;
+        if (gNetOptions.localTransport) caps |= CAP_LOCAL;
+        if (gNetOptions.udpTransport) caps |= CAP_UDP;
+        if (gNetOptions.zeroPieces) caps |= CAP_ZERO_PIECES;
+        return caps;
+    }
+
     //static bool setNonBlocking(socket_t){ return true; } // midpoint: ignore
 
     static void closesock(socket_t s){
@@ -17,65 +76,615 @@ namespace p2p {
     }
 
     ConnectionHandler::ConnectionHandler(int selfId, Logger& logger, socket_t sock,
-                                     bool incoming, std::vector<uint8_t> selfBitfield)
+                                     bool incoming, uint32_t swarmId)
+    : ConnectionHandler(selfId, logger, std::make_unique<SocketTransport>(sock), incoming, swarmId) {}
+
+    ConnectionHandler::ConnectionHandler(int selfId, Logger& logger, std::unique_ptr<Transport> io,
+                                     bool incoming, uint32_t swarmId)
     : selfId_(selfId),
       logger_(logger),
-      sock_(sock),
-      incoming_(incoming),
-      selfBitfield_(std::move(selfBitfield)) {}
+      io_(std::move(io)),
+      rx_(io_.get()),
+      tx_(io_.get()),
+      swarmId_(swarmId),
+      incoming_(incoming) {}
 
 
 
     ConnectionHandler::~ConnectionHandler(){
-        running_.store(false);
+        close();
         if (thr_.joinable()) thr_.join();
-    #if defined(_WIN32)
-        if (sock_ != INVALID_SOCKET) closesock(sock_);
-    #else
-        if (sock_ >= 0) closesock(sock_);
-    #endif
+        stopWriter_();
+        // Pool tasks for this connection still point at it.
+        {
+            ProfiledLock lk(qMtx_);
+            qCv_.wait(lk, [this]{ return tasks_ == 0; });
+        }
     }
 
 
     void ConnectionHandler::start(){ running_.store(true); thr_ = std::thread(&ConnectionHandler::run_, this); }
     void ConnectionHandler::join(){ if (thr_.joinable()) thr_.join(); }
 
+    void ConnectionHandler::close(){
+        running_.store(false);
+        io_->shutdown();
+        std::lock_guard<ProfiledMutex> lk(qMtx_);
+        if (alt_) alt_->shutdown();
+    }
+
+    void ConnectionHandler::retire(){
+        retired_.store(true);
+        close();
+    }
+
+    void ConnectionHandler::touch_(){
+        int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+        lastActivityNs_.store(now);
+        lastHeardNs_.store(now);
+    }
+
+    void ConnectionHandler::heard_(){
+        lastHeardNs_.store(std::chrono::steady_clock::now().time_since_epoch().count());
+    }
+
+    std::chrono::steady_clock::time_point ConnectionHandler::lastActivity() const{
+        return std::chrono::steady_clock::time_point(
+            std::chrono::steady_clock::duration(lastActivityNs_.load()));
+    }
+
+    void ConnectionHandler::run_(){
+        touch_();
+        runSession_();
+        if (localNonce_) gLocalListener.forget(localNonce_);
+        std::shared_ptr<UdpTransport> udp;
+        {
+            std::lock_guard<ProfiledMutex> lk(qMtx_);
+            udp = std::move(udpPending_);
+        }
+        if (udp) {
+            udp->disarm();
+            udp->shutdown();
+        }
+        gRecorder.onClose(recId_);
+        if (liveTimer_) gTimers.cancel(liveTimer_);
+        if (inFlight_ >= 0 && pm_) pm_->clearRequested(static_cast<size_t>(inFlight_));
+        if (superSeed_ && remotePeerId_ >= 0) superSeed_->forget(remotePeerId_);
+        stopWriter_();
+        finished_.store(true);
+    }
+
+    // gTimers: say something if we've been quiet, and give up on a peer that has.
+    void ConnectionHandler::liveTick_(){
+        using namespace std::chrono;
+        auto now = steady_clock::now();
+        auto lastHeard = steady_clock::time_point(steady_clock::duration(lastHeardNs_.load()));
+        if (gNetOptions.deadPeerSec > 0 && now - lastHeard > seconds(gNetOptions.deadPeerSec)) {
+            logger_.info("Peer " + std::to_string(remotePeerId_) + " silent for " +
+                         std::to_string(gNetOptions.deadPeerSec) + "s; dropping the connection.");
+            close();
+            return;
+        }
+        auto lastSend = steady_clock::time_point(steady_clock::duration(lastSendNs_.load()));
+        if (gNetOptions.keepAliveSec > 0 && now - lastSend >= seconds(gNetOptions.keepAliveSec)) {
+            {
+                std::lock_guard<ProfiledMutex> lk(qMtx_);
+                if (writerStop_) return;
+                ctrlOut_.insert(ctrlOut_.end(), 4, 0); // length 0: keep-alive
+            }
+            qCv_.notify_all();
+            record_(Recorder::OUT, Recorder::KEEP_ALIVE, 0, nullptr, 0);
+        }
+    }
+
+    // Wait for the next message to start arriving: >0 readable (or closed), 0 timed out, <0 error.
+    int ConnectionHandler::waitReadable_(int timeoutMs) const{
+        return rx_->waitReadable(timeoutMs);
+    }
+
+    std::chrono::milliseconds ConnectionHandler::requestTimeout_() const{
+        using namespace std::chrono;
+        milliseconds t = REQUEST_TIMEOUT_INITIAL;
+        if (haveRtt_) t = milliseconds(static_cast<int64_t>(srttMs_ + 4 * rttVarMs_));
+        t = std::clamp(t, REQUEST_TIMEOUT_MIN, REQUEST_TIMEOUT_MAX);
+        return std::min(t * (int64_t(1) << std::min(strikes_, 6)), REQUEST_TIMEOUT_MAX);
+    }
+
+    // RFC 6298 smoothing of request-to-PIECE times.
+    void ConnectionHandler::onRtt_(double ms){
+        if (!haveRtt_) {
+            srttMs_ = ms;
+            rttVarMs_ = ms / 2;
+            haveRtt_ = true;
+            return;
+        }
+        rttVarMs_ = 0.75 * rttVarMs_ + 0.25 * std::abs(srttMs_ - ms);
+        srttMs_ = 0.875 * srttMs_ + 0.125 * ms;
+    }
+
+    // Drops anything still queued; pool tasks that finish later find writerStop_ set.
+    // Closes the connection first: a writer stuck sending to a peer that
+    // stopped reading would otherwise never come back to be joined.
+    void ConnectionHandler::stopWriter_(){
+        {
+            std::lock_guard<ProfiledMutex> lk(qMtx_);
+            writerStop_ = true;
+        }
+        qCv_.notify_all();
+        close();
+        if (writer_.joinable()) writer_.join();
+    }
+
+    void ConnectionHandler::writeLoop_(){
+        std::vector<uint8_t> out;
+        for (;;) {
+            size_t raw = 0;
+            bool isPiece = false;
+            bool switching = false;
+            {
+                ProfiledLock lk(qMtx_);
+                qCv_.wait(lk, [this]{
+                    return writerStop_ || switchOut_ || !ctrlOut_.empty() || !pieceOut_.empty();
+                });
+                if (writerStop_) return;
+
+                out.clear();
+                if (switchOut_) {
+                    // Queued control, then the marker: the last bytes on the old transport.
+                    out.swap(ctrlOut_);
+                    auto marker = Message::serialize(msg::transportSwitch());
+                    recordOut_(marker);
+                    out.insert(out.end(), marker.begin(), marker.end());
+                    switchOut_ = false;
+                    switching = true;
+                } else if (!ctrlOut_.empty()) {
+                    // Everything queued since the last write goes out in one send().
+                    out.swap(ctrlOut_);
+                } else {
+                    out = std::move(pieceOut_.front().bytes);
+                    raw = pieceOut_.front().raw;
+                    pieceOut_.pop_front();
+                    isPiece = true;
+                }
+            }
+
+            P2P_PROFILE_PEER(remotePeerId_);
+            // One upload budget for the whole process, whatever the swarm.
+            if (isPiece) gUploadBudget.acquire(out.size());
+            if (!sendAll_(out.data(), out.size())) {
+                close();
+                return;
+            }
+            lastSendNs_.store(std::chrono::steady_clock::now().time_since_epoch().count());
+            if (switching) tx_ = alt_.get(); // set before switchOut_, under qMtx_
+            if (!isPiece) continue;
+
+            bytesUp_.fetch_add(raw);
+            // That freed some upload budget: start REQUESTs that were waiting for it.
+            std::vector<std::pair<uint32_t, size_t>> admit;
+            {
+                std::lock_guard<ProfiledMutex> lk(qMtx_);
+                uploadBytes_ -= raw;
+                while (!deferredReqs_.empty() &&
+                       (uploadBytes_ == 0 ||
+                        uploadBytes_ + deferredReqs_.front().second <= gNetOptions.sendQueueBytes)) {
+                    admit.push_back(deferredReqs_.front());
+                    uploadBytes_ += deferredReqs_.front().second;
+                    ++tasks_;
+                    deferredReqs_.pop_front();
+                }
+            }
+            for (const auto& [idx, size] : admit) postUpload_(idx, size);
+        }
+    }
+
     bool ConnectionHandler::sendAll_(const uint8_t* data, size_t n) const{
-        size_t sent=0;
-        while (sent<n){
-        #if defined(_WIN32)
-            int r = ::send(sock_, reinterpret_cast<const char*>(data+sent), int(n-sent), 0);
-        #else
-            ssize_t r = ::send(sock_, data+sent, n-sent, 0);
-        #endif
-            if (r<=0) return false;
-            sent += size_t(r);
+        P2P_SCOPE("sendAll_");
+        return tx_->sendAll(data, n);
+    }
+
+    bool ConnectionHandler::recvAll_(uint8_t* data, size_t n) const{
+        return rx_->recvAll(data, n);
+    }
+
+    // Read and throw away n bytes (a PIECE we can't use).
+    bool ConnectionHandler::skip_(size_t n){
+        uint8_t scratch[4096];
+        while (n > 0) {
+            size_t k = std::min(n, sizeof(scratch));
+            if (!recvAll_(scratch, k)) return false;
+            n -= k;
         }
         return true;
     }
 
-    bool ConnectionHandler::recvAll_(uint8_t* data, size_t n) const{
-        size_t got=0;
-        while (got<n){
-        #if defined(_WIN32)
-            int r = ::recv(sock_, reinterpret_cast<char*>(data+got), int(n-got), MSG_WAITALL);
-        #else
-            ssize_t r = ::recv(sock_, data+got, n-got, MSG_WAITALL);
-        #endif
-            if (r<=0) return false; got += size_t(r);
+    // Receive n bytes of PIECE data for `idx` straight into a pooled buffer and
+    // hand it to gWorkPool for decompression and the disk write. The piece is
+    // claimed first so we don't request it again while it's being written.
+    // Returns false only if the socket failed; bad pieces are read and dropped.
+    bool ConnectionHandler::recvPiece_(uint32_t idx, PieceCodec codec, size_t n){
+        std::shared_ptr<PieceManager> pm = pm_;
+        if (idx >= pm->pieceCount()) {
+            return skip_(n); // out of range
+        }
+        size_t want = static_cast<size_t>(pm->pieceSize(idx));
+
+        if (codec == PieceCodec::RAW) {
+            if (n != want) return skip_(n);
+        } else if (codec == PieceCodec::LZ4) {
+            // Compressed data never needs more than a little over the raw size.
+            if (n > want + want / 255 + 16) return skip_(n);
+        } else {
+            return skip_(n); // unknown codec
         }
+
+        // Already have it (or another connection just delivered it): no disk write.
+        if (!pm->beginWrite(idx)) {
+            if (!recId_ || !gRecorder.piecePayloads()) return skip_(n);
+            // Keep the bytes anyway so a replay sees the same stream.
+            auto dup = std::make_shared<AlignedBuffer>();
+            dup->resize(n);
+            if (!recvAll_(dup->data(), n)) return false;
+            lastPieceIn_ = std::move(dup);
+            return true;
+        }
+
+        std::shared_ptr<AlignedBuffer> buf;
+        bool pooled;
+        {
+            std::lock_guard<ProfiledMutex> lk(qMtx_);
+            if (!freeBufs_.empty()) { buf = std::move(freeBufs_.back()); freeBufs_.pop_back(); }
+            pooled = tasks_ < MAX_CONN_TASKS;
+            if (pooled) ++tasks_;
+        }
+        if (!buf) buf = std::make_shared<AlignedBuffer>();
+        buf->resize(n);
+
+        if (!recvAll_(buf->data(), n)) {
+            pm->abortWrite(idx);
+            if (pooled) taskDone_();
+            return false;
+        }
+        bytesDown_.fetch_add(want);
+        if (recId_ && gRecorder.piecePayloads()) lastPieceIn_ = buf;
+
+        if (!pooled) {
+            storePiece_(*pm, idx, codec, *buf, want);
+            std::lock_guard<ProfiledMutex> lk(qMtx_);
+            freeBufs_.push_back(std::move(buf));
+            return true;
+        }
+
+        gWorkPool.post([this, pm, idx, codec, want, buf]{
+            P2P_PROFILE_PEER(remotePeerId_);
+            storePiece_(*pm, idx, codec, *buf, want);
+            {
+                std::lock_guard<ProfiledMutex> lk(qMtx_);
+                freeBufs_.push_back(buf);
+            }
+            taskDone_();
+        });
         return true;
     }
 
-        void ConnectionHandler::run_(){
-        // 1) Send handshake
-        auto hs = Handshake::encode(selfId_);
-        if (!sendAll_(hs.data(), hs.size())) {
+    // Pool side of a received PIECE: decompress if needed, write, tell the swarm.
+    void ConnectionHandler::storePiece_(PieceManager& pm, uint32_t idx, PieceCodec codec,
+                                        const AlignedBuffer& wire, size_t size){
+        P2P_SCOPE("storePiece_");
+        const uint8_t* data = wire.data();
+        if (codec == PieceCodec::LZ4) {
+            static thread_local AlignedBuffer raw; // aligned for DirectIO
+            raw.resize(size);
+            if (!lz4::decompress(wire.data(), wire.size(), raw.data(), size)) {
+                logger_.error("Corrupt compressed piece " + std::to_string(idx) +
+                              " from peer " + std::to_string(remotePeerId_) + ".");
+                pm.abortWrite(idx);
+                return;
+            }
+            data = raw.data();
+        }
+
+        bool wasNew = false;
+        try {
+            wasNew = pm.writePiece(idx, data, size);
+        } catch (...) {
+            // Ignore write failures for now; someone can send it again.
+            pm.abortWrite(idx);
             return;
         }
+        if (wasNew) announceHave_(idx);
+        // This piece may have completed an erasure-coded stripe.
+        auto rebuilt = pm.takeRecovered();
+        size_t decoded = 0;
+        for (size_t r : rebuilt) {
+            announceHave_(static_cast<uint32_t>(r));
+            if (r < pm.dataPieceCount()) ++decoded;
+        }
+        if (decoded > 0) {
+            logger_.info("Rebuilt " + std::to_string(decoded) + " piece(s) of swarm " +
+                         std::to_string(swarmId_) + " from parity.");
+        }
+    }
 
-        // 2) Receive handshake
+    // Another peer's manifest: write what the old copy already has, tell the
+    // swarm, and let requests for the rest go ahead. The scan reads the whole
+    // old copy, so it runs on the pool; the receive loops pick up the
+    // requests within HOLD_POLL_MS of it finishing.
+    void ConnectionHandler::onManifest_(const uint8_t* data, size_t n){
+        {
+            std::lock_guard<ProfiledMutex> lk(qMtx_);
+            if (writerStop_) return;
+            ++tasks_;
+        }
+        auto payload = std::make_shared<std::vector<uint8_t>>(data, data + n);
+        gWorkPool.post([this, payload]{
+            P2P_PROFILE_PEER(remotePeerId_);
+            auto t0 = std::chrono::steady_clock::now();
+            std::optional<std::vector<size_t>> reused;
+            try {
+                reused = delta_->apply(payload->data(), payload->size());
+            } catch (const std::exception& e) {
+                logger_.error("Manifest from peer " + std::to_string(remotePeerId_) + ": " + e.what());
+            }
+            if (reused) { // else empty, or another connection's was used
+                for (size_t i : *reused) announceHave_(static_cast<uint32_t>(i));
+                for (size_t r : pm_->takeRecovered()) announceHave_(static_cast<uint32_t>(r));
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+                logger_.info("Reused " + std::to_string(reused->size()) + " of " + std::to_string(pm_->dataPieceCount()) +
+                             " pieces from " + delta_->oldPath() + " (manifest from peer " + std::to_string(remotePeerId_) +
+                             ", " + std::to_string(ms) + " ms); fetching the rest.");
+            }
+            taskDone_();
+        });
+    }
+
+    // Which pieces are all zeros, if we know any. Goes out before our bitfield so
+    // the remote never asks for one of them.
+    void ConnectionHandler::sendZeroPieces_(){
+        if (!(caps_ & CAP_ZERO_PIECES)) return;
+        auto zeros = pm_->zeroPieces();
+        if (zeros.count() == 0) return;
+        send(msg::zeroPieces(zeros.encodeRuns()));
+    }
+
+    // A peer's list of all-zero pieces: take the ones we're missing as they
+    // are, and pass the list on to neighbors that may not have heard it yet.
+    void ConnectionHandler::onZeroPieces_(const uint8_t* data, size_t n){
+        std::vector<size_t> fresh;
+        try {
+            fresh = pm_->markZero(CompactBitfield::decodeRuns(data, n, pm_->dataPieceCount()));
+        } catch (const std::exception& e) {
+            logger_.error("Zero pieces from peer " + std::to_string(remotePeerId_) + ": " + e.what());
+            return;
+        }
+        if (fresh.empty()) return; // nothing new to us, so nothing new to pass on
+
+        for (size_t i : fresh) announceHave_(static_cast<uint32_t>(i));
+        for (size_t r : pm_->takeRecovered()) announceHave_(static_cast<uint32_t>(r));
+        logger_.info("Took " + std::to_string(fresh.size()) + " all-zero piece(s) of swarm " +
+                     std::to_string(swarmId_) + " without downloading them (list from peer " +
+                     std::to_string(remotePeerId_) + ").");
+        if (mgr_) {
+            mgr_->forEach([&](ConnectionHandler& h){
+                if (&h != this && h.swarmId() == swarmId_ && h.remotePeerId() >= 0) h.sendZeroPieces_();
+            });
+        }
+    }
+
+    // Inform neighbors in this swarm that we now have this piece.
+    void ConnectionHandler::announceHave_(uint32_t idx){
+        auto haveMsg = msg::have(idx);
+        if (mgr_) {
+            mgr_->forEach([&](ConnectionHandler& h){
+                if (h.swarmId() == swarmId_ && h.remotePeerId() >= 0) h.send(haveMsg);
+            });
+        } else {
+            send(haveMsg);
+        }
+    }
+
+    void ConnectionHandler::superSeedOffer(){
+        int remote = remotePeerId_.load();
+        if (!superSeed_ || remote < 0) return;
+        int piece = superSeed_->offer(remote);
+        if (piece >= 0) send(msg::have(static_cast<uint32_t>(piece)));
+    }
+
+    void ConnectionHandler::superSeedTick(){
+        int remote = remotePeerId_.load();
+        if (!superSeed_ || remote < 0) return;
+        if (superSeed_->releaseIfStalled(remote, SuperSeed::clock::now())) superSeedOffer();
+    }
+
+    // Give each of these peers (in this swarm) its next super-seed offer.
+    void ConnectionHandler::offerTo_(const std::vector<int>& peers){
+        for (int p : peers) {
+            if (p == remotePeerId_) {
+                superSeedOffer();
+            } else if (mgr_) {
+                mgr_->forEach([&](ConnectionHandler& h){
+                    if (h.swarmId() == swarmId_ && h.remotePeerId() == p) h.superSeedOffer();
+                });
+            }
+        }
+    }
+
+    void ConnectionHandler::sendPex(){
+        int remote = remotePeerId_.load();
+        if (!(caps_ & CAP_PEX) || remote < 0) return;
+
+        // Ourselves first (empty host: "where this connection comes from"), then a
+        // random slice of the book so gossip covers it over a few rounds.
+        std::vector<PexEntry> entries;
+        if (gNetOptions.listenPort > 0) {
+            entries.push_back({selfId_, "", static_cast<uint16_t>(gNetOptions.listenPort)});
+        }
+        for (const auto& r : gPeerBook.sample(MAX_PEX_ENTRIES - entries.size(), remote)) {
+            entries.push_back({r.peerId, r.host, static_cast<uint16_t>(r.port)});
+        }
+        send(msg::pex(entries));
+    }
+
+    void ConnectionHandler::onPex_(const uint8_t* data, size_t n){
+        auto now = std::chrono::steady_clock::now();
+        if (lastPexIn_ != std::chrono::steady_clock::time_point{} && now - lastPexIn_ < PEX_MIN_GAP) {
+            return; // gossiping too fast
+        }
+        lastPexIn_ = now;
+
+        std::vector<PexEntry> entries;
+        try {
+            entries = decodePex(data, n, MAX_PEX_ENTRIES);
+        } catch (const std::exception& e) {
+            logger_.error(std::string("Bad PEX from peer ") + std::to_string(remotePeerId_) + ": " + e.what());
+            return;
+        }
+
+        size_t learned = 0;
+        for (auto& e : entries) {
+            if (e.peerId == selfId_) continue;
+            PeerInfoRow row;
+            row.peerId = e.peerId;
+            row.host = e.host.empty() ? remoteHost_() : e.host;
+            row.port = e.port;
+            if (gPeerBook.add(row)) ++learned;
+        }
+        if (learned > 0) {
+            logger_.info("Learned " + std::to_string(learned) + " peer(s) from peer " +
+                         std::to_string(remotePeerId_) + ".");
+        }
+    }
+
+    // Dialing side: if we negotiated CAP_LOCAL, tell the remote where to find us
+    // on this machine. It answers by connecting (same host) or not at all.
+    // Not over a TcpRoute (nor UDP, below): that link goes through the proxy on purpose.
+    void ConnectionHandler::offerLocal_(){
+        if (incoming_ || !(caps_ & CAP_LOCAL) || !gLocalListener.running()) return;
+        if (gNetOptions.tcpRoutes.count(remotePeerId_)) return;
+        localNonce_ = gLocalListener.expect([this](std::unique_ptr<Transport> t){ attachTransport_(std::move(t)); });
+        send(msg::localOffer({localNonce_, LocalListener::hostId(), gLocalListener.address()}));
+    }
+
+    void ConnectionHandler::onLocalOffer_(const uint8_t* data, size_t n){
+        LocalOffer offer;
+        try {
+            offer = decodeLocalOffer(data, n);
+        } catch (const std::exception& e) {
+            logger_.error(std::string("Bad LOCAL_OFFER from peer ") + std::to_string(remotePeerId_) + ": " + e.what());
+            return;
+        }
+        if (offer.hostId.empty() || offer.hostId != LocalListener::hostId()) return; // another machine
+        if (!LocalListener::isListenerAddress(offer.address)) {
+            logger_.error("Peer " + std::to_string(remotePeerId_) + " offered local socket " + offer.address +
+                          ", which isn't a p2p-local listener; staying on TCP.");
+            return;
+        }
+        {
+            std::lock_guard<ProfiledMutex> lk(qMtx_);
+            if (alt_) return;
+        }
+        auto t = LocalListener::connect(offer.address, offer.nonce);
+        if (!t) {
+            logger_.info("Peer " + std::to_string(remotePeerId_) + " is on this host but its local socket " +
+                         offer.address + " didn't answer; staying on TCP.");
+            return;
+        }
+        attachTransport_(std::move(t));
+    }
+
+    // Dialing side, after offerLocal_(): a same-host answer wins, else the other
+    // side may reach us on gUdpMux.
+    void ConnectionHandler::offerUdp_(){
+        if (incoming_ || !(caps_ & CAP_UDP) || !gUdpMux.running()) return;
+        if (gNetOptions.tcpRoutes.count(remotePeerId_)) return; // stays on the routed TCP link
+        uint32_t id = gUdpMux.newConnId();
+        auto t = gUdpMux.open(id);
+        if (!t) return;
+        watchUdp_(t);
+        send(msg::udpOffer(id, static_cast<uint16_t>(gUdpMux.port())));
+    }
+
+    void ConnectionHandler::onUdpOffer_(const uint8_t* data, size_t n){
+        if (n < 6 || !gUdpMux.running()) return;
+        uint32_t id = (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | uint32_t(data[3]);
+        int port = (data[4] << 8) | data[5];
+        {
+            std::lock_guard<ProfiledMutex> lk(qMtx_);
+            if (alt_ || udpPending_) return;
+        }
+        Endpoint ep{remoteHost_(), port};
+        auto route = gNetOptions.udpRoutes.find(remotePeerId_);
+        if (route != gNetOptions.udpRoutes.end()) ep = route->second;
+        auto t = gUdpMux.open(id, ep.host, ep.port);
+        if (!t) {
+            logger_.info("Can't reach peer " + std::to_string(remotePeerId_) + " over UDP at " +
+                         ep.host + ":" + std::to_string(ep.port) + "; staying on TCP.");
+            return;
+        }
+        watchUdp_(t);
+        t->connect();
+    }
+
+    // Move over as soon as the other end answers (gUdpMux's thread).
+    void ConnectionHandler::watchUdp_(std::shared_ptr<UdpTransport> t){
+        {
+            std::lock_guard<ProfiledMutex> lk(qMtx_);
+            udpPending_ = t;
+        }
+        t->setOnEstablished([this]{
+            std::shared_ptr<UdpTransport> ready;
+            {
+                std::lock_guard<ProfiledMutex> lk(qMtx_);
+                ready = std::move(udpPending_);
+            }
+            if (ready) attachTransport_(std::move(ready));
+        });
+    }
+
+    // Both sides end up here with their end of the new transport; the writer
+    // moves over once it has sent TRANSPORT_SWITCH. First one wins.
+    void ConnectionHandler::attachTransport_(std::shared_ptr<Transport> t){
+        {
+            std::lock_guard<ProfiledMutex> lk(qMtx_);
+            if (writerStop_ || alt_) {
+                t->shutdown();
+                return;
+            }
+            alt_ = t;
+            switchOut_ = true;
+        }
+        qCv_.notify_all();
+        bool udp = dynamic_cast<UdpTransport*>(t.get()) != nullptr;
+        logger_.info("Connection with peer " + std::to_string(remotePeerId_) + " moved to the " +
+                     (udp ? "UDP" : "local") + " transport.");
+    }
+
+    // Numeric address of the other end of this connection ("" if unknown).
+    std::string ConnectionHandler::remoteHost_() const{
+        return io_->remoteHost();
+    }
+
+    // Notify under the lock: once tasks_ hits 0 the destructor may free us.
+    void ConnectionHandler::taskDone_(){
+        std::lock_guard<ProfiledMutex> lk(qMtx_);
+        --tasks_;
+        qCv_.notify_all();
+    }
+
+    void ConnectionHandler::runSession_(){
+        // 1) Handshake. The incoming side waits for the remote's first so it
+        //    knows which swarm is being asked for, then answers with the same id.
+        uint32_t ourCaps = localCaps();
         std::array<uint8_t, Handshake::LEN> buf{};
+
+        if (!incoming_) {
+            auto hs = Handshake::encode(selfId_, ourCaps, swarmId_);
+            if (!sendAll_(hs.data(), hs.size())) {
+                return;
+            }
+        }
+
+        // 2) Receive handshake
         if (!recvAll_(buf.data(), buf.size())) {
             return;
         }
@@ -86,54 +695,180 @@ namespace p2p {
             return; // invalid handshake
         }
 
+        uint32_t remoteSwarm = Handshake::decodeSwarmId(buf);
+        if (incoming_) {
+            swarmId_ = remoteSwarm;
+        } else if (remoteSwarm != swarmId_) {
+            return; // answered for a different file
+        }
+
+        auto swarm = gSwarms.get(swarmId_);
+        if (swarm) pm_ = swarm->pieces;
+        if (!pm_) {
+            logger_.error("Peer " + std::to_string(remotePeerId_) +
+                          " asked for unknown swarm " + std::to_string(swarmId_) + ".");
+            return;
+        }
+
+        if (incoming_) {
+            auto hs = Handshake::encode(selfId_, ourCaps, swarmId_);
+            if (!sendAll_(hs.data(), hs.size())) {
+                return;
+            }
+        }
+
+        // Super-seed only while we're the one with the whole file.
+        if (swarm->superSeed && pm_->isComplete()) superSeed_ = swarm->superSeed;
+        delta_ = swarm->delta;
+
+        // Extensions are only used if both sides offered them.
+        caps_ = ourCaps & Handshake::decodeCaps(buf);
+        touch_();
+        if (gRecorder.enabled()) recId_ = gRecorder.onOpen(remotePeerId_, swarmId_, incoming_, caps_);
+
+        // Handshakes are written directly; everything after goes through the queue.
+        lastSendNs_.store(std::chrono::steady_clock::now().time_since_epoch().count());
+        writer_ = std::thread(&ConnectionHandler::writeLoop_, this);
+
+        if (gNetOptions.keepAliveSec > 0 || gNetOptions.deadPeerSec > 0) {
+            int every = gNetOptions.keepAliveSec > 0 ? gNetOptions.keepAliveSec : gNetOptions.deadPeerSec;
+            liveTimer_ = gTimers.every(std::chrono::milliseconds(every * 500), [this]{ liveTick_(); });
+        }
+
+        // One connection per peer and swarm: the manager may tell us to drop this one.
+        if (mgr_ && !mgr_->registerPeer(*this)) {
+            return;
+        }
+
         // 3) Log incoming connection once we know who connected
         if (incoming_) {
             logger_.onConnectIn(selfId_, remotePeerId_);
         }
 
-        // 4) After handshake, send our bitfield (if we have one)
-        if (!selfBitfield_.empty()) {
-            auto m = msg::bitfield(selfBitfield_);
-            send(m);
-        }
+        remoteBitfield_.reset(pm_->pieceCount());
+
+        // 4) After handshake, tell the remote what we have (and who we know)
+        sendZeroPieces_();
+        sendInitialHaves_();
+        sendPex();
+        offerLocal_();
+        offerUdp_();
+        // Updating from an old copy: the first peer to answer decides what we reuse.
+        if ((caps_ & CAP_MANIFEST) && delta_ && delta_->wantManifest()) send(msg::manifestRequest());
+
+        // Helper: does the remote have any piece we are missing?
+        // Walks the remote's set runs, so it stays cheap on the compact form.
+        auto remoteHasWanted = [this]() -> bool {
+            auto& pm = *pm_;
+            bool found = false;
+            remoteBitfield_.forEachRange([&](size_t b, size_t e){
+                if (pm.firstMissingIn(b, e) < e) { found = true; return false; }
+                return true;
+            });
+            return found;
+        };
+
+        // Helper: pick the next piece to request from this neighbor.
+        auto pickNextRequestPiece = [this]() -> int {
+            P2P_SCOPE("pickNextRequestPiece");
+            auto& pm = *pm_;
+            int next = -1;
+            bool fresh = true; // only pieces no other connection has on order
+
+            auto firstFrom = [&](size_t b, size_t e){
+                return fresh ? pm.firstUnrequestedIn(b, e) : pm.firstMissingIn(b, e);
+            };
+            auto gaveUpOn = [&](size_t i){
+                return std::find(timedOut_.begin(), timedOut_.end(), i) != timedOut_.end();
+            };
+
+            // First piece in [lo, hi) the remote has (per remoteBitfield_) that we don't.
+            auto firstIn = [&](size_t lo, size_t hi){
+                remoteBitfield_.forEachRange([&](size_t b, size_t e){
+                    if (b >= hi) return false;
+                    b = std::max(b, lo);
+                    e = std::min(e, hi);
+                    if (b >= e) return true;
+                    for (size_t i = firstFrom(b, e); i < e; i = firstFrom(i + 1, e)) {
+                        if (!gaveUpOn(i)) { next = static_cast<int>(i); return false; }
+                    }
+                    return true;
+                });
+            };
+
+            // Streaming: the pieces just ahead of the consumer come first.
+            auto [wb, we] = pm.priorityWindow();
+            auto pick = [&]{
+                if (wb < we) firstIn(wb, we);
+                if (next < 0) firstIn(0, pm.pieceCount());
+            };
+            pick();
+
+            // End game: all we still need from them is on order elsewhere. Ask
+            // anyway (first PIECE wins), unless this peer keeps stalling.
+            if (next < 0 && strikes_ < DEMOTE_AFTER_STRIKES) {
+                fresh = false;
+                pick();
+            }
+            return next; // -1: nothing useful to request
+        };
+
+        // Helper: keep one REQUEST outstanding while we're interested. Called whenever
+        // interest turns on or a piece lands, so a connection that becomes useful
+        // later (via HAVE) still starts downloading.
+        auto requestNext = [this, &pickNextRequestPiece]() {
+            if (!amInterested_ || inFlight_ >= 0) return;
+            if (delta_ && delta_->holding()) return; // until we know what the old copy has
+            int next = pickNextRequestPiece();
+            if (next >= 0) {
+                inFlight_ = next;
+                pm_->noteRequested(static_cast<size_t>(next));
+                reqSentAt_ = std::chrono::steady_clock::now();
+                reqDeadline_ = reqSentAt_ + requestTimeout_();
+                auto req = msg::request(static_cast<uint32_t>(next));
+                send(req);
+            }
+        };
+
+        // Helper: the PIECE we asked for didn't come in time. Let another holder
+        // have it, stop asking this peer for it, and move on to something else.
+        auto requestTimedOut = [this, &requestNext]() {
+            uint32_t idx = static_cast<uint32_t>(inFlight_);
+            auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - reqSentAt_).count();
+            pm_->clearRequested(idx);
+            inFlight_ = -1;
+            ++strikes_;
+            timeouts_.fetch_add(1);
+            timedOut_.push_back(idx);
+            if (timedOut_.size() > MAX_TIMED_OUT_PIECES) timedOut_.pop_front();
+
+            logger_.info("Request for piece " + std::to_string(idx) + " from peer " +
+                         std::to_string(remotePeerId_) + " timed out after " +
+                         std::to_string(waited) + " ms.");
+            if (strikes_ == DEMOTE_AFTER_STRIKES) {
+                logger_.info("Peer " + std::to_string(remotePeerId_) +
+                             " keeps timing out; asking it only for pieces nobody else is fetching.");
+            }
+            requestNext();
+        };
 
         // Helper: recompute whether WE are interested in this neighbor,
         // and send INTERESTED / NOT_INTERESTED if our state changes.
-        auto recomputeInterestAndSend = [this]() {
-            if (remoteBitfield_.empty()) {
+        auto recomputeInterestAndSend = [this, &remoteHasWanted, &requestNext]() {
+            if (!remoteKnown_) {
                 // We don't know anything about the remote's pieces yet.
                 return;
             }
 
-            bool interested = false;
-
-            if (selfBitfield_.empty()) {
-                // We have nothing: if remote has any 1-bits, we are interested.
-                for (uint8_t b : remoteBitfield_) {
-                    if (b != 0) {
-                        interested = true;
-                        break;
-                    }
-                }
-            } else {
-                // Compare byte-by-byte: remote & ~self
-                size_t n = std::min(selfBitfield_.size(), remoteBitfield_.size());
-                for (size_t i = 0; i < n; ++i) {
-                    uint8_t newBits =
-                        remoteBitfield_[i] &
-                        static_cast<uint8_t>(~selfBitfield_[i]);
-                    if (newBits != 0) {
-                        interested = true;
-                        break;
-                    }
-                }
-            }
+            bool interested = remoteHasWanted();
 
             if (interested != amInterested_) {
                 amInterested_ = interested;
                 if (interested) {
                     auto m = msg::interested();
                     send(m);
+                    requestNext();
                 } else {
                     auto m = msg::notInterested();
                     send(m);
@@ -141,59 +876,136 @@ namespace p2p {
             }
         };
 
-        // Helper: pick the next piece to request from this neighbor.
-        auto pickNextRequestPiece = [this]() -> int {
-            if (!p2p::gPieceManager) return -1;
-
-            auto& pm = *p2p::gPieceManager;
-            size_t total = pm.pieceCount();
-
-            for (size_t i = 0; i < total; ++i) {
-                // Skip pieces we already have.
-                if (pm.havePiece(i)) continue;
-
-                // Check if remote has this piece according to remoteBitfield_.
-                size_t byte = i / 8;
-                size_t bit  = 7 - (i % 8);
-                if (byte >= remoteBitfield_.size()) continue;
-
-                bool remoteHas =
-                    (remoteBitfield_[byte] & (uint8_t(1) << bit)) != 0;
-                if (!remoteHas) continue;
-
-                return static_cast<int>(i);
+        // Helper: first look at the remote's pieces (BITFIELD / HAVE_ALL / HAVE_NONE).
+        // Always sends one INTERESTED or NOT_INTERESTED.
+        auto initialInterest = [this, &remoteHasWanted, &requestNext]() {
+            remoteKnown_ = true;
+            if (superSeed_) offerTo_(superSeed_->onBitfield(remotePeerId_, remoteBitfield_));
+            bool interested = remoteHasWanted();
+
+            amInterested_ = interested;
+            if (interested) {
+                auto m = msg::interested();
+                send(m);
+
+                // TEMP: immediately request a piece from this neighbor.
+                // Person B can later gate this on "unchoked" state.
+                requestNext();
+            } else {
+                auto m = msg::notInterested();
+                send(m);
             }
-            return -1; // nothing useful to request
         };
 
         // 5) Main receive loop for length-prefixed messages
         while (running_.load()) {
+            // Don't block past the outstanding REQUEST's deadline (or, with nothing
+            // on order, past the next look for something to request).
+            int waitMs = -1;
+            if (inFlight_ >= 0) {
+                auto left = reqDeadline_ - std::chrono::steady_clock::now();
+                if (left <= std::chrono::steady_clock::duration::zero()) {
+                    requestTimedOut();
+                    continue;
+                }
+                waitMs = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(left).count());
+            } else if (amInterested_) {
+                waitMs = (delta_ && delta_->holding()) ? HOLD_POLL_MS : IDLE_RETRY_MS;
+            }
+            if (waitMs >= 0) {
+                int r = waitReadable_(waitMs);
+                if (r < 0) break;
+                if (r == 0) {
+                    requestNext();
+                    continue;
+                }
+            }
+
             // Read 4-byte length; if socket closes, we break
             uint8_t lenBuf[4];
             if (!recvAll_(lenBuf, 4)) {
                 break;
             }
 
+            // The rest of the iteration is this frame's (the wait for it isn't).
+            P2P_PROFILE_PEER(remotePeerId_);
+            P2P_SCOPE("frame");
+
             uint32_t len =
                 (uint32_t(lenBuf[0]) << 24) |
                 (uint32_t(lenBuf[1]) << 16) |
                 (uint32_t(lenBuf[2]) << 8)  |
                  uint32_t(lenBuf[3]);
 
+            heard_();
+
             // Keep-alive: length 0 => no type, no payload
             if (len == 0) {
+                record_(Recorder::IN, Recorder::KEEP_ALIVE, 0, nullptr, 0);
                 continue;
             }
+            touch_(); // a real message: not idle
 
-            // Read message body (type + payload)
-            std::vector<uint8_t> body(len);
-            if (!recvAll_(body.data(), len)) {
+            // First byte is the message type
+            uint8_t typeByte = 0;
+            if (!recvAll_(&typeByte, 1)) {
                 break;
             }
+            MessageType type = static_cast<MessageType>(typeByte);
+
+            // PIECE skips the generic body: read the header, then the data lands
+            // straight in a buffer that goes to the pool for the disk write.
+            if (type == MessageType::PIECE) {
+                P2P_SCOPE("PIECE");
+                size_t hdrLen = (caps_ & CAP_COMPRESSION) ? 5 : 4; // index (+ codec)
+                if (len - 1 < hdrLen) {
+                    if (!skip_(len - 1)) break;
+                    continue; // malformed
+                }
+                uint8_t hdr[5];
+                if (!recvAll_(hdr, hdrLen)) {
+                    break;
+                }
+                uint32_t idx =
+                    (uint32_t(hdr[0]) << 24) |
+                    (uint32_t(hdr[1]) << 16) |
+                    (uint32_t(hdr[2]) << 8)  |
+                     uint32_t(hdr[3]);
+                PieceCodec codec = (hdrLen == 5) ? static_cast<PieceCodec>(hdr[4]) : PieceCodec::RAW;
+
+                if (!recvPiece_(idx, codec, len - 1 - hdrLen)) {
+                    break;
+                }
+                if (lastPieceIn_) {
+                    record_(Recorder::IN, typeByte, len, hdr, hdrLen, lastPieceIn_->data(), lastPieceIn_->size());
+                    lastPieceIn_.reset();
+                } else {
+                    record_(Recorder::IN, typeByte, len, hdr, hdrLen);
+                }
+                if (static_cast<int>(idx) == inFlight_) {
+                    auto took = std::chrono::steady_clock::now() - reqSentAt_;
+                    onRtt_(std::chrono::duration<double, std::milli>(took).count());
+                    pm_->clearRequested(idx);
+                    inFlight_ = -1;
+                    strikes_ = 0;
+                    timedOut_.clear();
+                }
 
-            // First byte is the message type
-            MessageType type = static_cast<MessageType>(body[0]);
+                // Try to request another piece from this neighbor.
+                recomputeInterestAndSend();
+                requestNext();
+                continue;
+            }
+
+            // Read the rest of the body; body[0] stays the type byte.
+            std::vector<uint8_t> body(len);
+            body[0] = typeByte;
+            if (len > 1 && !recvAll_(body.data() + 1, len - 1)) {
+                break;
+            }
+            record_(Recorder::IN, typeByte, len, body.data() + 1, len - 1);
 
+            P2P_SCOPE(messageTypeName(typeByte));
             switch (type) {
                 case MessageType::BITFIELD: {
                     // Payload is the remote peer's bitfield bytes
@@ -207,53 +1019,43 @@ namespace p2p {
                                  std::to_string(remotePeerId_) + ".");
 
                     // Store remote bitfield for this connection
-                    remoteBitfield_ = std::move(remoteBits);
-
-                    // --- Initial interest decision: always send one message ---
-                    bool interested = false;
-
-                    if (selfBitfield_.empty()) {
-                        // We have nothing: if remote has any 1-bits, we are interested.
-                        for (uint8_t b : remoteBitfield_) {
-                            if (b != 0) {
-                                interested = true;
-                                break;
-                            }
-                        }
-                    } else {
-                        // Compare byte-by-byte: remote & ~self
-                        size_t n = std::min(selfBitfield_.size(), remoteBitfield_.size());
-                        for (size_t i = 0; i < n; ++i) {
-                            uint8_t newBits =
-                                remoteBitfield_[i] &
-                                static_cast<uint8_t>(~selfBitfield_[i]);
-                            if (newBits != 0) {
-                                interested = true;
-                                break;
-                            }
-                        }
+                    remoteBitfield_ = CompactBitfield::fromBytes(remoteBits, remoteBitfield_.pieceCount());
+                    initialInterest();
+                    break;
+                }
+
+                case MessageType::BITFIELD_RUNS: {
+                    if (!(caps_ & CAP_COMPACT_BITFIELD)) {
+                        break; // not negotiated
                     }
 
-                    // Send INTERESTED or NOT_INTERESTED once for the initial bitfield
-                    amInterested_ = interested;
-                    if (interested) {
-                        auto m = msg::interested();
-                        send(m);
-
-                        // TEMP: immediately request a piece from this neighbor.
-                        // Person B can later gate this on "unchoked" state.
-                        if (p2p::gPieceManager) {
-                            int next = pickNextRequestPiece();
-                            if (next >= 0) {
-                                auto req = msg::request(static_cast<uint32_t>(next));
-                                send(req);
-                            }
-                        }
-                    } else {
-                        auto m = msg::notInterested();
-                        send(m);
+                    try {
+                        remoteBitfield_ = CompactBitfield::decodeRuns(body.data() + 1, body.size() - 1,
+                                                                      remoteBitfield_.pieceCount());
+                    } catch (const std::exception& e) {
+                        logger_.error(std::string("Bad run-length bitfield from peer ") +
+                                      std::to_string(remotePeerId_) + ": " + e.what());
+                        break;
+                    }
+                    logger_.info("Received bitfield from peer " +
+                                 std::to_string(remotePeerId_) + ".");
+                    initialInterest();
+                    break;
+                }
+
+                case MessageType::HAVE_ALL:
+                case MessageType::HAVE_NONE: {
+                    if (!(caps_ & CAP_FAST_HAVE)) {
+                        break; // not negotiated
                     }
 
+                    bool all = (type == MessageType::HAVE_ALL);
+                    logger_.info(std::string("Received ") + (all ? "have-all" : "have-none") +
+                                 " from peer " + std::to_string(remotePeerId_) + ".");
+
+                    remoteBitfield_.reset(remoteBitfield_.pieceCount());
+                    if (all) remoteBitfield_.setRange(0, remoteBitfield_.pieceCount());
+                    initialInterest();
                     break;
                 }
 
@@ -273,38 +1075,119 @@ namespace p2p {
                     logger_.onReceivedHave(selfId_, remotePeerId_, idx);
 
                     // Update remoteBitfield_ to reflect this piece
-                    size_t byte = idx / 8;
-                    size_t bit  = 7 - (idx % 8);
+                    if (idx >= remoteBitfield_.pieceCount()) {
+                        break; // out of range
+                    }
+                    remoteBitfield_.set(idx);
+                    remoteKnown_ = true;
+                    if (superSeed_) offerTo_(superSeed_->onHave(remotePeerId_, idx));
+
+                    // Re-evaluate interest based on the new piece
+                    recomputeInterestAndSend();
+                    break;
+                }
 
-                    if (remoteBitfield_.size() <= byte) {
-                        remoteBitfield_.resize(byte + 1, 0);
+                case MessageType::PEX: {
+                    if (!(caps_ & CAP_PEX)) {
+                        break; // not negotiated
                     }
+                    onPex_(body.data() + 1, body.size() - 1);
+                    break;
+                }
 
-                    remoteBitfield_[byte] |= (uint8_t(1) << bit);
+                case MessageType::LOCAL_OFFER: {
+                    if (!(caps_ & CAP_LOCAL) || !incoming_) {
+                        break; // not negotiated, or not ours to answer
+                    }
+                    onLocalOffer_(body.data() + 1, body.size() - 1);
+                    break;
+                }
 
-                    // Re-evaluate interest based on the new piece
+                case MessageType::UDP_OFFER: {
+                    if (!(caps_ & CAP_UDP) || !incoming_) {
+                        break; // not negotiated, or not ours to answer
+                    }
+                    onUdpOffer_(body.data() + 1, body.size() - 1);
+                    break;
+                }
+
+                case MessageType::MANIFEST_REQUEST: {
+                    if (!(caps_ & CAP_MANIFEST) || !delta_) {
+                        break; // not negotiated
+                    }
+                    {
+                        std::lock_guard<ProfiledMutex> lk(qMtx_);
+                        if (writerStop_) break;
+                        ++tasks_;
+                    }
+                    // The first one reads the whole file; answered when that's done.
+                    delta_->manifest([this](const std::vector<uint8_t>& payload, const std::string& error){
+                        if (error.empty()) send(msg::manifest(payload));
+                        else logger_.error("Can't build manifest: " + error);
+                        taskDone_();
+                    });
+                    break;
+                }
+
+                case MessageType::MANIFEST: {
+                    if (!(caps_ & CAP_MANIFEST) || !delta_) {
+                        break; // not negotiated
+                    }
+                    onManifest_(body.data() + 1, body.size() - 1);
+                    break;
+                }
+
+                case MessageType::ZERO_PIECES: {
+                    if (!(caps_ & CAP_ZERO_PIECES)) {
+                        break; // not negotiated
+                    }
+                    onZeroPieces_(body.data() + 1, body.size() - 1);
                     recomputeInterestAndSend();
                     break;
                 }
 
+                case MessageType::TRANSPORT_SWITCH: {
+                    // Everything after this comes over the new transport. Ours may
+                    // still be on its way from gLocalListener's or gUdpMux's thread.
+                    // A UDP dialer only switches once it has our STATE, so if we've
+                    // seen its SYN but lost its reply, this marker confirms it.
+                    std::shared_ptr<UdpTransport> udp;
+                    {
+                        std::lock_guard<ProfiledMutex> lk(qMtx_);
+                        if (!alt_) udp = udpPending_;
+                    }
+                    if (udp) udp->confirm(); // attaches it through the callback
+                    Transport* next = nullptr;
+                    {
+                        ProfiledLock lk(qMtx_);
+                        qCv_.wait_for(lk, TRANSPORT_SWITCH_WAIT, [this]{ return alt_ || writerStop_; });
+                        next = alt_.get();
+                    }
+                    if (!next) {
+                        logger_.error("Peer " + std::to_string(remotePeerId_) +
+                                      " switched to a transport we don't have; closing.");
+                        return;
+                    }
+                    rx_ = next;
+                    break;
+                }
+
                 case MessageType::INTERESTED: {
                     logger_.onReceivedInterested(selfId_, remotePeerId_);
+                    peerInterested_.store(true);
                     // Later: mark neighbor as "interested" in shared state.
                     break;
                 }
 
                 case MessageType::NOT_INTERESTED: {
                     logger_.onReceivedNotInterested(selfId_, remotePeerId_);
+                    peerInterested_.store(false);
                     // Later: mark neighbor as "not interested" in shared state.
                     break;
                 }
 
                 // Handle a REQUEST from the remote peer: send them the piece.
                 case MessageType::REQUEST: {
-                    if (!p2p::gPieceManager) {
-                        break;
-                    }
-
                     // Payload: 4-byte piece index (big-endian)
                     if (body.size() < 1 + 4) {
                         break; // malformed
@@ -316,107 +1199,162 @@ namespace p2p {
                         (uint32_t(body[3]) << 8)  |
                          uint32_t(body[4]);
 
-                    auto& pm = *p2p::gPieceManager;
+                    auto& pm = *pm_;
 
                     // Only serve if we actually have this piece.
                     if (idx >= pm.pieceCount() || !pm.havePiece(idx)) {
                         break;
                     }
 
-                    try {
-                        auto data = pm.readPiece(idx);
-                        auto m = msg::piece(idx, data);
-                        send(m);
-                        // (Optional) Person B can count uploaded bytes here.
-                    } catch (...) {
-                        // On read failure, ignore this REQUEST for now.
-                    }
-
+                    serveRequest_(idx);
                     break;
                 }
 
-                // Handle a PIECE sent by the remote: write it and maybe request another.
-                case MessageType::PIECE: {
-                    if (!p2p::gPieceManager) {
-                        break;
-                    }
-
-                    // Need at least 4 bytes of piece index
-                    if (body.size() < 1 + 4) {
-                        break;
-                    }
+                default:
+                    // Other message types (CHOKE, UNCHOKE, REQUEST, PIECE, etc.)
+                    // will be handled in later steps.
+                    break;
+            }
+        }
+    }
 
-                    uint32_t idx =
-                        (uint32_t(body[1]) << 24) |
-                        (uint32_t(body[2]) << 16) |
-                        (uint32_t(body[3]) << 8)  |
-                         uint32_t(body[4]);
 
-                    // Remaining bytes are the piece data
-                    std::vector<uint8_t> payload;
-                    payload.reserve(body.size() - 1 - 4);
-                    payload.insert(payload.end(), body.begin() + 1 + 4, body.end());
+    // Advertise our pieces right after the handshake. With CAP_FAST_HAVE a seeder
+    // sends HAVE_ALL instead of a full bitfield and an empty peer says HAVE_NONE,
+    // so the remote can tell "has nothing" from "hasn't told us yet".
+    void ConnectionHandler::sendInitialHaves_(){
+        // Super-seeding: look empty, then hand out pieces one at a time.
+        if (superSeed_) {
+            if (caps_ & CAP_FAST_HAVE) send(msg::haveNone());
+            superSeedOffer();
+            return;
+        }
 
-                    auto& pm = *p2p::gPieceManager;
+        auto selfBitfield = pm_->toBitfieldBytes();
+        size_t have = pm_->haveCount();
+        size_t total = pm_->pieceCount();
 
-                    if (idx >= pm.pieceCount()) {
-                        break;
-                    }
+        if (caps_ & CAP_FAST_HAVE) {
+            if (total > 0 && have == total) { send(msg::haveAll()); return; }
+            if (have == 0) { send(msg::haveNone()); return; }
+        }
+        if (selfBitfield.empty()) {
+            return;
+        }
+        // Large, mostly-contiguous bitfields are much smaller as runs.
+        if (caps_ & CAP_COMPACT_BITFIELD) {
+            auto runs = CompactBitfield::fromBytes(selfBitfield, total).encodeRuns();
+            if (runs.size() < selfBitfield.size()) {
+                send(msg::bitfieldRuns(runs));
+                return;
+            }
+        }
+        send(msg::bitfield(selfBitfield));
+    }
 
-                    try {
-                        bool wasNew = pm.writePiece(idx, payload);
-                        if (wasNew) {
-                            // Update our local bitfield cache for this connection.
-                            size_t byte = idx / 8;
-                            size_t bit  = 7 - (idx % 8);
-
-                            if (selfBitfield_.size() <= byte) {
-                                selfBitfield_.resize(byte + 1, 0);
-                            }
-                            selfBitfield_[byte] |= (uint8_t(1) << bit);
-
-                            // Inform neighbor(s) that we now have this piece.
-                            auto haveMsg = msg::have(idx);
-                            send(haveMsg);
-
-                            // Person B can track download stats here using payload.size().
-                        }
-
-                        // Try to request another piece from this neighbor.
-                        int next = pickNextRequestPiece();
-                        if (next >= 0) {
-                            auto req = msg::request(static_cast<uint32_t>(next));
-                            send(req);
-                        }
-
-                    } catch (...) {
-                        // Ignore write failures for now.
-                    }
+    // Read (and maybe compress) a requested piece on gWorkPool, then queue it.
+    // The receive loop keeps reading while the disk and codec do their work.
+    // Pieces read but not yet sent are capped at sendQueueBytes; REQUESTs over
+    // that wait until the writer has caught up.
+    void ConnectionHandler::serveRequest_(uint32_t idx){
+        size_t raw = static_cast<size_t>(pm_->pieceSize(idx));
+        {
+            std::lock_guard<ProfiledMutex> lk(qMtx_);
+            if (writerStop_) return;
+            if (uploadBytes_ > 0 && uploadBytes_ + raw > gNetOptions.sendQueueBytes) {
+                if (deferredReqs_.size() < MAX_DEFERRED_REQUESTS) deferredReqs_.emplace_back(idx, raw);
+                return;
+            }
+            uploadBytes_ += raw;
+            ++tasks_;
+        }
+        postUpload_(idx, raw);
+    }
 
-                    break;
+    // Caller has already counted this upload in uploadBytes_ and tasks_.
+    void ConnectionHandler::postUpload_(uint32_t idx, size_t raw){
+        std::shared_ptr<PieceManager> pm = pm_;
+        bool compress = (caps_ & CAP_COMPRESSION) != 0;
+        gWorkPool.post([this, pm, idx, raw, compress]{
+            P2P_PROFILE_PEER(remotePeerId_);
+            P2P_SCOPE("postUpload_");
+            try {
+                auto data = pm->readPiece(idx);
+                Message m;
+                if (!compress) {
+                    m = msg::piece(idx, data);
+                } else {
+                    // Skip compression for pieces that don't shrink (already-compressed data).
+                    auto packed = lz4::compress(data.data(), data.size());
+                    m = packed.empty() ? msg::piece(idx, PieceCodec::RAW, data)
+                                       : msg::piece(idx, PieceCodec::LZ4, packed);
                 }
-
-                default:
-                    // Other message types (CHOKE, UNCHOKE, REQUEST, PIECE, etc.)
-                    // will be handled in later steps.
-                    break;
+                queuePiece_(Message::serialize(m), raw);
+            } catch (...) {
+                // On read failure, ignore this REQUEST for now.
+                std::lock_guard<ProfiledMutex> lk(qMtx_);
+                uploadBytes_ -= raw;
             }
+            taskDone_();
+        });
+    }
+
+    void ConnectionHandler::queuePiece_(std::vector<uint8_t> bytes, size_t raw){
+        recordOut_(bytes);
+        {
+            std::lock_guard<ProfiledMutex> lk(qMtx_);
+            if (writerStop_) { uploadBytes_ -= raw; return; }
+            pieceOut_.push_back({std::move(bytes), raw});
         }
+        qCv_.notify_all();
+    }
+
+    void ConnectionHandler::record_(Recorder::Dir dir, uint8_t type, uint32_t len,
+                                    const uint8_t* a, size_t an, const uint8_t* b, size_t bn){
+        uint32_t id = recId_.load();
+        if (id) gRecorder.onMessage(id, dir, type, len, a, an, b, bn);
     }
 
+    // Outgoing message as serialized: [len(4)][type][body]. PIECE data is only
+    // kept if the recording asked for it.
+    void ConnectionHandler::recordOut_(const std::vector<uint8_t>& bytes){
+        if (!recId_.load() || bytes.size() < 5) return;
+        uint32_t len = static_cast<uint32_t>(bytes.size() - 4);
+        size_t n = bytes.size() - 5;
+        if (bytes[4] == static_cast<uint8_t>(MessageType::PIECE) && !gRecorder.piecePayloads()) {
+            n = std::min(n, size_t((caps_ & CAP_COMPRESSION) ? 5 : 4));
+        }
+        record_(Recorder::OUT, bytes[4], len, bytes.data() + 5, n);
+    }
 
     void ConnectionHandler::send(const Message& m){
-        std::lock_guard<std::mutex> lk(sendMtx_);
         auto bytes = Message::serialize(m);
-        sendAll_(bytes.data(), bytes.size());
+        recordOut_(bytes);
+        ProfiledLock lk(qMtx_);
+        if (writerStop_) return;
+
+        if (m.type == MessageType::PIECE || m.type == MessageType::MANIFEST) {
+            // Bulk: a manifest can be bigger than the control queue allows.
+            pieceOut_.push_back({std::move(bytes), 0});
+        } else {
+            if (ctrlOut_.size() + bytes.size() > CTRL_QUEUE_MAX) {
+                lk.unlock();
+                logger_.error("Peer " + std::to_string(remotePeerId_) +
+                              " stopped reading; closing the connection.");
+                close();
+                return;
+            }
+            ctrlOut_.insert(ctrlOut_.end(), bytes.begin(), bytes.end());
+        }
+        lk.unlock();
+        qCv_.notify_all();
     }
 
-    PeerServer::PeerServer(int selfId, Logger& logger, int listenPort,
-                       std::vector<uint8_t> selfBitfield)
+    PeerServer::PeerServer(int selfId, Logger& logger, int listenPort, ConnectionManager& conns)
     : selfId_(selfId),
       logger_(logger),
       port_(listenPort),
-      selfBitfield_(std::move(selfBitfield)) {}
+      conns_(conns) {}
 
 
     PeerServer::~PeerServer(){ stop(); }
@@ -438,10 +1376,9 @@ namespace p2p {
                 sockaddr_in cli{}; socklen_t cl = sizeof(cli);
                 socket_t s = ::accept(srv_, (sockaddr*)&cli, &cl);
                 if (s<0) continue;
-                // Spawn handler for an incoming connection
-                auto* h = new ConnectionHandler(selfId_, logger_, s, /*incoming=*/true, selfBitfield_);
-                h->start();
-                // We intentionally leak handlers for midpoint simplicity; OS reclaims on exit.
+                // Spawn handler for an incoming connection; it picks the swarm from the handshake.
+                // The manager owns it from here (and may refuse it if we're full).
+                conns_.adopt(std::make_unique<ConnectionHandler>(selfId_, logger_, s, /*incoming=*/true));
 
             }
             if (srv_>=0) { closesock(srv_); srv_=-1; }
@@ -453,9 +1390,9 @@ namespace p2p {
 
     std::unique_ptr<ConnectionHandler>
     PeerClient::connect(int selfId, Logger& logger, const Endpoint& ep,
-                        const std::vector<uint8_t>& selfBitfield) {
+                        uint32_t swarmId) {
     #if defined(_WIN32)
-        (void)selfId; (void)logger; (void)ep; return nullptr; // midpoint
+        (void)selfId; (void)logger; (void)ep; (void)swarmId; return nullptr; // midpoint
     #else
         addrinfo hints{}; hints.ai_family=AF_UNSPEC; hints.ai_socktype=SOCK_STREAM;
         addrinfo* res=nullptr;
@@ -474,7 +1411,7 @@ namespace p2p {
 
         auto h = std::make_unique<ConnectionHandler>(selfId, logger, s,
                                                  /*incoming=*/false,
-                                                 selfBitfield);
+                                                 swarmId);
         h->start();
         return h;
     #endif
@@ -0,0 +1,61 @@
+#include "p2p/PeerBook.hpp"
+
+#include <algorithm>
+
+namespace p2p {
+
+    PeerBook gPeerBook;
+
+    // Gossip can't grow the book without bound.
+    static constexpr size_t MAX_PEERS = 4096;
+
+    void PeerBook::setSelf(int selfId){
+        std::lock_guard<std::mutex> lk(mtx_);
+        selfId_ = selfId;
+        peers_.erase(selfId);
+    }
+
+    void PeerBook::setOnNew(OnNew fn){
+        std::lock_guard<std::mutex> lk(mtx_);
+        onNew_ = std::move(fn);
+    }
+
+    bool PeerBook::add(const PeerInfoRow& row){
+        if (row.host.empty() || row.port <= 0 || row.port > 65535) return false;
+        OnNew cb;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (row.peerId == selfId_) return false;
+            if (peers_.count(row.peerId) || peers_.size() >= MAX_PEERS) return false;
+            peers_.emplace(row.peerId, row);
+            cb = onNew_;
+        }
+        if (cb) cb(row);
+        return true;
+    }
+
+    std::vector<PeerInfoRow> PeerBook::sample(size_t n, int exclude) const{
+        std::lock_guard<std::mutex> lk(mtx_);
+        std::vector<PeerInfoRow> all;
+        all.reserve(peers_.size());
+        for (const auto& [id, row] : peers_) if (id != exclude) all.push_back(row);
+        if (all.size() > n) {
+            std::shuffle(all.begin(), all.end(), rng_);
+            all.resize(n);
+        }
+        return all;
+    }
+
+    std::optional<PeerInfoRow> PeerBook::find(int peerId) const{
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = peers_.find(peerId);
+        if (it == peers_.end()) return std::nullopt;
+        return it->second;
+    }
+
+    size_t PeerBook::size() const{
+        std::lock_guard<std::mutex> lk(mtx_);
+        return peers_.size();
+    }
+
+} // namespace p2p
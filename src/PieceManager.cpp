@@ -1,12 +1,22 @@
 #include "p2p/PieceManager.hpp"
+#include "p2p/AlignedBuffer.hpp"
+#include "p2p/ZeroScan.hpp"
+#include "p2p/Profile.hpp"
 
 #include <fstream>
 #include <stdexcept>
 #include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
 
-namespace p2p {
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-    std::shared_ptr<PieceManager> gPieceManager;
+namespace p2p {
 
 PieceManager::PieceManager(const std::string& filePath,
                            long long fileSizeBytes,
@@ -15,7 +25,8 @@ PieceManager::PieceManager(const std::string& filePath,
     : filePath_(filePath),
       fileSizeBytes_(fileSizeBytes),
       pieceSizeBytes_(pieceSizeBytes),
-      pieceCount_(0) {
+      pieceCount_(0),
+      dataPieces_(0) {
 
     if (fileSizeBytes_ < 0 || pieceSizeBytes_ <= 0) {
         throw std::invalid_argument("Invalid file or piece size");
@@ -23,6 +34,9 @@ PieceManager::PieceManager(const std::string& filePath,
 
     computePieceCount_();
     have_.assign(pieceCount_, false);
+    writing_.assign(pieceCount_, false);
+    requested_.assign(pieceCount_, 0);
+    zero_.reset(dataPieces_);
 
     if (hasCompleteFile) {
         // Seeder: assume the file on disk is correct and complete.
@@ -32,17 +46,46 @@ PieceManager::PieceManager(const std::string& filePath,
     }
 }
 
+PieceManager::~PieceManager() {
+#if !defined(_WIN32)
+    if (fd_ >= 0) ::close(fd_);
+    if (pfd_ >= 0) ::close(pfd_);
+    if (dfd_ >= 0) ::close(dfd_);
+#endif
+}
+
 void PieceManager::computePieceCount_() {
     // classic ceil(fileSize / pieceSize)
     pieceCount_ = static_cast<size_t>(
         (fileSizeBytes_ + pieceSizeBytes_ - 1) / pieceSizeBytes_
     );
+    dataPieces_ = pieceCount_;
+}
+
+void PieceManager::enableErasure(int stripe, int parity) {
+    if (stripe <= 0 || parity <= 0 || dataPieces_ == 0) return;
+    rs_ = std::make_unique<ReedSolomon>(stripe, parity);
+    stripe_ = static_cast<size_t>(stripe);
+    parity_ = static_cast<size_t>(parity);
+    parityPath_ = filePath_ + ".parity";
+
+    size_t stripes = (dataPieces_ + stripe_ - 1) / stripe_;
+    pieceCount_ = dataPieces_ + stripes * parity_;
+    // Parity starts missing even for a seed; prepareStorage() writes it.
+    have_.resize(pieceCount_, false);
+    writing_.resize(pieceCount_, false);
+    requested_.resize(pieceCount_, 0);
+    rebuilding_.assign(stripes, false);
 }
 
 std::pair<long long,long long> PieceManager::pieceOffsetAndSize_(size_t index) const {
     if (index >= pieceCount_) {
         throw std::out_of_range("Piece index out of range");
     }
+    if (index >= dataPieces_) {
+        // Parity pieces are all full size, back to back in the parity file.
+        return {static_cast<long long>(index - dataPieces_) * pieceSizeBytes_, pieceSizeBytes_};
+    }
     long long offset = static_cast<long long>(index) * pieceSizeBytes_;
     // Last piece may be smaller.
     long long maxBytes = fileSizeBytes_ - offset;
@@ -51,14 +94,79 @@ std::pair<long long,long long> PieceManager::pieceOffsetAndSize_(size_t index) c
 }
 
 bool PieceManager::havePiece(size_t index) const {
-    std::lock_guard<std::mutex> lk(mtx_);
+    std::lock_guard<ProfiledMutex> lk(mtx_);
     return index < have_.size() && have_[index];
 }
 
+size_t PieceManager::firstMissingIn(size_t begin, size_t end) const {
+    std::lock_guard<ProfiledMutex> lk(mtx_);
+    size_t stop = std::min(end, have_.size());
+    for (size_t i = begin; i < stop; ++i) {
+        if (have_[i] || writing_[i]) continue;
+        if (rs_ && stripeHeld_(stripeOf_(i), true, false) >= stripeData_(stripeOf_(i))) {
+            i = stripeRunEnd_(i) - 1; // the stripe will rebuild the rest
+            continue;
+        }
+        return i;
+    }
+    return end;
+}
+
+size_t PieceManager::firstUnrequestedIn(size_t begin, size_t end) const {
+    std::lock_guard<ProfiledMutex> lk(mtx_);
+    size_t stop = std::min(end, have_.size());
+    for (size_t i = begin; i < stop; ++i) {
+        if (have_[i] || writing_[i] || requested_[i] > 0) continue;
+        if (rs_ && stripeHeld_(stripeOf_(i), true, true) >= stripeData_(stripeOf_(i))) {
+            i = stripeRunEnd_(i) - 1;
+            continue;
+        }
+        return i;
+    }
+    return end;
+}
+
+void PieceManager::noteRequested(size_t index) {
+    std::lock_guard<ProfiledMutex> lk(mtx_);
+    if (index < requested_.size() && requested_[index] < UINT16_MAX) ++requested_[index];
+}
+
+void PieceManager::clearRequested(size_t index) {
+    std::lock_guard<ProfiledMutex> lk(mtx_);
+    if (index < requested_.size() && requested_[index] > 0) --requested_[index];
+}
+
+bool PieceManager::beginWrite(size_t index) {
+    std::lock_guard<ProfiledMutex> lk(mtx_);
+    if (index >= have_.size() || have_[index] || writing_[index]) return false;
+    writing_[index] = true;
+    return true;
+}
+
+void PieceManager::abortWrite(size_t index) {
+    std::lock_guard<ProfiledMutex> lk(mtx_);
+    if (index < writing_.size()) writing_[index] = false;
+}
+
+void PieceManager::setPriorityWindow(size_t begin, size_t end) {
+    // Readers may see a torn pair for a moment; that only skews one pick.
+    windowEnd_.store(std::min(end, pieceCount_));
+    windowBegin_.store(begin);
+}
+
+std::pair<size_t, size_t> PieceManager::priorityWindow() const {
+    return {windowBegin_.load(), windowEnd_.load()};
+}
+
+size_t PieceManager::haveCount() const {
+    std::lock_guard<ProfiledMutex> lk(mtx_);
+    return static_cast<size_t>(std::count(have_.begin(), have_.end(), true));
+}
+
 bool PieceManager::isComplete() const {
-    std::lock_guard<std::mutex> lk(mtx_);
-    for (bool h : have_) {
-        if (!h) {
+    std::lock_guard<ProfiledMutex> lk(mtx_);
+    for (size_t i = 0; i < dataPieces_; ++i) {
+        if (!have_[i]) {
             return false;
         }
     }
@@ -66,20 +174,30 @@ bool PieceManager::isComplete() const {
 }
 
 void PieceManager::markHave(size_t index) {
-    std::lock_guard<std::mutex> lk(mtx_);
+    std::lock_guard<ProfiledMutex> lk(mtx_);
     if (index >= have_.size()) {
         throw std::out_of_range("markHave index");
     }
     have_[index] = true;
 }
 
+#if defined(_WIN32)
+
+int PieceManager::openFile_(bool) const { return -1; }
+
+void PieceManager::prepareStorage(bool) {
+    if (rs_ && isComplete()) encodeParity_();
+}
+
 std::vector<uint8_t> PieceManager::readPiece(size_t index) const {
+    P2P_SCOPE("PieceManager::readPiece");
     auto [offset, size] = pieceOffsetAndSize_(index);
     std::vector<uint8_t> buf(size);
+    const std::string& path = index >= dataPieces_ ? parityPath_ : filePath_;
 
-    std::ifstream in(filePath_, std::ios::binary);
+    std::ifstream in(path, std::ios::binary);
     if (!in) {
-        throw std::runtime_error("Failed to open file for reading: " + filePath_);
+        throw std::runtime_error("Failed to open file for reading: " + path);
     }
     in.seekg(offset);
     in.read(reinterpret_cast<char*>(buf.data()), size);
@@ -89,47 +207,396 @@ std::vector<uint8_t> PieceManager::readPiece(size_t index) const {
     return buf;
 }
 
-bool PieceManager::writePiece(size_t index, const std::vector<uint8_t>& data) {
+void PieceManager::writeRaw_(size_t index, const uint8_t* data, size_t n) {
     auto [offset, expectedSize] = pieceOffsetAndSize_(index);
-    if (static_cast<long long>(data.size()) != expectedSize) {
-        // You could allow this and only write expectedSize, but mismatched
-        // sizes likely indicate a bug in REQUEST/PIECE logic.
-        throw std::runtime_error("Piece data size mismatch");
+    (void)expectedSize;
+    const std::string& path = index >= dataPieces_ ? parityPath_ : filePath_;
+
+    // Write to file
+    std::fstream out(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!out) {
+        // If file doesn't exist yet, create it with the right size.
+        out.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        out.close();
+        out.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    }
+    if (!out) {
+        throw std::runtime_error("Failed to open file for writing: " + path);
     }
 
-    {
-        // Write to file
-        std::fstream out(filePath_, std::ios::in | std::ios::out | std::ios::binary);
-        if (!out) {
-            // If file doesn't exist yet, create it with the right size.
-            out.open(filePath_, std::ios::out | std::ios::binary | std::ios::trunc);
-            out.close();
-            out.open(filePath_, std::ios::in | std::ios::out | std::ios::binary);
+    out.seekp(offset);
+    out.write(reinterpret_cast<const char*>(data), n);
+    if (!out) {
+        throw std::runtime_error("Failed to write piece to file");
+    }
+}
+
+size_t PieceManager::scanZeroPieces() {
+    CompactBitfield zeros(dataPieces_);
+    for (size_t i = 0; i < dataPieces_; ++i) {
+        auto bytes = readPiece(i);
+        if (allZero(bytes.data(), bytes.size())) zeros.set(i);
+    }
+    std::lock_guard<ProfiledMutex> lk(mtx_);
+    zero_ = zeros;
+    return zeros.count();
+}
+
+void PieceManager::zeroRaw_(size_t index) {
+    std::vector<uint8_t> zeros(static_cast<size_t>(pieceSize(index)), 0);
+    writeRaw_(index, zeros.data(), zeros.size());
+}
+
+#else
+
+// One descriptor for the life of the swarm; pread/pwrite don't share a file
+// position, so uploads and downloads can use it concurrently.
+int PieceManager::openFile_(bool parity) const {
+    std::lock_guard<std::mutex> lk(fdMtx_);
+    int& fd = parity ? pfd_ : fd_;
+    const std::string& path = parity ? parityPath_ : filePath_;
+    if (fd < 0) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open file: " + path + ": " + std::strerror(errno));
         }
-        if (!out) {
-            throw std::runtime_error("Failed to open file for writing: " + filePath_);
+    }
+    return fd;
+}
+
+static void preadAll(int fd, uint8_t* data, size_t n, off_t offset) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = ::pread(fd, data + got, n - got, offset + static_cast<off_t>(got));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            throw std::runtime_error("Failed to read piece from file");
+        }
+        got += static_cast<size_t>(r);
+    }
+}
+
+std::vector<uint8_t> PieceManager::readPiece(size_t index) const {
+    P2P_SCOPE("PieceManager::readPiece");
+    auto [offset, size] = pieceOffsetAndSize_(index);
+    std::vector<uint8_t> buf(size);
+    preadAll(openFile_(index >= dataPieces_), buf.data(), buf.size(), static_cast<off_t>(offset));
+    return buf;
+}
+
+static void pwriteAll(int fd, const uint8_t* data, size_t n, off_t offset) {
+    size_t put = 0;
+    while (put < n) {
+        ssize_t r = ::pwrite(fd, data + put, n - put, offset + static_cast<off_t>(put));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            throw std::runtime_error(std::string("Failed to write piece to file: ") + std::strerror(errno));
         }
+        put += static_cast<size_t>(r);
+    }
+}
+
+// Grow fd to `size` with real extents where the filesystem can.
+static void allocateFile(int fd, long long size, const std::string& path) {
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || st.st_size >= size) return;
+    int err = 0;
+#if defined(__linux__)
+    // Real extents, not a hole; fails fast if the disk is too small.
+    if (::fallocate(fd, 0, 0, size) != 0) err = errno;
+#else
+    err = EOPNOTSUPP;
+#endif
+    if (err == EOPNOTSUPP || err == ENOSYS) {
+        // Filesystem can't preallocate: at least set the size up front.
+        err = (::ftruncate(fd, size) == 0) ? 0 : errno;
+    }
+    if (err != 0) {
+        throw std::runtime_error("Failed to allocate " + path + ": " + std::strerror(err));
+    }
+}
+
+void PieceManager::prepareStorage(bool directIO) {
+    int fd = openFile_();
+
+    if (!isComplete()) {
+        allocateFile(fd, fileSizeBytes_, filePath_);
+    }
+    if (rs_ && isComplete()) {
+        encodeParity_();
+    } else if (rs_) {
+        long long parityBytes = static_cast<long long>(pieceCount_ - dataPieces_) * pieceSizeBytes_;
+        allocateFile(openFile_(true), parityBytes, parityPath_);
+    }
+
+#if defined(O_DIRECT)
+    if (directIO && dfd_ < 0) {
+        dfd_ = ::open(filePath_.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+        // EINVAL: the filesystem doesn't do O_DIRECT (tmpfs, ...); stay buffered.
+    }
+#else
+    (void)directIO;
+#endif
+}
 
-        out.seekp(offset);
-        out.write(reinterpret_cast<const char*>(data.data()), data.size());
-        if (!out) {
-            throw std::runtime_error("Failed to write piece to file");
+void PieceManager::writeRaw_(size_t index, const uint8_t* data, size_t n) {
+    auto [offset, expectedSize] = pieceOffsetAndSize_(index);
+    (void)expectedSize;
+    if (index >= dataPieces_) {
+        pwriteAll(openFile_(true), data, n, static_cast<off_t>(offset));
+        return;
+    }
+
+    // O_DIRECT only for fully aligned writes; a short last piece (or an
+    // unaligned caller buffer) goes through the page cache instead.
+    bool aligned = offset % static_cast<long long>(DIRECT_IO_ALIGN) == 0 &&
+                   n % DIRECT_IO_ALIGN == 0 &&
+                   reinterpret_cast<uintptr_t>(data) % DIRECT_IO_ALIGN == 0;
+    int fd = (dfd_ >= 0 && aligned) ? dfd_ : openFile_();
+    pwriteAll(fd, data, n, static_cast<off_t>(offset));
+}
+
+// Pieces inside a hole (SEEK_DATA skips past them) are zeros without reading;
+// sparse images are mostly that. The rest are read into one buffer and scanned.
+size_t PieceManager::scanZeroPieces() {
+    int fd = openFile_();
+    CompactBitfield zeros(dataPieces_);
+    std::vector<uint8_t> buf(static_cast<size_t>(pieceSizeBytes_));
+    long long dataAt = 0; // first byte at or after the last lookup that may hold data
+#if defined(SEEK_DATA)
+    bool holes = true;
+#else
+    bool holes = false;
+#endif
+    for (size_t i = 0; i < dataPieces_; ++i) {
+        auto [offset, size] = pieceOffsetAndSize_(i);
+#if defined(SEEK_DATA)
+        if (holes && dataAt < offset) {
+            off_t r = ::lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+            if (r >= 0) dataAt = r;
+            else if (errno == ENXIO) dataAt = fileSizeBytes_; // hole to the end
+            else holes = false;
+        }
+#endif
+        if (holes && dataAt >= offset + size) {
+            zeros.set(i);
+            continue;
         }
+        preadAll(fd, buf.data(), static_cast<size_t>(size), static_cast<off_t>(offset));
+        if (allZero(buf.data(), static_cast<size_t>(size))) zeros.set(i);
     }
+    std::lock_guard<ProfiledMutex> lk(mtx_);
+    zero_ = zeros;
+    return zeros.count();
+}
 
+void PieceManager::zeroRaw_(size_t index) {
+    auto [offset, size] = pieceOffsetAndSize_(index);
+    int fd = openFile_();
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+    // The file was preallocated; give this piece's blocks back.
+    if (::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size) == 0) return;
+#endif
+    // Can't punch holes here: write the zeros.
+    std::vector<uint8_t> zeros(static_cast<size_t>(size), 0);
+    pwriteAll(fd, zeros.data(), zeros.size(), static_cast<off_t>(offset));
+}
+
+#endif
+
+bool PieceManager::writePiece(size_t index, const uint8_t* data, size_t n) {
+    P2P_SCOPE("PieceManager::writePiece");
+    auto [offset, expectedSize] = pieceOffsetAndSize_(index);
+    (void)offset;
+    if (static_cast<long long>(n) != expectedSize) {
+        // Mismatched sizes likely indicate a bug in REQUEST/PIECE logic.
+        throw std::runtime_error("Piece data size mismatch");
+    }
+    writeRaw_(index, data, n);
+    return finishWrite_(index);
+}
+
+bool PieceManager::writePiece(size_t index, const std::vector<uint8_t>& data) {
+    return writePiece(index, data.data(), data.size());
+}
+
+// The piece is on disk: mark it, and rebuild its stripe if this write made it whole.
+bool PieceManager::finishWrite_(size_t index) {
     bool wasNew = false;
+    bool rebuild = false;
+    size_t s = 0;
     {
-        std::lock_guard<std::mutex> lk(mtx_);
+        std::lock_guard<ProfiledMutex> lk(mtx_);
+        writing_[index] = false;
         if (!have_[index]) {
             have_[index] = true;
             wasNew = true;
         }
+        if (rs_ && wasNew) {
+            s = stripeOf_(index);
+            size_t held = stripeHeld_(s, false, false);
+            if (held >= stripeData_(s) && held < stripeData_(s) + parity_ && !rebuilding_[s]) {
+                rebuilding_[s] = true;
+                rebuild = true;
+            }
+        }
     }
+    if (wasNew && onPieceDone_) onPieceDone_(index);
+    if (rebuild) rebuildStripe_(s);
     return wasNew;
 }
 
+size_t PieceManager::stripeOf_(size_t index) const {
+    return index < dataPieces_ ? index / stripe_ : (index - dataPieces_) / parity_;
+}
+
+size_t PieceManager::stripeData_(size_t s) const {
+    return std::min(stripe_, dataPieces_ - s * stripe_);
+}
+
+size_t PieceManager::stripeRunEnd_(size_t index) const {
+    size_t s = stripeOf_(index);
+    return index < dataPieces_ ? s * stripe_ + stripeData_(s) : dataPieces_ + (s + 1) * parity_;
+}
+
+size_t PieceManager::stripeHeld_(size_t s, bool writing, bool requested) const {
+    size_t held = 0;
+    auto count = [&](size_t i){
+        if (have_[i] || (writing && writing_[i]) || (requested && requested_[i] > 0)) ++held;
+    };
+    for (size_t i = s * stripe_, e = i + stripeData_(s); i < e; ++i) count(i);
+    for (size_t i = dataPieces_ + s * parity_, e = i + parity_; i < e; ++i) count(i);
+    return held;
+}
+
+// Read what the stripe has, decode the missing data, recompute the missing
+// parity (so we can serve it too) and write both. Pieces that arrive from the
+// network meanwhile are written twice with the same bytes; harmless.
+void PieceManager::rebuildStripe_(size_t s) {
+    const size_t d = stripeData_(s);
+    const size_t ps = static_cast<size_t>(pieceSizeBytes_);
+    std::vector<size_t> idx;
+    for (size_t i = 0; i < d; ++i) idx.push_back(s * stripe_ + i);
+    for (size_t j = 0; j < parity_; ++j) idx.push_back(dataPieces_ + s * parity_ + j);
+
+    std::vector<uint8_t> present(idx.size());
+    {
+        std::lock_guard<ProfiledMutex> lk(mtx_);
+        for (size_t i = 0; i < idx.size(); ++i) present[i] = have_[idx[i]];
+    }
+
+    // Short last piece: coded as if zero-padded to full size.
+    std::vector<std::vector<uint8_t>> blocks(idx.size(), std::vector<uint8_t>(ps, 0));
+    std::vector<uint8_t*> ptrs;
+    for (auto& b : blocks) ptrs.push_back(b.data());
+    std::vector<uint8_t*> missingParity(parity_, nullptr);
+    try {
+        for (size_t i = 0; i < idx.size(); ++i) {
+            if (present[i]) {
+                auto bytes = readPiece(idx[i]);
+                std::memcpy(ptrs[i], bytes.data(), bytes.size());
+            } else if (i >= d) {
+                missingParity[i - d] = ptrs[i];
+            }
+        }
+        if (!rs_->reconstruct(ptrs.data(), present.data(), static_cast<int>(d), ps)) {
+            throw std::runtime_error("Stripe " + std::to_string(s) + " can't be rebuilt");
+        }
+        rs_->encode(ptrs.data(), static_cast<int>(d), missingParity.data(), ps);
+        for (size_t i = 0; i < idx.size(); ++i) {
+            if (!present[i]) writeRaw_(idx[i], ptrs[i], static_cast<size_t>(pieceSize(idx[i])));
+        }
+    } catch (...) {
+        std::lock_guard<ProfiledMutex> lk(mtx_);
+        rebuilding_[s] = false;
+        throw;
+    }
+
+    std::vector<size_t> done;
+    {
+        std::lock_guard<ProfiledMutex> lk(mtx_);
+        for (size_t i = 0; i < idx.size(); ++i) {
+            if (present[i] || have_[idx[i]]) continue;
+            have_[idx[i]] = true;
+            done.push_back(idx[i]);
+            recovered_.push_back(idx[i]);
+        }
+        rebuilding_[s] = false;
+    }
+    if (onPieceDone_) {
+        for (size_t i : done) onPieceDone_(i);
+    }
+}
+
+// Seed: compute every parity piece, unless the parity file is already newer
+// than the file it was made from.
+void PieceManager::encodeParity_() {
+    namespace fs = std::filesystem;
+    std::error_code ec1, ec2;
+    long long parityBytes = static_cast<long long>(pieceCount_ - dataPieces_) * pieceSizeBytes_;
+    bool current = fs::file_size(parityPath_, ec1) == static_cast<uintmax_t>(parityBytes) &&
+                   fs::last_write_time(parityPath_, ec1) >= fs::last_write_time(filePath_, ec2) &&
+                   !ec1 && !ec2;
+
+    const size_t ps = static_cast<size_t>(pieceSizeBytes_);
+    std::vector<std::vector<uint8_t>> data(stripe_, std::vector<uint8_t>(ps)), parity(parity_, std::vector<uint8_t>(ps));
+    std::vector<const uint8_t*> dp;
+    std::vector<uint8_t*> pp;
+    for (auto& b : data) dp.push_back(b.data());
+    for (auto& b : parity) pp.push_back(b.data());
+
+    for (size_t s = 0; !current && s < rebuilding_.size(); ++s) {
+        size_t d = stripeData_(s);
+        for (size_t i = 0; i < d; ++i) {
+            auto bytes = readPiece(s * stripe_ + i);
+            std::memcpy(data[i].data(), bytes.data(), bytes.size());
+            std::memset(data[i].data() + bytes.size(), 0, ps - bytes.size());
+        }
+        rs_->encode(dp.data(), static_cast<int>(d), pp.data(), ps);
+        for (size_t j = 0; j < parity_; ++j) writeRaw_(dataPieces_ + s * parity_ + j, pp[j], ps);
+    }
+
+    std::lock_guard<ProfiledMutex> lk(mtx_);
+    for (size_t i = dataPieces_; i < pieceCount_; ++i) have_[i] = true;
+}
+
+CompactBitfield PieceManager::zeroPieces() const {
+    std::lock_guard<ProfiledMutex> lk(mtx_);
+    return zero_;
+}
+
+std::vector<size_t> PieceManager::markZero(const CompactBitfield& zeros) {
+    std::vector<size_t> fresh;
+    zeros.forEachRange([&](size_t b, size_t e){
+        e = std::min(e, dataPieces_);
+        for (size_t i = b; i < e; ++i) {
+            {
+                std::lock_guard<ProfiledMutex> lk(mtx_);
+                zero_.set(i);
+            }
+            if (!beginWrite(i)) continue;
+            try {
+                zeroRaw_(i);
+            } catch (...) {
+                abortWrite(i);
+                throw;
+            }
+            if (finishWrite_(i)) fresh.push_back(i);
+        }
+        return b < dataPieces_;
+    });
+    return fresh;
+}
+
+std::vector<size_t> PieceManager::takeRecovered() {
+    std::lock_guard<ProfiledMutex> lk(mtx_);
+    std::vector<size_t> out;
+    out.swap(recovered_);
+    return out;
+}
+
 std::vector<uint8_t> PieceManager::toBitfieldBytes() const {
-    std::lock_guard<std::mutex> lk(mtx_);
+    std::lock_guard<ProfiledMutex> lk(mtx_);
     size_t bytes = (pieceCount_ + 7) / 8;
     std::vector<uint8_t> bf(bytes, 0);
 
@@ -0,0 +1,269 @@
+#include "p2p/Profile.hpp"
+
+#if defined(P2P_PROFILE)
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <csignal>
+#include <sys/time.h>
+#endif
+
+namespace p2p {
+
+    // Samples a thread can take between collectProfileSamples() calls before
+    // the oldest are dropped (about 4 s of one busy thread at 1 kHz).
+    static constexpr size_t SAMPLE_RING = 4096;
+
+    struct ProfileNode {
+        const char* name = nullptr; // null: the thread's root
+        ProfileNode* parent = nullptr;
+        std::vector<ProfileNode*> children; // appended under ThreadProfile::mtx
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> totalNs{0};
+    };
+
+    struct ProfileSample {
+        ProfileNode* node;
+        int peer;
+    };
+
+    struct ThreadProfile {
+        std::mutex mtx; // the owner adding nodes vs. a report walking them
+        std::deque<ProfileNode> nodes; // stable addresses
+        ProfileNode root;
+        std::atomic<ProfileNode*> cur{&root};
+
+        // Written by the SIGPROF handler on this thread, read by the collector.
+        std::array<ProfileSample, SAMPLE_RING> ring{};
+        std::atomic<uint64_t> head{0};
+        uint64_t tail = 0; // collector only
+    };
+
+    // Plain pointers and lock-free atomics, so the signal handler can use them.
+    static thread_local ThreadProfile* tProfile = nullptr;
+    static thread_local std::atomic<int> tPeer{-1};
+
+    // Live threads' profiles. When a thread exits its tree is folded into
+    // retiredNs() and its pending samples into gSamples, and the profile
+    // (ring and nodes) is freed, so connection churn doesn't pile them up.
+    static std::mutex& threadsMtx(){ static std::mutex m; return m; }
+    static std::vector<ThreadProfile*>& threads(){ static std::vector<ThreadProfile*> v; return v; }
+    // Self time by path of threads that have exited (under threadsMtx()).
+    static std::map<std::string, int64_t>& retiredNs(){ static std::map<std::string, int64_t> m; return m; }
+
+    static void retire(ThreadProfile* t);
+
+    // Its destructor is the thread-exit hook.
+    struct ThreadOwner {
+        ThreadProfile* t = nullptr;
+        ~ThreadOwner(){ if (t) retire(t); }
+    };
+    static thread_local ThreadOwner tOwner;
+
+    static ThreadProfile& self(){
+        if (!tProfile) {
+            auto* t = new ThreadProfile();
+            {
+                std::lock_guard<std::mutex> lk(threadsMtx());
+                threads().push_back(t);
+            }
+            tOwner.t = t;
+            tProfile = t;
+        }
+        return *tProfile;
+    }
+
+    // Single writer, so no read-modify-write needed.
+    static void bump(std::atomic<uint64_t>& c, uint64_t by){
+        c.store(c.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    int64_t profileNowNs(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::atomic<int>& profilePeerSlot(){
+        self(); // so the sampler can see this thread
+        return tPeer;
+    }
+
+    void* profileEnter(const char* name){
+        ThreadProfile& t = self();
+        ProfileNode* parent = t.cur.load(std::memory_order_relaxed);
+        ProfileNode* child = nullptr;
+        for (ProfileNode* c : parent->children) {
+            if (c->name == name) { child = c; break; }
+        }
+        if (!child) {
+            std::lock_guard<std::mutex> lk(t.mtx);
+            child = &t.nodes.emplace_back();
+            child->name = name;
+            child->parent = parent;
+            parent->children.push_back(child);
+        }
+        t.cur.store(child, std::memory_order_relaxed);
+        return child;
+    }
+
+    void profileLeave(void* n, int64_t ns){
+        auto* node = static_cast<ProfileNode*>(n);
+        bump(node->calls, 1);
+        bump(node->totalNs, static_cast<uint64_t>(ns > 0 ? ns : 0));
+        tProfile->cur.store(node->parent, std::memory_order_relaxed);
+    }
+
+    static std::string pathOf(const ProfileNode* n){
+        std::vector<const char*> names;
+        for (; n && n->name; n = n->parent) names.push_back(n->name);
+        std::string out;
+        for (auto it = names.rbegin(); it != names.rend(); ++it) {
+            if (!out.empty()) out += ';';
+            out += *it;
+        }
+        return out;
+    }
+
+    // Self time = total minus what the children account for. A scope still
+    // open has no total yet, so its finished children can make that negative.
+    static void walk(const ProfileNode* n, const std::string& path, std::map<std::string, int64_t>& out){
+        int64_t self = static_cast<int64_t>(n->totalNs.load(std::memory_order_relaxed));
+        for (const ProfileNode* c : n->children) {
+            self -= static_cast<int64_t>(c->totalNs.load(std::memory_order_relaxed));
+            walk(c, path.empty() ? c->name : path + ";" + c->name, out);
+        }
+        if (n->name && self > 0) out[path] += self;
+    }
+
+    std::string profileCollapsed(){
+        std::lock_guard<std::mutex> lk(threadsMtx());
+        std::map<std::string, int64_t> byPath = retiredNs();
+        for (ThreadProfile* t : threads()) {
+            std::lock_guard<std::mutex> tl(t->mtx);
+            walk(&t->root, "", byPath);
+        }
+        std::string out;
+        for (const auto& [path, ns] : byPath) {
+            if (ns >= 1000) out += path + " " + std::to_string(ns / 1000) + "\n";
+        }
+        return out;
+    }
+
+    // ---- sampling ----
+
+    static std::atomic<uint64_t> gUntracked{0}; // samples on threads that never profiled anything
+    static std::mutex gSamplesMtx;
+    // (scope path, peer) -> samples; by path, since the nodes go away with their thread.
+    static std::map<std::pair<std::string, int>, uint64_t> gSamples;
+    static uint64_t gDropped = 0;
+
+#if !defined(_WIN32)
+    static void onSigprof(int){
+        int saved = errno;
+        ThreadProfile* t = tProfile;
+        if (!t) {
+            gUntracked.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            uint64_t h = t->head.load(std::memory_order_relaxed);
+            t->ring[h % SAMPLE_RING] = {t->cur.load(std::memory_order_relaxed), tPeer.load(std::memory_order_relaxed)};
+            t->head.store(h + 1, std::memory_order_release);
+        }
+        errno = saved;
+    }
+
+    bool startProfileSampling(int hz){
+        if (hz <= 0) return false;
+        struct sigaction sa{};
+        sa.sa_handler = onSigprof;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (::sigaction(SIGPROF, &sa, nullptr) != 0) return false;
+        itimerval it{};
+        it.it_interval.tv_sec = 0;
+        it.it_interval.tv_usec = std::max(1, 1000000 / hz);
+        it.it_value = it.it_interval;
+        return ::setitimer(ITIMER_PROF, &it, nullptr) == 0;
+    }
+#else
+    bool startProfileSampling(int){ return false; }
+#endif
+
+    // Caller holds gSamplesMtx, then threadsMtx().
+    static void collectFrom(ThreadProfile& t){
+        std::map<const ProfileNode*, std::string> paths; // nodes seen in this batch
+        uint64_t h = t.head.load(std::memory_order_acquire);
+        if (h - t.tail > SAMPLE_RING) {
+            gDropped += h - t.tail - SAMPLE_RING;
+            t.tail = h - SAMPLE_RING;
+        }
+        for (; t.tail < h; ++t.tail) {
+            ProfileSample s = t.ring[t.tail % SAMPLE_RING];
+            // Lapped while we read it: the slot may be half new.
+            if (t.head.load(std::memory_order_acquire) - t.tail >= SAMPLE_RING) { ++gDropped; continue; }
+            auto it = paths.find(s.node);
+            if (it == paths.end()) it = paths.emplace(s.node, pathOf(s.node)).first;
+            ++gSamples[{it->second, s.peer}];
+        }
+    }
+
+    void collectProfileSamples(){
+        std::lock_guard<std::mutex> lk(gSamplesMtx);
+        std::lock_guard<std::mutex> tl(threadsMtx());
+        for (ThreadProfile* t : threads()) collectFrom(*t);
+    }
+
+    // On the exiting thread. Off tProfile first, so a SIGPROF from here on
+    // counts as untracked instead of writing into what we're about to free.
+    static void retire(ThreadProfile* t){
+        tProfile = nullptr;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        std::lock_guard<std::mutex> lk(gSamplesMtx);
+        std::lock_guard<std::mutex> tl(threadsMtx());
+        collectFrom(*t);
+        walk(&t->root, "", retiredNs());
+        auto& v = threads();
+        v.erase(std::remove(v.begin(), v.end(), t), v.end());
+        delete t;
+    }
+
+    std::string profileSamples(){
+        collectProfileSamples();
+        std::map<std::string, uint64_t> byPath;
+        {
+            std::lock_guard<std::mutex> lk(gSamplesMtx);
+            for (const auto& [key, n] : gSamples) {
+                std::string path = key.second >= 0 ? "peer " + std::to_string(key.second) : "no peer";
+                const std::string& frames = key.first;
+                byPath[path + ";" + (frames.empty() ? "(outside scopes)" : frames)] += n;
+            }
+            if (uint64_t u = gUntracked.load()) byPath["no peer;(untracked thread)"] += u;
+            if (gDropped) byPath["(dropped)"] += gDropped;
+        }
+        std::string out;
+        for (const auto& [path, n] : byPath) out += path + " " + std::to_string(n) + "\n";
+        return out;
+    }
+
+} // namespace p2p
+
+#else
+
+namespace p2p {
+
+    std::string profileCollapsed(){ return ""; }
+    bool startProfileSampling(int){ return false; }
+    void collectProfileSamples(){}
+    std::string profileSamples(){ return ""; }
+
+} // namespace p2p
+
+#endif
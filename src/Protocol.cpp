@@ -1,5 +1,8 @@
 #include "p2p/Protocol.hpp"
+#include "p2p/Profile.hpp"
 
+#include <algorithm>
+#include <cstddef>
 #include <cstring>
 
 namespace p2p {
@@ -8,10 +11,18 @@ namespace p2p {
             'P','2','P','F','I','L','E','S','H','A','R','I','N','G','P','R','O','J'
     };
 
-    std::array<uint8_t, Handshake::LEN> Handshake::encode(int peerId){
+    std::array<uint8_t, Handshake::LEN> Handshake::encode(int peerId, uint32_t caps, uint32_t swarmId){
         std::array<uint8_t, LEN> out{};
         std::memcpy(out.data(), HEADER.data(), HEADER.size());
-        // bytes 18..27 are zeros by default (value-initialized)
+        // bytes 18..21 = capability bits, 22..23 stay zero (value-initialized)
+        for (size_t i = 0; i < CAPS_LEN; ++i) {
+            out[CAPS_OFF + i] = static_cast<uint8_t>((caps >> (8 * i)) & 0xFF);
+        }
+        // swarm id at 24..27 big-endian
+        out[SWARM_OFF]     = static_cast<uint8_t>((swarmId >> 24) & 0xFF);
+        out[SWARM_OFF + 1] = static_cast<uint8_t>((swarmId >> 16) & 0xFF);
+        out[SWARM_OFF + 2] = static_cast<uint8_t>((swarmId >> 8) & 0xFF);
+        out[SWARM_OFF + 3] = static_cast<uint8_t>((swarmId) & 0xFF);
         // peerId at 28..31 big-endian
         out[28] = static_cast<uint8_t>((peerId >> 24) & 0xFF);
         out[29] = static_cast<uint8_t>((peerId >> 16) & 0xFF);
@@ -28,6 +39,28 @@ namespace p2p {
         return id;
     }
 
+    uint32_t Handshake::decodeCaps(const std::array<uint8_t, LEN>& msg){
+        uint32_t caps = 0;
+        for (size_t i = 0; i < CAPS_LEN; ++i) {
+            caps |= uint32_t(msg[CAPS_OFF + i]) << (8 * i);
+        }
+        return caps;
+    }
+
+    uint32_t Handshake::decodeSwarmId(const std::array<uint8_t, LEN>& msg){
+        return (uint32_t(msg[SWARM_OFF]) << 24) | (uint32_t(msg[SWARM_OFF + 1]) << 16) |
+               (uint32_t(msg[SWARM_OFF + 2]) << 8) | uint32_t(msg[SWARM_OFF + 3]);
+    }
+
+    const char* messageTypeName(uint8_t type){
+        static const char* const names[] = {
+            "CHOKE", "UNCHOKE", "INTERESTED", "NOT_INTERESTED", "HAVE", "BITFIELD", "REQUEST", "PIECE",
+            "HAVE_ALL", "HAVE_NONE", "BITFIELD_RUNS", "PEX", "LOCAL_OFFER", "TRANSPORT_SWITCH", "UDP_OFFER",
+            "MANIFEST_REQUEST", "MANIFEST", "ZERO_PIECES"
+        };
+        return type < sizeof(names) / sizeof(names[0]) ? names[type] : "UNKNOWN";
+    }
+
     Message Message::make(MessageType t, std::vector<uint8_t> payload){
         Message m; m.type = t; m.payload = std::move(payload); m.length = static_cast<uint32_t>(1 + m.payload.size()); return m;
     }
@@ -36,6 +69,7 @@ namespace p2p {
     static uint32_t get32(const uint8_t* p){ return (uint32_t(p[0])<<24)|(uint32_t(p[1])<<16)|(uint32_t(p[2])<<8)|uint32_t(p[3]); }
 
     std::vector<uint8_t> Message::serialize(const Message& m){
+        P2P_SCOPE("Message::serialize");
         std::vector<uint8_t> b; b.reserve(4 + m.length);
         put32(b, m.length);
         b.push_back(static_cast<uint8_t>(m.type));
@@ -52,6 +86,39 @@ namespace p2p {
         return m;
     }
 
+    std::vector<PexEntry> decodePex(const uint8_t* data, size_t n, size_t maxEntries){
+        std::vector<PexEntry> out;
+        size_t off = 0;
+        while (off < n && out.size() < maxEntries) {
+            if (n - off < 7) throw std::runtime_error("Truncated PEX entry");
+            PexEntry e;
+            e.peerId = static_cast<int>(get32(data + off));
+            e.port = static_cast<uint16_t>((data[off + 4] << 8) | data[off + 5]);
+            size_t hostLen = data[off + 6];
+            off += 7;
+            if (n - off < hostLen) throw std::runtime_error("Truncated PEX host");
+            e.host.assign(reinterpret_cast<const char*>(data + off), hostLen);
+            off += hostLen;
+            out.push_back(std::move(e));
+        }
+        return out;
+    }
+
+    LocalOffer decodeLocalOffer(const uint8_t* data, size_t n){
+        LocalOffer o;
+        if (n < 9) throw std::runtime_error("Truncated LOCAL_OFFER");
+        for (int i = 0; i < 8; ++i) o.nonce = (o.nonce << 8) | data[i];
+        size_t off = 8;
+        for (std::string* s : {&o.hostId, &o.address}) {
+            if (off >= n) throw std::runtime_error("Truncated LOCAL_OFFER");
+            size_t len = data[off++];
+            if (n - off < len) throw std::runtime_error("Truncated LOCAL_OFFER");
+            s->assign(reinterpret_cast<const char*>(data + off), len);
+            off += len;
+        }
+        return o;
+    }
+
     namespace msg {
 
         // ---- Control messages: no payload ----
@@ -85,6 +152,66 @@ namespace p2p {
             return Message::make(MessageType::BITFIELD, bits);
         }
 
+        Message bitfieldRuns(const std::vector<uint8_t>& runs){
+            return Message::make(MessageType::BITFIELD_RUNS, runs);
+        }
+
+        Message haveAll() {
+            return Message::make(MessageType::HAVE_ALL);
+        }
+
+        Message haveNone() {
+            return Message::make(MessageType::HAVE_NONE);
+        }
+
+        Message pex(const std::vector<PexEntry>& entries){
+            std::vector<uint8_t> p;
+            for (const auto& e : entries) {
+                if (e.host.size() > 255) continue; // can't be encoded; not a real host anyway
+                put32(p, static_cast<uint32_t>(e.peerId));
+                p.push_back(static_cast<uint8_t>(e.port >> 8));
+                p.push_back(static_cast<uint8_t>(e.port & 0xFF));
+                p.push_back(static_cast<uint8_t>(e.host.size()));
+                p.insert(p.end(), e.host.begin(), e.host.end());
+            }
+            return Message::make(MessageType::PEX, std::move(p));
+        }
+
+        Message localOffer(const LocalOffer& offer){
+            std::vector<uint8_t> p;
+            for (int i = 7; i >= 0; --i) p.push_back(static_cast<uint8_t>(offer.nonce >> (8 * i)));
+            for (const std::string* s : {&offer.hostId, &offer.address}) {
+                size_t len = std::min<size_t>(s->size(), 255);
+                p.push_back(static_cast<uint8_t>(len));
+                p.insert(p.end(), s->begin(), s->begin() + static_cast<std::ptrdiff_t>(len));
+            }
+            return Message::make(MessageType::LOCAL_OFFER, std::move(p));
+        }
+
+        Message transportSwitch(){
+            return Message::make(MessageType::TRANSPORT_SWITCH);
+        }
+
+        Message udpOffer(uint32_t connId, uint16_t port){
+            std::vector<uint8_t> p;
+            put32(p, connId);
+            p.push_back(static_cast<uint8_t>(port >> 8));
+            p.push_back(static_cast<uint8_t>(port & 0xFF));
+            return Message::make(MessageType::UDP_OFFER, std::move(p));
+        }
+
+        Message manifestRequest(){
+            return Message::make(MessageType::MANIFEST_REQUEST);
+        }
+
+        Message manifest(std::vector<uint8_t> payload){
+            return Message::make(MessageType::MANIFEST, std::move(payload));
+        }
+
+        Message zeroPieces(const std::vector<uint8_t>& runs){
+            return Message::make(MessageType::ZERO_PIECES, runs);
+        }
+
         Message request(uint32_t pieceIndex){
             std::vector<uint8_t> p;
             p.reserve(4);
@@ -100,6 +227,15 @@ namespace p2p {
             return Message::make(MessageType::PIECE, std::move(p));
         }
 
+        Message piece(uint32_t pieceIndex, PieceCodec codec, const std::vector<uint8_t>& data){
+            std::vector<uint8_t> p;
+            p.reserve(4 + 1 + data.size());
+            put32(p, pieceIndex);
+            p.push_back(static_cast<uint8_t>(codec));
+            p.insert(p.end(), data.begin(), data.end());
+            return Message::make(MessageType::PIECE, std::move(p));
+        }
+
     } // namespace msg
 
 
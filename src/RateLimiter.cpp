@@ -0,0 +1,33 @@
+#include "p2p/RateLimiter.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace p2p {
+
+    RateLimiter gUploadBudget;
+
+    void RateLimiter::setRate(long long bytesPerSec, double burstSec){
+        std::lock_guard<std::mutex> lk(mtx_);
+        rate_ = bytesPerSec;
+        burst_ = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(burstSec));
+        next_ = clock::now();
+    }
+
+    void RateLimiter::acquire(size_t n){
+        clock::time_point start;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (rate_ <= 0) return;
+
+            // Reserve a slot: idle time beyond the burst allowance is forfeited.
+            auto now = clock::now();
+            start = std::max(next_, now - burst_);
+            auto cost = std::chrono::duration_cast<clock::duration>(
+                std::chrono::duration<double>(double(n) / double(rate_)));
+            next_ = start + cost;
+        }
+        std::this_thread::sleep_until(start);
+    }
+
+} // namespace p2p
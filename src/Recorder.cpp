@@ -0,0 +1,201 @@
+#include "p2p/Recorder.hpp"
+#include "p2p/Protocol.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace p2p {
+
+    Recorder gRecorder;
+
+    static constexpr char MAGIC[8] = {'P', '2', 'P', 'R', 'E', 'C', '1', '\n'};
+
+    // Records pile up here and go to disk in big writes (and on flush()).
+    static constexpr size_t FLUSH_AT = 256u << 10;
+
+    static void putVarint(std::vector<uint8_t>& out, uint64_t v){
+        while (v >= 0x80) {
+            out.push_back(static_cast<uint8_t>(v) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(v));
+    }
+
+    Recorder::~Recorder(){ close(); }
+
+    void Recorder::open(const std::string& path, int selfId, bool piecePayloads,
+                        const std::vector<SwarmInfo>& swarms){
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (f_) return;
+        f_ = std::fopen(path.c_str(), "wb");
+        if (!f_) throw std::runtime_error("Cannot open recording file " + path);
+        payloads_ = piecePayloads;
+        last_ = std::chrono::steady_clock::now();
+
+        buf_.assign(MAGIC, MAGIC + sizeof(MAGIC));
+        putVarint(buf_, payloads_ ? FLAG_PAYLOADS : 0);
+        putVarint(buf_, static_cast<uint64_t>(selfId));
+        putVarint(buf_, swarms.size());
+        for (const auto& s : swarms) {
+            putVarint(buf_, s.id);
+            putVarint(buf_, static_cast<uint64_t>(s.fileSize));
+            putVarint(buf_, static_cast<uint64_t>(s.pieceSize));
+        }
+        flush_();
+    }
+
+    void Recorder::close(){
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (!f_) return;
+        flush_();
+        std::fclose(f_);
+        f_ = nullptr;
+    }
+
+    void Recorder::flush(){
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (f_) flush_();
+    }
+
+    uint64_t Recorder::dtUs_(){
+        auto now = std::chrono::steady_clock::now();
+        auto dt = std::chrono::duration_cast<std::chrono::microseconds>(now - last_).count();
+        if (dt <= 0) return 0;
+        // Keep the remainder so rounding doesn't drift over a long recording.
+        last_ += std::chrono::microseconds(dt);
+        return static_cast<uint64_t>(dt);
+    }
+
+    void Recorder::flush_(){
+        if (!buf_.empty()) std::fwrite(buf_.data(), 1, buf_.size(), f_);
+        buf_.clear();
+        std::fflush(f_);
+    }
+
+    uint32_t Recorder::onOpen(int remotePeer, uint32_t swarm, bool incoming, uint32_t caps){
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (!f_) return 0;
+        uint32_t id = nextConn_++;
+        buf_.push_back(OPEN);
+        putVarint(buf_, id);
+        putVarint(buf_, dtUs_());
+        putVarint(buf_, static_cast<uint64_t>(remotePeer));
+        putVarint(buf_, swarm);
+        buf_.push_back(incoming ? 1 : 0);
+        putVarint(buf_, caps);
+        return id;
+    }
+
+    void Recorder::onMessage(uint32_t conn, Dir dir, uint8_t type, uint32_t len,
+                             const uint8_t* a, size_t an, const uint8_t* b, size_t bn){
+        if (!conn) return;
+        // Index of HAVE / REQUEST / PIECE: first 4 bytes of the body.
+        uint64_t index = 0;
+        auto t = static_cast<MessageType>(type);
+        bool indexed = t == MessageType::HAVE || t == MessageType::REQUEST || t == MessageType::PIECE;
+        if (indexed && an >= 4) {
+            index = ((uint64_t(a[0]) << 24) | (uint64_t(a[1]) << 16) | (uint64_t(a[2]) << 8) | a[3]) + 1;
+        }
+
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (!f_) return;
+        buf_.push_back(MSG);
+        putVarint(buf_, conn);
+        putVarint(buf_, dtUs_());
+        buf_.push_back(dir);
+        buf_.push_back(type);
+        putVarint(buf_, len);
+        putVarint(buf_, index);
+        putVarint(buf_, an + bn);
+        if (an) buf_.insert(buf_.end(), a, a + an);
+        if (bn) buf_.insert(buf_.end(), b, b + bn);
+        if (buf_.size() >= FLUSH_AT) flush_();
+    }
+
+    void Recorder::onClose(uint32_t conn){
+        if (!conn) return;
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (!f_) return;
+        buf_.push_back(CLOSE);
+        putVarint(buf_, conn);
+        putVarint(buf_, dtUs_());
+        flush_(); // a crash right after still leaves a usable file
+    }
+
+    RecordReader::RecordReader(const std::string& path){
+        f_ = std::fopen(path.c_str(), "rb");
+        if (!f_) throw std::runtime_error("Cannot open recording " + path);
+        char magic[sizeof(MAGIC)];
+        if (std::fread(magic, 1, sizeof(magic), f_) != sizeof(magic) ||
+            std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+            std::fclose(f_);
+            throw std::runtime_error(path + " is not a recording");
+        }
+        flags_ = static_cast<uint32_t>(varint_());
+        selfId_ = static_cast<int>(varint_());
+        uint64_t n = varint_();
+        for (uint64_t i = 0; i < n; ++i) {
+            Recorder::SwarmInfo s{};
+            s.id = static_cast<uint32_t>(varint_());
+            s.fileSize = static_cast<long long>(varint_());
+            s.pieceSize = static_cast<int>(varint_());
+            swarms_.push_back(s);
+        }
+    }
+
+    RecordReader::~RecordReader(){ if (f_) std::fclose(f_); }
+
+    uint8_t RecordReader::byte_(){
+        int c = std::fgetc(f_);
+        if (c == EOF) throw std::runtime_error("Truncated recording");
+        return static_cast<uint8_t>(c);
+    }
+
+    uint64_t RecordReader::varint_(){
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = byte_();
+            v |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        throw std::runtime_error("Bad varint in recording");
+    }
+
+    bool RecordReader::next(Record& r){
+        int c = std::fgetc(f_);
+        if (c == EOF) return false;
+
+        r = Record{};
+        r.kind = static_cast<Recorder::Kind>(c);
+        r.conn = static_cast<uint32_t>(varint_());
+        t_ += varint_();
+        r.tUs = t_;
+        switch (r.kind) {
+            case Recorder::OPEN:
+                r.remotePeer = static_cast<int>(varint_());
+                r.swarm = static_cast<uint32_t>(varint_());
+                r.incoming = byte_() != 0;
+                r.caps = static_cast<uint32_t>(varint_());
+                break;
+            case Recorder::MSG: {
+                r.dir = static_cast<Recorder::Dir>(byte_());
+                r.type = byte_();
+                r.len = static_cast<uint32_t>(varint_());
+                r.index = static_cast<int64_t>(varint_()) - 1;
+                uint64_t n = varint_();
+                if (n > r.len) throw std::runtime_error("Bad payload length in recording");
+                r.payload.resize(n);
+                if (n && std::fread(r.payload.data(), 1, n, f_) != n) {
+                    throw std::runtime_error("Truncated recording");
+                }
+                break;
+            }
+            case Recorder::CLOSE:
+                break;
+            default:
+                throw std::runtime_error("Unknown record kind in recording");
+        }
+        return true;
+    }
+
+} // namespace p2p
@@ -1 +1,253 @@
-//#include "p2p/Scheduler.hpp"
\ No newline at end of file
+#include "p2p/Scheduler.hpp"
+
+#include <algorithm>
+
+namespace p2p {
+
+    TimerWheel gTimers;
+
+    TimerWheel::TimerWheel(clock::duration tick)
+    : tick_(tick > clock::duration::zero() ? tick : std::chrono::milliseconds(1)),
+      origin_(clock::now()),
+      heads_(LEVELS * SLOTS + 1, -1) {}
+
+    TimerWheel::~TimerWheel(){ stop(); }
+
+    void TimerWheel::start(){
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (running_) return;
+        running_ = true;
+        stop_ = false;
+        thr_ = std::thread(&TimerWheel::run_, this);
+    }
+
+    void TimerWheel::stop(){
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (!running_) return;
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thr_.joinable()) thr_.join();
+        std::lock_guard<std::mutex> lk(mtx_);
+        running_ = false;
+    }
+
+    TimerWheel::TimerId TimerWheel::at(clock::time_point due, Fn fn){
+        return add_(due, clock::duration::zero(), std::move(fn));
+    }
+
+    TimerWheel::TimerId TimerWheel::after(clock::duration delay, Fn fn){
+        return add_(clock::now() + delay, clock::duration::zero(), std::move(fn));
+    }
+
+    TimerWheel::TimerId TimerWheel::every(clock::duration period, Fn fn){
+        return every(period, std::move(fn), period);
+    }
+
+    TimerWheel::TimerId TimerWheel::every(clock::duration period, Fn fn, clock::duration firstDelay){
+        if (period <= clock::duration::zero()) period = tick_;
+        return add_(clock::now() + firstDelay, period, std::move(fn));
+    }
+
+    TimerWheel::TimerId TimerWheel::add_(clock::time_point due, clock::duration period, Fn fn){
+        std::lock_guard<std::mutex> lk(mtx_);
+        int32_t i;
+        if (freeHead_ >= 0) {
+            i = freeHead_;
+            freeHead_ = nodes_[i].next;
+        } else {
+            i = static_cast<int32_t>(nodes_.size());
+            nodes_.emplace_back();
+        }
+        // Nothing pending: skip the idle stretch instead of ticking through it.
+        if (count_ == 0) cur_ = std::max(cur_, tickOf_(clock::now()));
+
+        Node& n = nodes_[i];
+        n.due = due;
+        n.period = period;
+        n.fn = std::move(fn);
+        n.state = QUEUED;
+        n.cancelled = false;
+        n.tick = tickOf_(due);
+        place_(i);
+        ++count_;
+
+        TimerId id = (TimerId(n.gen) << 32) | TimerId(uint32_t(i) + 1);
+        if (due < wakeAt_) cv_.notify_one();
+        return id;
+    }
+
+    bool TimerWheel::cancel(TimerId id){
+        int32_t i = static_cast<int32_t>(uint32_t(id & 0xffffffffu)) - 1;
+        uint32_t gen = static_cast<uint32_t>(id >> 32);
+
+        std::unique_lock<std::mutex> lk(mtx_);
+        if (i < 0 || size_t(i) >= nodes_.size() || nodes_[i].gen != gen) return false;
+        Node& n = nodes_[i];
+        if (n.state == QUEUED) {
+            unlink_(i);
+            free_(i);
+            return true;
+        }
+        if (n.state == FIRING && !n.cancelled) {
+            n.cancelled = true;
+            // The callback cancelling itself (or another timer's callback doing it
+            // from the timer thread) can't wait for itself.
+            if (std::this_thread::get_id() != thr_.get_id()) {
+                doneCv_.wait(lk, [&]{ return firing_ != i; });
+            }
+            return true;
+        }
+        return false;
+    }
+
+    size_t TimerWheel::size() const {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return count_;
+    }
+
+    uint64_t TimerWheel::tickOf_(clock::time_point t) const {
+        if (t <= origin_) return 0;
+        return static_cast<uint64_t>((t - origin_) / tick_);
+    }
+
+    void TimerWheel::place_(int32_t i){
+        uint64_t d = nodes_[i].tick;
+        if (d <= cur_) { link_(i, NEAR_LIST); return; }
+
+        uint64_t delta = d - cur_;
+        for (size_t level = 0; level < LEVELS; ++level) {
+            if (delta < (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+                link_(i, level * SLOTS + ((d >> (SLOT_BITS * level)) & (SLOTS - 1)));
+                return;
+            }
+        }
+        // Past the end of the wheel: park it as far out as we can and re-place
+        // it when that slot cascades.
+        uint64_t far = cur_ + (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+        link_(i, (LEVELS - 1) * SLOTS + ((far >> (SLOT_BITS * (LEVELS - 1))) & (SLOTS - 1)));
+    }
+
+    void TimerWheel::link_(int32_t i, size_t list){
+        Node& n = nodes_[i];
+        n.list = static_cast<int32_t>(list);
+        n.prev = -1;
+        n.next = heads_[list];
+        if (n.next >= 0) nodes_[n.next].prev = i;
+        heads_[list] = i;
+    }
+
+    void TimerWheel::unlink_(int32_t i){
+        Node& n = nodes_[i];
+        if (n.prev >= 0) nodes_[n.prev].next = n.next;
+        else heads_[n.list] = n.next;
+        if (n.next >= 0) nodes_[n.next].prev = n.prev;
+        n.prev = n.next = n.list = -1;
+    }
+
+    void TimerWheel::free_(int32_t i){
+        Node& n = nodes_[i];
+        n.fn = nullptr;
+        n.state = FREE;
+        n.cancelled = false;
+        ++n.gen;
+        if (n.gen == 0) n.gen = 1; // keep ids nonzero
+        n.next = freeHead_;
+        freeHead_ = i;
+        --count_;
+    }
+
+    void TimerWheel::cascade_(size_t level){
+        size_t list = level * SLOTS + ((cur_ >> (SLOT_BITS * level)) & (SLOTS - 1));
+        int32_t i = heads_[list];
+        heads_[list] = -1;
+        while (i >= 0) {
+            int32_t next = nodes_[i].next;
+            place_(i);
+            i = next;
+        }
+    }
+
+    void TimerWheel::advance_(){
+        ++cur_;
+        // Whenever a level wraps, pull the next slot of the level above down.
+        for (size_t level = 1; level < LEVELS; ++level) {
+            if ((cur_ >> (SLOT_BITS * (level - 1))) & (SLOTS - 1)) break;
+            cascade_(level);
+        }
+        // This tick's timers wait on the near list for their exact deadline.
+        size_t list = cur_ & (SLOTS - 1);
+        int32_t i = heads_[list];
+        heads_[list] = -1;
+        while (i >= 0) {
+            int32_t next = nodes_[i].next;
+            link_(i, NEAR_LIST);
+            i = next;
+        }
+    }
+
+    TimerWheel::clock::time_point TimerWheel::nextWake_() const {
+        if (count_ == 0) return clock::time_point::max();
+
+        clock::time_point wake = clock::time_point::max();
+        for (int32_t i = heads_[NEAR_LIST]; i >= 0; i = nodes_[i].next) {
+            if (nodes_[i].due < wake) wake = nodes_[i].due;
+        }
+        // Next non-empty level-0 slot before the wrap, or the wrap itself so the
+        // level above can cascade.
+        uint64_t t = cur_ + 1;
+        for (; (t & (SLOTS - 1)) != 0; ++t) {
+            if (heads_[t & (SLOTS - 1)] >= 0) break;
+        }
+        auto tickAt = origin_ + tick_ * static_cast<int64_t>(t);
+        return std::min(wake, tickAt);
+    }
+
+    void TimerWheel::run_(){
+        std::unique_lock<std::mutex> lk(mtx_);
+        while (!stop_) {
+            auto now = clock::now();
+            uint64_t target = tickOf_(now);
+            while (cur_ < target) advance_();
+
+            due_.clear();
+            for (int32_t i = heads_[NEAR_LIST]; i >= 0; i = nodes_[i].next) {
+                if (nodes_[i].due <= now) due_.push_back(i);
+            }
+            for (int32_t i : due_) {
+                Node& n = nodes_[i];
+                if (n.state != QUEUED || n.list != int32_t(NEAR_LIST) || n.due > now) continue; // cancelled by an earlier callback
+                unlink_(i);
+                n.state = FIRING;
+                firing_ = i;
+                Fn fn = std::move(n.fn); // nodes_ may grow while we're unlocked
+
+                lk.unlock();
+                try { fn(); } catch (...) {}
+                lk.lock();
+
+                Node& m = nodes_[i];
+                firing_ = -1;
+                if (m.period > clock::duration::zero() && !m.cancelled) {
+                    m.fn = std::move(fn);
+                    m.due += m.period;
+                    auto after = clock::now();
+                    if (m.due <= after) m.due = after + m.period;
+                    m.tick = tickOf_(m.due);
+                    m.state = QUEUED;
+                    place_(i);
+                } else {
+                    free_(i);
+                }
+                doneCv_.notify_all();
+            }
+
+            wakeAt_ = nextWake_();
+            if (wakeAt_ == clock::time_point::max()) cv_.wait(lk);
+            else cv_.wait_until(lk, wakeAt_);
+            wakeAt_ = clock::time_point::min(); // adds while we're busy don't need to wake us
+        }
+    }
+
+} // namespace p2p
@@ -0,0 +1,89 @@
+#include "p2p/StreamSink.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace p2p {
+
+    StreamSink::StreamSink(Logger& logger, std::shared_ptr<PieceManager> pm, Consumer out, size_t window)
+    : logger_(logger),
+      pm_(std::move(pm)),
+      out_(std::move(out)),
+      window_(std::max<size_t>(1, window)) {}
+
+    StreamSink::~StreamSink(){ stop(); }
+
+    StreamSink::Consumer StreamSink::toPath(const std::string& path){
+        // Opened lazily on the sink thread, so a FIFO without a reader yet
+        // doesn't hold up startup.
+        struct Out {
+            std::FILE* f = nullptr;
+            bool own = false;
+            ~Out(){ if (own && f) std::fclose(f); }
+        };
+        auto o = std::make_shared<Out>();
+        return [path, o](const uint8_t* data, size_t n){
+            if (!o->f) {
+                if (path == "-") {
+                    o->f = stdout;
+                } else {
+                    o->f = std::fopen(path.c_str(), "wb");
+                    o->own = true;
+                }
+                if (!o->f) return false;
+            }
+            // Flush every piece: the point is to get bytes out as they arrive.
+            return std::fwrite(data, 1, n, o->f) == n && std::fflush(o->f) == 0;
+        };
+    }
+
+    void StreamSink::start(){
+        // Woken by every newly written piece; cheap when it isn't the one we wait for.
+        pm_->setOnPieceDone([this](size_t){
+            std::lock_guard<std::mutex> lk(mtx_);
+            cv_.notify_all();
+        });
+        thr_ = std::thread(&StreamSink::run_, this);
+    }
+
+    void StreamSink::stop(){
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thr_.joinable()) thr_.join();
+    }
+
+    void StreamSink::run_(){
+        size_t total = pm_->dataPieceCount();
+        size_t cur = cursor_.load();
+
+        while (cur < total) {
+            pm_->setPriorityWindow(cur, std::min(total, cur + window_));
+            {
+                std::unique_lock<std::mutex> lk(mtx_);
+                cv_.wait(lk, [&]{ return stop_ || pm_->havePiece(cur); });
+                if (stop_) return;
+            }
+
+            std::vector<uint8_t> data;
+            try {
+                data = pm_->readPiece(cur);
+            } catch (const std::exception& e) {
+                logger_.error(std::string("Streaming stopped: ") + e.what());
+                break;
+            }
+            if (!out_(data.data(), data.size())) {
+                logger_.info("Stream consumer went away after piece " + std::to_string(cur) + ".");
+                break;
+            }
+            cursor_.store(++cur);
+        }
+
+        pm_->setPriorityWindow(0, 0);
+        if (cur == total) logger_.info("Stream complete: delivered " + std::to_string(total) + " pieces.");
+    }
+
+} // namespace p2p
@@ -0,0 +1,112 @@
+#include "p2p/SuperSeed.hpp"
+
+namespace p2p {
+
+    // How long a leecher may sit on an offered piece nobody else fetches before
+    // it gets another one anyway.
+    static constexpr std::chrono::seconds STALL_AFTER{3};
+
+    SuperSeed::SuperSeed(size_t pieceCount)
+    : pieces_(pieceCount),
+      offers_(pieceCount, 0),
+      seen_(pieceCount, 0) {}
+
+    SuperSeed::Peer& SuperSeed::peer_(int id){
+        auto it = peers_.find(id);
+        if (it == peers_.end()) {
+            it = peers_.emplace(id, Peer{}).first;
+            it->second.has.reset(pieces_);
+        }
+        return it->second;
+    }
+
+    int SuperSeed::offer(int peer){
+        std::lock_guard<std::mutex> lk(mtx_);
+        Peer& p = peer_(peer);
+        if (p.offered >= 0) return -1;
+
+        // Least offered first; among those, the one fewest peers have.
+        int best = -1;
+        for (size_t i = 0; i < pieces_; ++i) {
+            if (p.has.has(i)) continue;
+            if (best < 0 || offers_[i] < offers_[best] ||
+                (offers_[i] == offers_[best] && seen_[i] < seen_[best])) {
+                best = static_cast<int>(i);
+                if (offers_[i] == 0 && seen_[i] == 0) break; // can't do better
+            }
+        }
+        if (best < 0) return -1;
+
+        ++offers_[best];
+        p.offered = best;
+        p.gotIt = false;
+        return best;
+    }
+
+    void SuperSeed::noteHave_(int peer, size_t piece, std::vector<int>& ready){
+        Peer& p = peer_(peer);
+        if (piece >= pieces_ || p.has.has(piece)) return;
+        p.has.set(piece);
+        ++seen_[piece];
+
+        // Someone else's offer reached this peer: that one has spread.
+        bool othersLack = false;
+        for (auto& [id, q] : peers_) {
+            if (id == peer) continue;
+            if (q.offered == static_cast<int>(piece)) {
+                q.offered = -1;
+                ready.push_back(id);
+            }
+            if (!q.has.has(piece)) othersLack = true;
+        }
+
+        if (p.offered == static_cast<int>(piece)) {
+            p.gotIt = true;
+            p.gotAt = clock::now();
+            // Nobody around to pass it on to: no point waiting.
+            if (!othersLack) {
+                p.offered = -1;
+                ready.push_back(peer);
+            }
+        }
+    }
+
+    std::vector<int> SuperSeed::onHave(int peer, size_t piece){
+        std::lock_guard<std::mutex> lk(mtx_);
+        std::vector<int> ready;
+        noteHave_(peer, piece, ready);
+        return ready;
+    }
+
+    std::vector<int> SuperSeed::onBitfield(int peer, const CompactBitfield& has){
+        std::lock_guard<std::mutex> lk(mtx_);
+        std::vector<int> ready;
+        has.forEachRange([&](size_t b, size_t e){
+            for (size_t i = b; i < e && i < pieces_; ++i) noteHave_(peer, i, ready);
+            return true;
+        });
+        return ready;
+    }
+
+    bool SuperSeed::releaseIfStalled(int peer, clock::time_point now){
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = peers_.find(peer);
+        if (it == peers_.end()) return false;
+        Peer& p = it->second;
+        if (p.offered < 0 || !p.gotIt || now - p.gotAt < STALL_AFTER) return false;
+        p.offered = -1;
+        return true;
+    }
+
+    void SuperSeed::forget(int peer){
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = peers_.find(peer);
+        if (it == peers_.end()) return;
+        it->second.has.forEachRange([&](size_t b, size_t e){
+            for (size_t i = b; i < e; ++i) if (seen_[i] > 0) --seen_[i];
+            return true;
+        });
+        peers_.erase(it);
+    }
+
+} // namespace p2p
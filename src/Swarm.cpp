@@ -0,0 +1,34 @@
+#include "p2p/Swarm.hpp"
+
+namespace p2p {
+
+    SwarmRegistry gSwarms;
+
+    void SwarmRegistry::add(Swarm s){
+        std::lock_guard<std::mutex> lk(mtx_);
+        uint32_t id = s.id;
+        swarms_[id] = std::move(s);
+    }
+
+    std::shared_ptr<PieceManager> SwarmRegistry::find(uint32_t id) const{
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = swarms_.find(id);
+        return it == swarms_.end() ? nullptr : it->second.pieces;
+    }
+
+    std::optional<Swarm> SwarmRegistry::get(uint32_t id) const{
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = swarms_.find(id);
+        if (it == swarms_.end()) return std::nullopt;
+        return it->second;
+    }
+
+    std::vector<Swarm> SwarmRegistry::all() const{
+        std::lock_guard<std::mutex> lk(mtx_);
+        std::vector<Swarm> out;
+        out.reserve(swarms_.size());
+        for (const auto& [id, s] : swarms_) out.push_back(s);
+        return out;
+    }
+
+} // namespace p2p
@@ -0,0 +1,116 @@
+#include "p2p/Topology.hpp"
+
+#include <algorithm>
+
+namespace p2p {
+
+    // A dial younger than this that hasn't produced a connection still counts
+    // as a neighbor slot, so we don't over-dial while connects are in flight.
+    static constexpr std::chrono::seconds DIAL_PENDING{10};
+
+    Topology::Topology(int selfId, Logger& logger, ConnectionManager& conns, Connector& connector,
+                       std::vector<PeerInfoRow> candidates, size_t maxNeighbors, int refreshSec)
+    : selfId_(selfId),
+      logger_(logger),
+      conns_(conns),
+      connector_(connector),
+      maxNeighbors_(maxNeighbors),
+      cooldown_(std::max(1, refreshSec) * 2),
+      candidates_(std::move(candidates)) {
+        candidates_.erase(std::remove_if(candidates_.begin(), candidates_.end(),
+                          [&](const PeerInfoRow& r){ return r.peerId == selfId_; }),
+                          candidates_.end());
+    }
+
+    void Topology::start(){
+        std::lock_guard<std::mutex> lk(mtx_);
+        topUp_({});
+    }
+
+    void Topology::addCandidate(const PeerInfoRow& row){
+        if (row.peerId == selfId_) return;
+        std::map<int, bool> current;
+        conns_.forEach([&](ConnectionHandler& h){
+            if (h.remotePeerId() >= 0) current[h.remotePeerId()] = true;
+        });
+
+        std::lock_guard<std::mutex> lk(mtx_);
+        for (const auto& r : candidates_) if (r.peerId == row.peerId) return;
+        candidates_.push_back(row);
+        // A joining peer starts with a bootstrap node or two; fill up now rather
+        // than at the next refresh.
+        topUp_(current);
+    }
+
+    void Topology::dial_(const PeerInfoRow& row){
+        dialed_[row.peerId] = clock::now();
+        for (const auto& sw : gSwarms.all()) {
+            connector_.add({row.peerId, Endpoint{row.host, row.port}, sw.id});
+        }
+    }
+
+    void Topology::topUp_(const std::map<int, bool>& current){
+        auto now = clock::now();
+        size_t have = current.size();
+        for (const auto& [peer, at] : dialed_) {
+            if (!current.count(peer) && now - at < DIAL_PENDING) ++have;
+        }
+        if (have >= maxNeighbors_) return;
+
+        std::vector<const PeerInfoRow*> pool;
+        for (const auto& r : candidates_) {
+            if (current.count(r.peerId)) continue;
+            auto it = dialed_.find(r.peerId);
+            if (it != dialed_.end() && now - it->second < cooldown_) continue;
+            pool.push_back(&r);
+        }
+        std::shuffle(pool.begin(), pool.end(), rng_);
+        for (size_t i = 0; i < pool.size() && have < maxNeighbors_; ++i, ++have) {
+            dial_(*pool[i]);
+        }
+    }
+
+    void Topology::refresh(){
+        // Neighbor -> piece bytes received from it (all swarms), and whether we dialed it.
+        std::map<int, uint64_t> down;
+        std::map<int, bool> current;
+        conns_.forEach([&](ConnectionHandler& h){
+            int peer = h.remotePeerId();
+            if (peer < 0) return;
+            down[peer] += h.bytesDownloaded();
+            current[peer] = current[peer] || !h.incoming();
+        });
+
+        bool downloading = false;
+        for (const auto& sw : gSwarms.all()) {
+            if (!sw.pieces->isComplete()) { downloading = true; break; }
+        }
+
+        std::lock_guard<std::mutex> lk(mtx_);
+
+        // Full: swap out the slowest neighbor we dialed (measured over the last
+        // interval) for a random new one. Seeds have nothing to gain, so they keep theirs.
+        if (downloading && current.size() >= maxNeighbors_) {
+            int worst = -1;
+            uint64_t worstRate = 0;
+            for (const auto& [peer, dialedByUs] : current) {
+                auto prev = lastDown_.find(peer);
+                if (!dialedByUs || prev == lastDown_.end()) continue; // too new to judge
+                uint64_t rate = down[peer] - prev->second;
+                if (worst < 0 || rate < worstRate) { worst = peer; worstRate = rate; }
+            }
+            if (worst >= 0) {
+                logger_.info("Dropping slow neighbor " + std::to_string(worst) + " (" +
+                             std::to_string(worstRate) + " bytes last interval).");
+                conns_.forEach([&](ConnectionHandler& h){
+                    if (h.remotePeerId() == worst && !h.incoming()) h.retire();
+                });
+                current.erase(worst);
+            }
+        }
+
+        lastDown_ = std::move(down);
+        topUp_(current);
+    }
+
+} // namespace p2p
@@ -0,0 +1,158 @@
+#include "p2p/Transport.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#endif
+
+namespace p2p {
+
+    SocketTransport::~SocketTransport(){
+    #if defined(_WIN32)
+        if (sock_ != INVALID_SOCKET) closesocket(sock_);
+    #else
+        if (sock_ >= 0) ::close(sock_);
+    #endif
+    }
+
+    bool SocketTransport::sendAll(const uint8_t* data, size_t n){
+        size_t sent=0;
+        while (sent<n){
+        #if defined(_WIN32)
+            int r = ::send(sock_, reinterpret_cast<const char*>(data+sent), int(n-sent), 0);
+        #else
+            ssize_t r = ::send(sock_, data+sent, n-sent, 0);
+        #endif
+            if (r<=0) return false;
+            sent += size_t(r);
+        }
+        return true;
+    }
+
+    bool SocketTransport::recvAll(uint8_t* data, size_t n){
+        size_t got=0;
+        while (got<n){
+        #if defined(_WIN32)
+            int r = ::recv(sock_, reinterpret_cast<char*>(data+got), int(n-got), MSG_WAITALL);
+        #else
+            ssize_t r = ::recv(sock_, data+got, n-got, MSG_WAITALL);
+        #endif
+            if (r<=0) return false;
+            got += size_t(r);
+        }
+        return true;
+    }
+
+    int SocketTransport::waitReadable(int timeoutMs){
+    #if defined(_WIN32)
+        WSAPOLLFD p{}; p.fd = sock_; p.events = POLLRDNORM;
+        return WSAPoll(&p, 1, timeoutMs);
+    #else
+        pollfd p{}; p.fd = sock_; p.events = POLLIN;
+        int r = ::poll(&p, 1, timeoutMs);
+        if (r < 0 && errno == EINTR) return 0;
+        return r;
+    #endif
+    }
+
+    void SocketTransport::shutdown(){
+    #if defined(_WIN32)
+        if (sock_ != INVALID_SOCKET) ::shutdown(sock_, SD_BOTH);
+    #else
+        if (sock_ >= 0) ::shutdown(sock_, SHUT_RDWR);
+    #endif
+    }
+
+    std::string SocketTransport::remoteHost() const{
+    #if defined(_WIN32)
+        return "";
+    #else
+        sockaddr_storage ss{};
+        socklen_t len = sizeof(ss);
+        if (::getpeername(sock_, reinterpret_cast<sockaddr*>(&ss), &len) != 0) return "";
+        char buf[INET6_ADDRSTRLEN] = {0};
+        if (ss.ss_family == AF_INET) {
+            inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in*>(&ss)->sin_addr, buf, sizeof(buf));
+        } else if (ss.ss_family == AF_INET6) {
+            inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6*>(&ss)->sin6_addr, buf, sizeof(buf));
+        }
+        return buf;
+    #endif
+    }
+
+    std::pair<std::unique_ptr<MemoryTransport>, std::unique_ptr<MemoryTransport>>
+    MemoryTransport::pair(size_t capacity){
+        auto ab = std::make_shared<Pipe>();
+        auto ba = std::make_shared<Pipe>();
+        ab->ring.resize(std::max<size_t>(capacity, 1));
+        ba->ring.resize(std::max<size_t>(capacity, 1));
+        return {std::unique_ptr<MemoryTransport>(new MemoryTransport(ba, ab)),
+                std::unique_ptr<MemoryTransport>(new MemoryTransport(ab, ba))};
+    }
+
+    bool MemoryTransport::sendAll(const uint8_t* data, size_t n){
+        Pipe& p = *out_;
+        std::unique_lock<std::mutex> lk(p.mtx);
+        while (n > 0) {
+            p.cv.wait(lk, [&]{ return p.closed || p.size < p.ring.size(); });
+            if (p.closed) return false;
+            size_t cap = p.ring.size();
+            size_t tail = (p.head + p.size) % cap;
+            size_t k = std::min(n, std::min(cap - p.size, cap - tail));
+            std::memcpy(p.ring.data() + tail, data, k);
+            p.size += k;
+            data += k;
+            n -= k;
+            p.cv.notify_all();
+        }
+        return true;
+    }
+
+    bool MemoryTransport::recvAll(uint8_t* data, size_t n){
+        Pipe& p = *in_;
+        std::unique_lock<std::mutex> lk(p.mtx);
+        while (n > 0) {
+            p.cv.wait(lk, [&]{ return p.closed || p.size > 0; });
+            if (p.size == 0) return false; // closed and drained
+            size_t cap = p.ring.size();
+            size_t k = std::min(n, std::min(p.size, cap - p.head));
+            std::memcpy(data, p.ring.data() + p.head, k);
+            p.head = (p.head + k) % cap;
+            p.size -= k;
+            data += k;
+            n -= k;
+            p.cv.notify_all();
+        }
+        return true;
+    }
+
+    int MemoryTransport::waitReadable(int timeoutMs){
+        Pipe& p = *in_;
+        std::unique_lock<std::mutex> lk(p.mtx);
+        auto ready = [&]{ return p.closed || p.size > 0; };
+        if (timeoutMs < 0) {
+            p.cv.wait(lk, ready);
+            return 1;
+        }
+        return p.cv.wait_for(lk, std::chrono::milliseconds(timeoutMs), ready) ? 1 : 0;
+    }
+
+    void MemoryTransport::closeWrite(){
+        std::lock_guard<std::mutex> lk(out_->mtx);
+        out_->closed = true;
+        out_->cv.notify_all();
+    }
+
+    void MemoryTransport::shutdown(){
+        for (auto* p : {in_.get(), out_.get()}) {
+            std::lock_guard<std::mutex> lk(p->mtx);
+            p->closed = true;
+            p->cv.notify_all();
+        }
+    }
+
+} // namespace p2p
@@ -0,0 +1,600 @@
+#include "p2p/UdpTransport.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
+namespace p2p {
+
+    UdpMux gUdpMux;
+
+    enum : uint8_t { PKT_DATA = 0, PKT_STATE = 1, PKT_SYN = 2, PKT_FIN = 3 };
+
+    static constexpr size_t HDR = 29;
+    static constexpr size_t MSS = 1200;                  // payload; fits a 1280-byte IPv6 minimum MTU
+    static constexpr size_t SEND_BUF = 2u << 20;         // unacked + unsent bytes before sendAll() waits
+    static constexpr size_t RECV_BUF = 4u << 20;         // most we'll hold unread (advertised window)
+    static constexpr double MIN_CWND = 2 * MSS;
+    static constexpr double MAX_CWND = 16u << 20;
+    static constexpr double INITIAL_CWND = 4 * MSS;
+    static constexpr double GAIN = 1.0;                  // RFC 6817: at most one MSS per RTT
+    static constexpr double ALLOWED_INCREASE = 1.0;      // cwnd may exceed what's in flight by this many MSS
+    static constexpr size_t CURRENT_FILTER = 4;          // samples in the current-delay minimum
+    static constexpr size_t BASE_HISTORY = 10;           // minutes of base delay kept
+    static constexpr int64_t RTO_INITIAL_US = 1000000;
+    static constexpr int64_t RTO_MIN_US = 200000;
+    static constexpr int64_t RTO_MAX_US = 8000000;
+    static constexpr int MAX_TX = 10;                    // sends of one packet before the connection fails
+    static constexpr int64_t SYN_EVERY_US = 250000;
+    static constexpr int MAX_SYNS = 20;
+    static constexpr int TICK_MS = 5;
+
+    static int64_t nowUs(){
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Sequence and timestamp comparisons are mod 2^32.
+    static bool seqLess(uint32_t a, uint32_t b){ return static_cast<int32_t>(a - b) < 0; }
+
+    static void put32(uint8_t* p, uint32_t v){
+        p[0] = uint8_t(v >> 24); p[1] = uint8_t(v >> 16); p[2] = uint8_t(v >> 8); p[3] = uint8_t(v);
+    }
+    static uint32_t get32(const uint8_t* p){
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+
+    static bool sameAddr(const sockaddr_storage& a, const sockaddr_storage& b){
+        if (a.ss_family != AF_INET || b.ss_family != AF_INET) return false;
+        auto& x = reinterpret_cast<const sockaddr_in&>(a);
+        auto& y = reinterpret_cast<const sockaddr_in&>(b);
+        return x.sin_port == y.sin_port && x.sin_addr.s_addr == y.sin_addr.s_addr;
+    }
+
+    // ---- UdpTransport ----
+
+    UdpTransport::UdpTransport(UdpMux& mux, uint32_t connId, const sockaddr_storage* to, socklen_t toLen)
+    : mux_(mux), connId_(connId), peerWnd_(RECV_BUF), cwnd_(INITIAL_CWND), ssthresh_(MAX_CWND),
+      rtoUs_(RTO_INITIAL_US) {
+        if (to) {
+            peer_ = *to;
+            peerLen_ = toLen;
+        }
+        advertised_ = RECV_BUF;
+    }
+
+    UdpTransport::~UdpTransport(){ mux_.remove_(connId_, this); }
+
+    void UdpTransport::setOnEstablished(OnEstablished fn){
+        std::lock_guard<std::mutex> lk(cbMtx_);
+        onEstablished_ = std::move(fn);
+    }
+
+    void UdpTransport::disarm(){
+        std::lock_guard<std::mutex> lk(cbMtx_);
+        onEstablished_ = nullptr;
+    }
+
+    void UdpTransport::connect(){
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (!peerLen_ || connecting_) return;
+        connecting_ = true;
+        synAtUs_ = nowUs();
+        synTries_ = 1;
+        sendCtl_(PKT_SYN, synAtUs_);
+    }
+
+    size_t UdpTransport::cwnd() const{
+        std::lock_guard<std::mutex> lk(mtx_);
+        return static_cast<size_t>(cwnd_);
+    }
+
+    double UdpTransport::queuingDelayMs() const{
+        std::lock_guard<std::mutex> lk(mtx_);
+        return queuingUs_ / 1000.0;
+    }
+
+    std::string UdpTransport::remoteHost() const{
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (!peerLen_ || peer_.ss_family != AF_INET) return "";
+        char buf[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in&>(peer_).sin_addr, buf, sizeof(buf));
+        return buf;
+    }
+
+    uint32_t UdpTransport::recvWindow_() const{
+        size_t held = rqBytes_ + oooBytes_;
+        return held >= RECV_BUF ? 0 : static_cast<uint32_t>(RECV_BUF - held);
+    }
+
+    // Header with our side of the receive state; every packet carries it.
+    static void fillHeader(uint8_t* h, uint8_t type, uint32_t connId, uint32_t seq, uint32_t ack,
+                           uint32_t sack, uint32_t ts, uint32_t tsDiff, uint32_t wnd){
+        h[0] = type;
+        put32(h + 1, connId);
+        put32(h + 5, seq);
+        put32(h + 9, ack);
+        put32(h + 13, sack);
+        put32(h + 17, ts);
+        put32(h + 21, tsDiff);
+        put32(h + 25, wnd);
+    }
+
+    void UdpTransport::sendCtl_(uint8_t type, int64_t now){
+        if (!peerLen_) return;
+        uint32_t sack = 0;
+        for (const auto& [seq, data] : ooo_) {
+            uint32_t bit = seq - ackNext_ - 1;
+            if (bit >= 32) break;
+            sack |= 1u << bit;
+        }
+        uint8_t h[HDR];
+        advertised_ = recvWindow_();
+        fillHeader(h, type, connId_, nextSeq_, ackNext_, sack, static_cast<uint32_t>(now), lastDelayUs_, advertised_);
+        mux_.send_(h, HDR, peer_, peerLen_);
+    }
+
+    void UdpTransport::transmit_(Packet& p, int64_t now){
+        uint32_t sack = 0;
+        for (const auto& [seq, data] : ooo_) {
+            uint32_t bit = seq - ackNext_ - 1;
+            if (bit >= 32) break;
+            sack |= 1u << bit;
+        }
+        uint8_t buf[HDR + MSS];
+        advertised_ = recvWindow_();
+        fillHeader(buf, PKT_DATA, connId_, p.seq, ackNext_, sack, static_cast<uint32_t>(now), lastDelayUs_, advertised_);
+        std::memcpy(buf + HDR, p.data.data(), p.data.size());
+        mux_.send_(buf, HDR + p.data.size(), peer_, peerLen_);
+        p.sentUs = now;
+        ++p.tx;
+    }
+
+    // Send new packets while the window (ours and theirs) has room. With
+    // nothing in flight one always goes, which also probes a closed window.
+    void UdpTransport::trySend_(int64_t now){
+        if (!established_ || closed_ || failed_) return;
+        size_t wnd = std::min(static_cast<size_t>(cwnd_), static_cast<size_t>(peerWnd_));
+        while (sendNext_ < sendQ_.size()) {
+            Packet& p = sendQ_[sendNext_];
+            if (flight_ > 0 && flight_ + p.data.size() > wnd) break;
+            transmit_(p, now);
+            flight_ += p.data.size();
+            ++sendNext_;
+        }
+    }
+
+    void UdpTransport::fail_(){
+        failed_ = true;
+        cv_.notify_all();
+    }
+
+    // RFC 6298, in microseconds.
+    void UdpTransport::onRtt_(int64_t us){
+        double r = static_cast<double>(std::max<int64_t>(us, 1));
+        if (!haveRtt_) {
+            srttUs_ = r;
+            rttVarUs_ = r / 2;
+            haveRtt_ = true;
+        } else {
+            rttVarUs_ = 0.75 * rttVarUs_ + 0.25 * std::abs(srttUs_ - r);
+            srttUs_ = 0.875 * srttUs_ + 0.125 * r;
+        }
+        rtoUs_ = std::clamp(static_cast<int64_t>(srttUs_ + 4 * rttVarUs_), RTO_MIN_US, RTO_MAX_US);
+    }
+
+    // One-way delay sample: keep the base (per-minute minima) and current
+    // (last few) filters, then queuing delay = current - base.
+    void UdpTransport::onDelay_(uint32_t sample, int64_t now){
+        if (baseDelays_.empty() || now - baseMinuteUs_ >= 60000000) {
+            baseDelays_.push_back(sample);
+            if (baseDelays_.size() > BASE_HISTORY) baseDelays_.erase(baseDelays_.begin());
+            baseMinuteUs_ = now;
+        } else if (seqLess(sample, baseDelays_.back())) {
+            baseDelays_.back() = sample;
+        }
+        curDelays_.push_back(sample);
+        if (curDelays_.size() > CURRENT_FILTER) curDelays_.pop_front();
+
+        uint32_t base = baseDelays_.front();
+        for (uint32_t b : baseDelays_) if (seqLess(b, base)) base = b;
+        uint32_t cur = curDelays_.front();
+        for (uint32_t c : curDelays_) if (seqLess(c, cur)) cur = c;
+        int32_t q = static_cast<int32_t>(cur - base);
+        queuingUs_ = q > 0 ? static_cast<uint32_t>(q) : 0;
+    }
+
+    void UdpTransport::onAck_(uint32_t ack, uint32_t sack, uint32_t wnd, uint32_t tsDiff, int64_t now){
+        peerWnd_ = wnd;
+        size_t flightBefore = flight_;
+        size_t acked = 0;
+        bool sampled = false;
+
+        // Cumulative: everything before `ack`.
+        while (sendNext_ > 0 && seqLess(sendQ_.front().seq, ack)) {
+            Packet& p = sendQ_.front();
+            if (!p.sacked) {
+                flight_ -= p.data.size();
+                acked += p.data.size();
+            }
+            if (p.tx == 1 && !sampled) { // Karn: no samples from retransmits
+                onRtt_(now - p.sentUs);
+                sampled = true;
+            }
+            queuedBytes_ -= p.data.size();
+            sendQ_.pop_front();
+            --sendNext_;
+        }
+
+        // Selective: ack+1+i for each set bit. A hole with three sacked packets
+        // after it is taken as lost and resent once.
+        bool loss = false;
+        if (sack && sendNext_ > 0) {
+            uint32_t first = sendQ_.front().seq;
+            for (int i = 0; i < 32; ++i) {
+                if (!(sack & (1u << i))) continue;
+                size_t at = static_cast<size_t>(ack + 1 + static_cast<uint32_t>(i) - first);
+                if (at >= sendNext_) break;
+                Packet& p = sendQ_[at];
+                if (!p.sacked) {
+                    p.sacked = true;
+                    flight_ -= p.data.size();
+                    acked += p.data.size();
+                }
+            }
+            size_t after = 0;
+            for (size_t i = sendNext_; i-- > 0;) {
+                Packet& p = sendQ_[i];
+                if (p.sacked) { ++after; continue; }
+                if (after >= 3 && !p.fastRetx) {
+                    p.fastRetx = true;
+                    transmit_(p, now);
+                    loss = true;
+                }
+            }
+        }
+        if (inRecovery_ && !seqLess(ack, recoverSeq_)) inRecovery_ = false;
+        if (loss && !inRecovery_) {
+            // Once per window, like TCP: halve and leave slow start.
+            cwnd_ = std::max(cwnd_ / 2, MIN_CWND);
+            ssthresh_ = cwnd_;
+            inRecovery_ = true;
+            recoverSeq_ = nextSeq_;
+        }
+
+        if (acked > 0) {
+            if (tsDiff) onDelay_(tsDiff, now);
+            double before = cwnd_;
+            double target = static_cast<double>(mux_.targetDelayUs());
+            double q = static_cast<double>(queuingUs_);
+            if (cwnd_ < ssthresh_ && q < target / 2) {
+                cwnd_ += static_cast<double>(acked); // slow start until the queue starts to build
+            } else {
+                if (ssthresh_ >= MAX_CWND) ssthresh_ = cwnd_;
+                double offTarget = (target - q) / target;
+                cwnd_ += GAIN * offTarget * static_cast<double>(acked) * MSS / cwnd_;
+            }
+            // No growing a window the sender isn't filling (RFC 6817 2.4.1); it
+            // doesn't shrink for that either, or every idle gap would reset it.
+            double cap = static_cast<double>(flightBefore) + ALLOWED_INCREASE * MSS;
+            if (cwnd_ > before && cwnd_ > cap) cwnd_ = std::max(before, cap);
+            cwnd_ = std::clamp(cwnd_, MIN_CWND, MAX_CWND);
+            cv_.notify_all();
+        }
+    }
+
+    void UdpTransport::onData_(uint32_t seq, const uint8_t* p, size_t n){
+        if (seqLess(seq, ackNext_)) return; // duplicate
+        if (static_cast<size_t>(seq - ackNext_) >= RECV_BUF / MSS) return; // past our window
+        if (seq != ackNext_) {
+            if (ooo_.emplace(seq, std::vector<uint8_t>(p, p + n)).second) oooBytes_ += n;
+            return;
+        }
+        rq_.emplace_back(p, p + n);
+        rqBytes_ += n;
+        ++ackNext_;
+        for (auto it = ooo_.find(ackNext_); it != ooo_.end(); it = ooo_.find(ackNext_)) {
+            oooBytes_ -= it->second.size();
+            rqBytes_ += it->second.size();
+            rq_.push_back(std::move(it->second));
+            ooo_.erase(it);
+            ++ackNext_;
+        }
+        cv_.notify_all();
+    }
+
+    void UdpTransport::onPacket_(const uint8_t* p, size_t n, const sockaddr_storage& from, socklen_t fromLen){
+        if (n < HDR) return;
+        uint8_t type = p[0];
+        uint32_t seq = get32(p + 5), ack = get32(p + 9), sack = get32(p + 13);
+        uint32_t ts = get32(p + 17), tsDiff = get32(p + 21), wnd = get32(p + 25);
+        int64_t now = nowUs();
+        bool justEstablished = false;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (!peerLen_) {
+                if (type != PKT_SYN) return;
+                peer_ = from; // listening side: the SYN says who we're talking to
+                peerLen_ = fromLen;
+            } else if (!sameAddr(from, peer_)) {
+                return;
+            }
+            if (closed_) {
+                sendCtl_(PKT_FIN, now);
+                return;
+            }
+            // A SYN alone doesn't establish the listening side: its STATE may
+            // not get through, and then the dialer would never switch.
+            if (!established_ && (connecting_ || type != PKT_SYN)) {
+                established_ = true;
+                justEstablished = true;
+            }
+
+            onAck_(ack, sack, wnd, tsDiff, now);
+            switch (type) {
+                case PKT_SYN:
+                    sendCtl_(PKT_STATE, now);
+                    break;
+                case PKT_DATA:
+                    lastDelayUs_ = static_cast<uint32_t>(now) - ts;
+                    if (lastDelayUs_ == 0) lastDelayUs_ = 1; // 0 means "no sample"
+                    onData_(seq, p + HDR, n - HDR);
+                    sendCtl_(PKT_STATE, now);
+                    break;
+                case PKT_FIN:
+                    peerClosed_ = true;
+                    cv_.notify_all();
+                    break;
+                default:
+                    break;
+            }
+            // Dialer: tell the listening side its STATE arrived.
+            if (justEstablished && connecting_) sendCtl_(PKT_STATE, now);
+            trySend_(now);
+        }
+        if (justEstablished) fireEstablished_();
+    }
+
+    bool UdpTransport::confirm(){
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (connecting_ || !peerLen_ || closed_ || failed_) return false;
+            if (established_) return true;
+            established_ = true;
+        }
+        fireEstablished_();
+        return true;
+    }
+
+    void UdpTransport::fireEstablished_(){
+        std::lock_guard<std::mutex> lk(cbMtx_);
+        if (onEstablished_) {
+            auto fn = std::move(onEstablished_);
+            onEstablished_ = nullptr;
+            fn();
+        }
+    }
+
+    // Retransmit timer, SYN retries.
+    void UdpTransport::tick_(int64_t now){
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (closed_ || failed_) return;
+        if (connecting_ && !established_) {
+            if (now - synAtUs_ < SYN_EVERY_US) return;
+            if (++synTries_ > MAX_SYNS) { fail_(); return; }
+            synAtUs_ = now;
+            sendCtl_(PKT_SYN, now);
+            return;
+        }
+        if (!established_) return;
+
+        // Oldest packet still unaccounted for.
+        for (size_t i = 0; i < sendNext_; ++i) {
+            Packet& p = sendQ_[i];
+            if (p.sacked) continue;
+            if (now - p.sentUs < rtoUs_) break;
+            if (p.tx >= MAX_TX) { fail_(); return; }
+            // Timeout: back to the minimum window, slow start up to half the old one.
+            ssthresh_ = std::max(cwnd_ / 2, MIN_CWND);
+            cwnd_ = MIN_CWND;
+            rtoUs_ = std::min(rtoUs_ * 2, RTO_MAX_US);
+            transmit_(p, now);
+            break;
+        }
+        trySend_(now);
+    }
+
+    bool UdpTransport::sendAll(const uint8_t* data, size_t n){
+        std::unique_lock<std::mutex> lk(mtx_);
+        while (n > 0) {
+            cv_.wait(lk, [this]{ return closed_ || failed_ || peerClosed_ || queuedBytes_ < SEND_BUF; });
+            if (closed_ || failed_ || peerClosed_) return false;
+            while (n > 0 && queuedBytes_ < SEND_BUF) {
+                size_t k = std::min(n, MSS);
+                Packet p;
+                p.seq = nextSeq_++;
+                p.data.assign(data, data + k);
+                sendQ_.push_back(std::move(p));
+                queuedBytes_ += k;
+                data += k;
+                n -= k;
+            }
+            trySend_(nowUs());
+        }
+        return true;
+    }
+
+    bool UdpTransport::recvAll(uint8_t* data, size_t n){
+        std::unique_lock<std::mutex> lk(mtx_);
+        while (n > 0) {
+            cv_.wait(lk, [this]{ return rqBytes_ > 0 || closed_ || failed_ || peerClosed_; });
+            if (closed_ || rqBytes_ == 0) return false;
+            while (n > 0 && !rq_.empty()) {
+                auto& front = rq_.front();
+                size_t k = std::min(n, front.size() - rqOff_);
+                std::memcpy(data, front.data() + rqOff_, k);
+                data += k;
+                n -= k;
+                rqOff_ += k;
+                rqBytes_ -= k;
+                if (rqOff_ == front.size()) {
+                    rq_.pop_front();
+                    rqOff_ = 0;
+                }
+            }
+            // Tell a sender we've stalled that there's room again.
+            if (advertised_ < 2 * MSS && recvWindow_() >= RECV_BUF / 4) sendCtl_(PKT_STATE, nowUs());
+        }
+        return true;
+    }
+
+    int UdpTransport::waitReadable(int timeoutMs){
+        std::unique_lock<std::mutex> lk(mtx_);
+        auto ready = [this]{ return rqBytes_ > 0 || closed_ || failed_ || peerClosed_; };
+        if (timeoutMs < 0) {
+            cv_.wait(lk, ready);
+            return 1;
+        }
+        return cv_.wait_for(lk, std::chrono::milliseconds(timeoutMs), ready) ? 1 : 0;
+    }
+
+    void UdpTransport::shutdown(){
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (closed_) return;
+        if (established_) sendCtl_(PKT_FIN, nowUs());
+        closed_ = true;
+        cv_.notify_all();
+    }
+
+    // ---- UdpMux ----
+
+    UdpMux::~UdpMux(){ stop(); }
+
+#if defined(_WIN32)
+    void UdpMux::start(int, int){ throw std::runtime_error("UDP transport is not supported on Windows"); }
+    void UdpMux::stop(){}
+    void UdpMux::loop_(){}
+    void UdpMux::send_(const uint8_t*, size_t, const sockaddr_storage&, socklen_t){}
+    std::shared_ptr<UdpTransport> UdpMux::open(uint32_t, const std::string&, int){ return nullptr; }
+#else
+    void UdpMux::start(int port, int targetDelayMs){
+        if (running_) return;
+        sock_ = ::socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_addr.s_addr = htonl(INADDR_ANY);
+        a.sin_port = htons(static_cast<uint16_t>(port));
+        if (sock_ < 0 || ::bind(sock_, reinterpret_cast<sockaddr*>(&a), sizeof(a)) != 0) {
+            if (sock_ >= 0) ::close(sock_);
+            sock_ = -1;
+            throw std::runtime_error("Cannot bind UDP port " + std::to_string(port));
+        }
+        // Bursts of a whole window arrive back to back.
+        int bufBytes = 4 << 20;
+        ::setsockopt(sock_, SOL_SOCKET, SO_RCVBUF, &bufBytes, sizeof(bufBytes));
+        ::setsockopt(sock_, SOL_SOCKET, SO_SNDBUF, &bufBytes, sizeof(bufBytes));
+        port_ = port;
+        targetUs_ = std::max(1, targetDelayMs) * 1000;
+        running_ = true;
+        thr_ = std::thread(&UdpMux::loop_, this);
+    }
+
+    void UdpMux::stop(){
+        if (!running_.exchange(false)) return;
+        if (thr_.joinable()) thr_.join();
+        ::close(sock_);
+        sock_ = -1;
+    }
+
+    void UdpMux::send_(const uint8_t* p, size_t n, const sockaddr_storage& to, socklen_t toLen){
+        // A full socket buffer drops it, as the network might; retransmission covers it.
+        ::sendto(sock_, p, n, MSG_DONTWAIT, reinterpret_cast<const sockaddr*>(&to), toLen);
+    }
+
+    void UdpMux::loop_(){
+        std::vector<uint8_t> buf(65536);
+        int64_t lastTick = nowUs();
+        while (running_) {
+            pollfd pf{}; pf.fd = sock_; pf.events = POLLIN;
+            int r = ::poll(&pf, 1, TICK_MS);
+            if (r > 0) {
+                for (;;) {
+                    sockaddr_storage from{};
+                    socklen_t fromLen = sizeof(from);
+                    ssize_t n = ::recvfrom(sock_, buf.data(), buf.size(), MSG_DONTWAIT,
+                                           reinterpret_cast<sockaddr*>(&from), &fromLen);
+                    if (n < 0) break;
+                    if (static_cast<size_t>(n) < HDR) continue;
+                    std::shared_ptr<UdpTransport> t;
+                    {
+                        std::lock_guard<std::mutex> lk(mtx_);
+                        auto it = conns_.find(get32(buf.data() + 1));
+                        if (it != conns_.end()) t = it->second.lock();
+                    }
+                    // Outside mtx_: a transport released here unregisters itself.
+                    if (t) t->onPacket_(buf.data(), static_cast<size_t>(n), from, fromLen);
+                }
+            }
+            int64_t now = nowUs();
+            if (now - lastTick >= TICK_MS * 1000) {
+                lastTick = now;
+                std::vector<std::shared_ptr<UdpTransport>> all;
+                {
+                    std::lock_guard<std::mutex> lk(mtx_);
+                    for (auto& [id, w] : conns_) if (auto t = w.lock()) all.push_back(std::move(t));
+                }
+                for (auto& t : all) t->tick_(now);
+            }
+        }
+    }
+
+    std::shared_ptr<UdpTransport> UdpMux::open(uint32_t connId, const std::string& host, int port){
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo* res = nullptr;
+        if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0 || !res) return nullptr;
+        sockaddr_storage to{};
+        std::memcpy(&to, res->ai_addr, res->ai_addrlen);
+        socklen_t len = static_cast<socklen_t>(res->ai_addrlen);
+        ::freeaddrinfo(res);
+        return register_(std::shared_ptr<UdpTransport>(new UdpTransport(*this, connId, &to, len)));
+    }
+#endif
+
+    std::shared_ptr<UdpTransport> UdpMux::open(uint32_t connId){
+        return register_(std::shared_ptr<UdpTransport>(new UdpTransport(*this, connId, nullptr, 0)));
+    }
+
+    std::shared_ptr<UdpTransport> UdpMux::register_(std::shared_ptr<UdpTransport> t){
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto& slot = conns_[t->connId_];
+        if (!slot.expired()) return nullptr; // taken; t's destructor leaves the slot alone
+        slot = t;
+        return t;
+    }
+
+    void UdpMux::remove_(uint32_t connId, const UdpTransport* t){
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = conns_.find(connId);
+        if (it == conns_.end()) return;
+        // Only our own entry (a rejected duplicate mustn't remove the original).
+        auto cur = it->second.lock();
+        if (!cur || cur.get() == t) conns_.erase(it);
+    }
+
+    uint32_t UdpMux::newConnId(){
+        std::lock_guard<std::mutex> lk(mtx_);
+        uint32_t id;
+        do { id = rng_(); } while (id == 0 || conns_.count(id));
+        return id;
+    }
+
+} // namespace p2p
@@ -0,0 +1,93 @@
+#include "p2p/WorkPool.hpp"
+
+#include <algorithm>
+
+namespace p2p {
+
+    WorkPool gWorkPool;
+
+    // Which pool (and which of its workers) the current thread belongs to.
+    static thread_local const WorkPool* tlsPool = nullptr;
+    static thread_local size_t tlsWorker = 0;
+
+    WorkPool::~WorkPool(){ stop(); }
+
+    void WorkPool::start(size_t threads){
+        if (running_.load()) return;
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+        workers_.clear();
+        for (size_t i = 0; i < threads; ++i) workers_.push_back(std::make_unique<Worker>());
+        running_.store(true);
+        for (size_t i = 0; i < threads; ++i) threads_.emplace_back(&WorkPool::run_, this, i);
+    }
+
+    void WorkPool::stop(){
+        if (!running_.exchange(false)) return;
+        { std::lock_guard<std::mutex> lk(sleepMtx_); }
+        sleepCv_.notify_all();
+        for (auto& t : threads_) if (t.joinable()) t.join();
+        threads_.clear();
+        workers_.clear();
+    }
+
+    void WorkPool::post(Task t){
+        if (!running_.load()) { t(); return; }
+
+        size_t w = (tlsPool == this) ? tlsWorker : next_.fetch_add(1) % workers_.size();
+        {
+            std::lock_guard<std::mutex> lk(workers_[w]->mtx);
+            if (tlsPool == this) workers_[w]->q.push_front(std::move(t));
+            else workers_[w]->q.push_back(std::move(t));
+        }
+        pending_.fetch_add(1);
+        // Take the lock so a worker between its check and its wait can't miss this.
+        { std::lock_guard<std::mutex> lk(sleepMtx_); }
+        sleepCv_.notify_one();
+    }
+
+    bool WorkPool::tryPop_(size_t self, Task& out){
+        {
+            Worker& mine = *workers_[self];
+            std::lock_guard<std::mutex> lk(mine.mtx);
+            if (!mine.q.empty()) {
+                out = std::move(mine.q.front());
+                mine.q.pop_front();
+                pending_.fetch_sub(1);
+                return true;
+            }
+        }
+        // Steal from the back of someone else's deque, the end its owner isn't
+        // popping. Its own posts go on the front, so the back is the newest
+        // post from outside, or failing that the owner's oldest task.
+        for (size_t k = 1; k < workers_.size(); ++k) {
+            Worker& victim = *workers_[(self + k) % workers_.size()];
+            std::lock_guard<std::mutex> lk(victim.mtx);
+            if (!victim.q.empty()) {
+                out = std::move(victim.q.back());
+                victim.q.pop_back();
+                pending_.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkPool::run_(size_t self){
+        tlsPool = this;
+        tlsWorker = self;
+        Task t;
+        for (;;) {
+            if (tryPop_(self, t)) {
+                try { t(); } catch (...) { /* tasks report their own errors */ }
+                t = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(sleepMtx_);
+            sleepCv_.wait(lk, [this]{ return pending_.load() > 0 || !running_.load(); });
+            if (!running_.load() && pending_.load() == 0) break;
+        }
+        tlsPool = nullptr;
+    }
+
+} // namespace p2p
@@ -0,0 +1,103 @@
+#include "p2p/ZeroScan.hpp"
+
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define P2P_ZS_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define P2P_ZS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace p2p {
+
+    // Blocks of this many bytes are OR'd together before testing, so the loop
+    // body is loads and ORs with one branch per block.
+    static constexpr size_t BLOCK = 256;
+
+    static bool allZeroScalar(const uint8_t* p, size_t n){
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            uint64_t w;
+            std::memcpy(&w, p + i, 8);
+            if (w) return false;
+        }
+        for (; i < n; ++i) {
+            if (p[i]) return false;
+        }
+        return true;
+    }
+
+#if defined(P2P_ZS_X86)
+
+    __attribute__((target("sse2")))
+    static bool allZeroSse2(const uint8_t* p, size_t n){
+        size_t i = 0;
+        for (; i + BLOCK <= n; i += BLOCK) {
+            __m128i acc = _mm_setzero_si128();
+            for (size_t j = 0; j < BLOCK; j += 16) {
+                acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + j)));
+            }
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xffff) return false;
+        }
+        return allZeroScalar(p + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    static bool allZeroAvx2(const uint8_t* p, size_t n){
+        size_t i = 0;
+        for (; i + BLOCK <= n; i += BLOCK) {
+            __m256i acc = _mm256_setzero_si256();
+            for (size_t j = 0; j < BLOCK; j += 32) {
+                acc = _mm256_or_si256(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + j)));
+            }
+            if (!_mm256_testz_si256(acc, acc)) return false;
+        }
+        return allZeroScalar(p + i, n - i);
+    }
+
+#elif defined(P2P_ZS_NEON)
+
+    static bool allZeroNeon(const uint8_t* p, size_t n){
+        size_t i = 0;
+        for (; i + BLOCK <= n; i += BLOCK) {
+            uint8x16_t acc = vdupq_n_u8(0);
+            for (size_t j = 0; j < BLOCK; j += 16) acc = vorrq_u8(acc, vld1q_u8(p + i + j));
+            if (vmaxvq_u8(acc) != 0) return false;
+        }
+        return allZeroScalar(p + i, n - i);
+    }
+
+#endif
+
+    struct ZeroKernel {
+        const char* name;
+        bool (*fn)(const uint8_t*, size_t);
+    };
+
+    static ZeroKernel pick(){
+#if defined(P2P_ZS_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return {"avx2", allZeroAvx2};
+        if (__builtin_cpu_supports("sse2")) return {"sse2", allZeroSse2};
+#elif defined(P2P_ZS_NEON)
+        return {"neon", allZeroNeon};
+#endif
+        return {"scalar", allZeroScalar};
+    }
+
+    static const ZeroKernel& kernel(){
+        static const ZeroKernel k = pick();
+        return k;
+    }
+
+    bool allZero(const uint8_t* p, size_t n){
+        // Most pieces that aren't zero say so in their first bytes.
+        if (n >= 16 && !allZeroScalar(p, 16)) return false;
+        return kernel().fn(p, n);
+    }
+
+    const char* allZeroBackend(){ return kernel().name; }
+
+} // namespace p2p
@@ -2,18 +2,43 @@
 #include <vector>
 #include <memory>
 #include <filesystem>
+#include <algorithm>
+#include <csignal>
+#include <chrono>
+#include <fstream>
 
 #include "p2p/Config.hpp"
 #include "p2p/Logger.hpp"
 #include "p2p/Bitfield.hpp"
 #include "p2p/PeerState.hpp"
 #include "p2p/Net.hpp"
+#include "p2p/Connector.hpp"
+#include "p2p/ConnectionManager.hpp"
+#include "p2p/Topology.hpp"
 //#include "p2p/Protocol.hpp"
 #include "p2p/Scheduler.hpp"
 #include "p2p/PieceManager.hpp"
+#include "p2p/Swarm.hpp"
+#include "p2p/RateLimiter.hpp"
+#include "p2p/WorkPool.hpp"
+#include "p2p/StreamSink.hpp"
+#include "p2p/PeerBook.hpp"
+#include "p2p/Recorder.hpp"
+#include "p2p/LocalTransport.hpp"
+#include "p2p/ErasureCode.hpp"
+#include "p2p/DeltaSync.hpp"
+#include "p2p/ZeroScan.hpp"
+#include "p2p/LockStats.hpp"
+#include "p2p/Profile.hpp"
 
 using namespace p2p;
 
+#if defined(P2P_LOCK_STATS) || defined(P2P_PROFILE)
+// SIGUSR1: write the diagnostic reports. SIGINT / SIGTERM: write them, then go down as usual.
+static volatile std::sig_atomic_t gReportSignal = 0;
+static void onReportSignal(int sig){ gReportSignal = sig; }
+#endif
+
 static size_t computePieceCount(long long fileSize, int pieceSize){
     if (pieceSize<=0) return 0;
     auto full = fileSize / pieceSize;
@@ -22,38 +47,227 @@ static size_t computePieceCount(long long fileSize, int pieceSize){
 
 int main(int argc, char** argv){
     try {
-        if (argc < 2){ std::cerr << "Usage: peerProcess <peerId>\n"; return 1; }
+        if (argc < 2){ std::cerr << "Usage: peerProcess <peerId> [listenPort]\n"; return 1; }
         int selfId = std::stoi(argv[1]);
+        // A listen port lets a peer missing from PeerInfo.cfg join through PEX.
+        int joinPort = (argc >= 3) ? std::stoi(argv[2]) : 0;
 
         // Assume working dir is current directory
         std::string workDir = std::filesystem::current_path().string();
         std::string rootDir = std::filesystem::path(workDir).parent_path().string();
-        auto cfg = ConfigBundle::load(selfId, rootDir+"/Common.cfg", rootDir+"/PeerInfo.cfg", rootDir);
+        auto cfg = ConfigBundle::load(selfId, rootDir+"/Common.cfg", rootDir+"/PeerInfo.cfg", rootDir, joinPort);
 
         Logger logger(cfg.paths.logFile);
-        std::cout << "Log file path: " << cfg.paths.logFile << std::endl;
-        std::cout.flush();
+        // stdout carries the file itself when streaming to "-"
+        std::ostream& diag = (cfg.common.streamTo == "-") ? std::cerr : std::cout;
+        diag << "Log file path: " << cfg.paths.logFile << std::endl;
+        diag.flush();
         logger.info("peerProcess starting for peerId=" + std::to_string(selfId));
-        std::cout << "Logged startup message" << std::endl;
-        std::cout.flush();
+        diag << "Logged startup message" << std::endl;
+        diag.flush();
+
+    #if !defined(_WIN32)
+        // A peer or stream consumer hanging up should be an EPIPE, not the end of us.
+        std::signal(SIGPIPE, SIG_IGN);
+    #endif
 
         // PieceManager setup
         // Store the data file inside this peer's directory.
         std::string filePath = cfg.paths.peerDir + "/" + cfg.common.fileName;
 
-        // Create the PieceManager on the heap and store it in the global pointer
+        // Swarm 0: the file from Common.cfg
         auto pieceMgr = std::make_shared<p2p::PieceManager>(
             filePath,
             cfg.common.fileSizeBytes,
             cfg.common.pieceSizeBytes,
             cfg.self.hasFile   // true if this peer starts with complete file
         );
+        pieceMgr->enableErasure(cfg.common.erasureStripe, cfg.common.erasureParity);
+
+        // Super-seeding only makes sense for files we start out with.
+        auto superSeedFor = [&](bool seeding, const std::shared_ptr<p2p::PieceManager>& pm){
+            return (cfg.common.superSeed && seeding) ? std::make_shared<p2p::SuperSeed>(pm->pieceCount())
+                                                     : nullptr;
+        };
+
+        // Update mode: reuse whatever an older version of the file already has.
+        std::string deltaFrom;
+        if (!cfg.common.deltaFrom.empty() && !cfg.self.hasFile) {
+            std::filesystem::path old = cfg.common.deltaFrom;
+            if (old.is_relative()) old = std::filesystem::path(cfg.paths.peerDir) / old;
+            std::error_code ec;
+            if (std::filesystem::equivalent(old, filePath, ec)) {
+                // We'd be downloading over what we read from; move it aside
+                // (unless an earlier run already did).
+                std::filesystem::path moved = filePath + ".old";
+                if (!std::filesystem::exists(moved)) std::filesystem::rename(old, moved);
+                old = moved;
+            }
+            deltaFrom = old.string();
+        }
+        auto delta = std::make_shared<p2p::DeltaSync>(pieceMgr, deltaFrom);
+
+        // Make it visible to all connections
+        p2p::gSwarms.add({0, cfg.common.fileName, pieceMgr, superSeedFor(cfg.self.hasFile, pieceMgr), delta});
+
+        // Extra swarms from Swarms.cfg share the listener, threads and upload budget.
+        // We seed one if its file is already in our directory at full size.
+        for (const auto& row : cfg.swarms.rows) {
+            std::string path = cfg.paths.peerDir + "/" + row.fileName;
+            std::error_code ec;
+            bool seeding = std::filesystem::file_size(path, ec) == static_cast<uintmax_t>(row.fileSizeBytes) && !ec;
+            auto pm = std::make_shared<p2p::PieceManager>(path, row.fileSizeBytes, row.pieceSizeBytes, seeding);
+            pm->enableErasure(cfg.common.erasureStripe, cfg.common.erasureParity);
+            p2p::gSwarms.add({row.swarmId, row.fileName, pm, superSeedFor(seeding, pm),
+                              std::make_shared<p2p::DeltaSync>(pm)});
+            logger.info("Serving swarm " + std::to_string(row.swarmId) + " (" + row.fileName + ")" +
+                        (seeding ? " as seed." : "."));
+        }
+
+        // Lay out files we're downloading before any piece arrives (a seed
+        // computes its parity pieces here).
+        for (const auto& sw : p2p::gSwarms.all()) {
+            auto t0 = std::chrono::steady_clock::now();
+            sw.pieces->prepareStorage(cfg.common.directIO);
+            if (sw.pieces->erasure()) {
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+                logger.info("Erasure coding " + sw.fileName + ": " + std::to_string(cfg.common.erasureStripe) + "+" +
+                            std::to_string(cfg.common.erasureParity) + " per stripe, " +
+                            std::to_string(sw.pieces->pieceCount() - sw.pieces->dataPieceCount()) + " parity pieces (" +
+                            p2p::gf256::backend() + ", " + std::to_string(ms) + " ms).");
+            }
+            if (cfg.common.zeroPieces && sw.pieces->isComplete()) {
+                // Seeding: find the all-zero pieces nobody needs to download.
+                t0 = std::chrono::steady_clock::now();
+                size_t zeros = sw.pieces->scanZeroPieces();
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+                logger.info(sw.fileName + ": " + std::to_string(zeros) + " of " + std::to_string(sw.pieces->dataPieceCount()) +
+                            " pieces are all zeros (" + p2p::allZeroBackend() + ", " + std::to_string(ms) + " ms).");
+            }
+            if (cfg.common.directIO && !sw.pieces->directIO()) {
+                logger.info("DirectIO not supported for " + sw.fileName + "; using buffered writes.");
+            }
+        }
+
+        // Wire recording for later replay (tools/p2preplay)
+        if (!cfg.common.recordTo.empty()) {
+            std::filesystem::path dir = cfg.common.recordTo;
+            if (dir.is_relative()) dir = std::filesystem::path(cfg.paths.workDir) / dir;
+            std::filesystem::create_directories(dir);
+            std::vector<p2p::Recorder::SwarmInfo> infos{{0, cfg.common.fileSizeBytes, cfg.common.pieceSizeBytes}};
+            for (const auto& row : cfg.swarms.rows) infos.push_back({row.swarmId, row.fileSizeBytes, row.pieceSizeBytes});
+            auto path = (dir / ("record_" + std::to_string(selfId) + ".p2prec")).string();
+            p2p::gRecorder.open(path, selfId, cfg.common.recordPayloads, infos);
+            logger.info("Recording connections to " + path + ".");
+        }
+
+        // Streaming mode: hand swarm 0's file over in order while it downloads.
+        std::unique_ptr<p2p::StreamSink> stream;
+        if (!cfg.common.streamTo.empty()) {
+            stream = std::make_unique<p2p::StreamSink>(logger, pieceMgr,
+                                                       p2p::StreamSink::toPath(cfg.common.streamTo),
+                                                       static_cast<size_t>(std::max(1, cfg.common.streamWindow)));
+            stream->start();
+        }
+
+        // Networking options shared by every connection
+        p2p::gNetOptions.compressPieces = cfg.common.compressPieces;
+        p2p::gNetOptions.sendQueueBytes = static_cast<size_t>(std::max(1, cfg.common.sendQueueKB)) * 1024;
+        p2p::gNetOptions.pex = cfg.common.pexIntervalSec > 0;
+        p2p::gNetOptions.listenPort = cfg.self.port;
+        p2p::gNetOptions.keepAliveSec = cfg.common.keepAliveSec;
+        p2p::gNetOptions.deadPeerSec = cfg.common.deadPeerSec;
+        p2p::gNetOptions.localTransport = cfg.common.localTransport;
+        p2p::gNetOptions.zeroPieces = cfg.common.zeroPieces;
+        for (const auto& [peer, via] : cfg.common.udpRoutes) {
+            auto colon = via.rfind(':');
+            if (colon == std::string::npos) throw std::runtime_error("UdpRoute wants host:port, got " + via);
+            p2p::gNetOptions.udpRoutes[peer] = Endpoint{via.substr(0, colon), std::stoi(via.substr(colon + 1))};
+        }
+        for (const auto& [peer, via] : cfg.common.tcpRoutes) {
+            auto colon = via.rfind(':');
+            if (colon == std::string::npos) throw std::runtime_error("TcpRoute wants host:port, got " + via);
+            p2p::gNetOptions.tcpRoutes[peer] = Endpoint{via.substr(0, colon), std::stoi(via.substr(colon + 1))};
+        }
+        p2p::gUploadBudget.setRate(cfg.common.maxUploadRate);
+
+        // Disk reads/writes and piece compression, shared by all connections
+        p2p::gWorkPool.start(static_cast<size_t>(std::max(0, cfg.common.workerThreads)));
+
+        // One timer thread for every periodic and per-connection timer
+        p2p::gTimers.start();
+
+    #if defined(P2P_PROFILE)
+        if (cfg.common.profileSampleHz > 0) {
+            if (p2p::startProfileSampling(cfg.common.profileSampleHz)) {
+                p2p::gTimers.every(std::chrono::seconds(1), []{ p2p::collectProfileSamples(); });
+            } else {
+                logger.error("Can't start CPU sampling; scope timers only.");
+            }
+        }
+    #endif
+
+    #if defined(P2P_LOCK_STATS) || defined(P2P_PROFILE)
+        // Reports next to the log: lock_stats_<peerId>.txt, and profile_<peerId>.folded /
+        // samples_<peerId>.folded for flamegraph.pl.
+        auto reportPath = [&](const std::string& stem, const char* ext){
+            return (std::filesystem::path(cfg.paths.logFile).parent_path() /
+                    (stem + "_" + std::to_string(selfId) + ext)).string();
+        };
+        std::signal(SIGUSR1, onReportSignal);
+        std::signal(SIGINT, onReportSignal);
+        std::signal(SIGTERM, onReportSignal);
+        p2p::gTimers.every(std::chrono::milliseconds(100), [&, reportPath]{
+            int sig = gReportSignal;
+            if (!sig) return;
+            gReportSignal = 0;
+        #if defined(P2P_LOCK_STATS)
+            std::ofstream(reportPath("lock_stats", ".txt"), std::ios::trunc) << p2p::lockStatsReport();
+        #endif
+        #if defined(P2P_PROFILE)
+            std::ofstream(reportPath("profile", ".folded"), std::ios::trunc) << p2p::profileCollapsed();
+            if (cfg.common.profileSampleHz > 0) {
+                std::ofstream(reportPath("samples", ".folded"), std::ios::trunc) << p2p::profileSamples();
+            }
+        #endif
+            logger.info("Diagnostic reports written next to " + cfg.paths.logFile + ".");
+            if (sig != SIGUSR1) {
+                std::signal(sig, SIG_DFL);
+                std::raise(sig);
+            }
+        });
+    #endif
 
-        // Make it globally visible to all connections
-        p2p::gPieceManager = pieceMgr;
+        if (delta->wantManifest()) {
+            logger.info("Updating from " + delta->oldPath() + ": requests wait for a peer's manifest.");
+            if (cfg.common.deltaWaitSec > 0) {
+                p2p::gTimers.after(std::chrono::seconds(cfg.common.deltaWaitSec), [delta, &logger]{
+                    if (delta->giveUp()) logger.info("No manifest came; downloading the whole file.");
+                });
+            }
+        }
+
+        // Peers on this machine move their connections here (LocalTransport.hpp)
+        if (p2p::gNetOptions.localTransport) {
+            try {
+                p2p::gLocalListener.start(selfId);
+                logger.info("Local transport listening on " + p2p::gLocalListener.address() + ".");
+            } catch (const std::exception& e) {
+                logger.error(std::string(e.what()) + "; same-host peers stay on TCP.");
+            }
+        }
 
-        // Build initial BITFIELD bytes from PieceManager
-        auto bitfieldBytes = pieceMgr->toBitfieldBytes();
+        // UDP with LEDBAT, on the same port number as the TCP listener
+        if (cfg.common.udpTransport) {
+            try {
+                p2p::gUdpMux.start(cfg.self.port, cfg.common.ledbatTargetMs);
+                p2p::gNetOptions.udpTransport = true;
+                logger.info("UDP transport on port " + std::to_string(cfg.self.port) + ", LEDBAT target " +
+                            std::to_string(cfg.common.ledbatTargetMs) + " ms.");
+            } catch (const std::exception& e) {
+                logger.error(std::string(e.what()) + "; staying on TCP.");
+            }
+        }
 
         /*
         // Bitfield setup
@@ -69,16 +283,74 @@ int main(int argc, char** argv){
         auto bitfieldBytes = myBits.toBytes();
         */
 
-        PeerServer server(selfId, logger, cfg.self.port, bitfieldBytes);
+        // Owns every connection, incoming and outgoing
+        ConnectionLimits limits;
+        limits.maxConnections = static_cast<size_t>(std::max(1, cfg.common.maxConnections));
+        limits.idleTimeoutSec = cfg.common.idleTimeoutSec;
+        ConnectionManager conns(selfId, logger, limits);
 
-        server.start();
+        PeerServer server(selfId, logger, cfg.self.port, conns);
 
-        // Connect to earlier peers
-        std::vector<std::unique_ptr<ConnectionHandler>> conns;
-        for (const auto& r : cfg.peers.earlierPeers(selfId)){
-            Endpoint ep{r.host, r.port};
-            auto h = PeerClient::connect(selfId, logger, ep, bitfieldBytes);
-            if (h){ logger.onConnectOut(selfId, r.peerId); conns.push_back(std::move(h)); }
+        // Connect to earlier peers, once per swarm. All connects run in parallel;
+        // handlers are created as each one comes up.
+
+        ConnectOptions copts;
+        copts.timeoutMs = cfg.common.connectTimeoutMs;
+        copts.maxRetries = cfg.common.connectRetries;
+        copts.backoffMs = cfg.common.connectBackoffMs;
+        copts.backoffMaxMs = cfg.common.connectBackoffMaxMs;
+
+        Connector connector(logger, copts, [&](socket_t s, const Connector::Target& t){
+            auto h = std::make_unique<ConnectionHandler>(selfId, logger, s, /*incoming=*/false, t.swarmId);
+            if (conns.adopt(std::move(h))) logger.onConnectOut(selfId, t.peerId);
+        });
+
+        // Full mesh (default): dial every earlier peer. Partial mesh (MaxNeighbors > 0):
+        // dial a bounded random subset and keep rotating the slowest one out.
+        std::unique_ptr<Topology> topology;
+        if (cfg.common.maxNeighbors > 0) {
+            topology = std::make_unique<Topology>(selfId, logger, conns, connector, cfg.peers.rows,
+                                                  static_cast<size_t>(cfg.common.maxNeighbors),
+                                                  cfg.common.neighborRefreshSec);
+        }
+
+        // Everyone in PeerInfo.cfg is known up front; gossip adds the rest. A peer we
+        // learn about is dialed by whichever side has the higher id (as with file
+        // order), or handed to the topology to pick from. Filled in before anything
+        // is listening or dialing, so an early PEX can't get in ahead of the file.
+        p2p::gPeerBook.setSelf(selfId);
+        for (const auto& r : cfg.peers.rows) p2p::gPeerBook.add(r);
+        p2p::gPeerBook.setOnNew([&](const PeerInfoRow& r){
+            if (topology) {
+                topology->addCandidate(r);
+            } else if (r.peerId < selfId) {
+                for (const auto& sw : p2p::gSwarms.all()) {
+                    connector.add({r.peerId, Endpoint{r.host, r.port}, sw.id});
+                }
+            }
+        });
+
+        // Full mesh: an outgoing connection that broke (the remote restarted, the
+        // link was reset) is dialed again, with the connector's usual backoff if
+        // it doesn't come straight back. The topology tops itself up instead.
+        conns.setOnLost([&](int peerId, uint32_t swarmId){
+            if (topology) return;
+            auto r = p2p::gPeerBook.find(peerId);
+            if (!r) return;
+            logger.info("Lost the connection to peer " + std::to_string(peerId) + "; dialing it again.");
+            connector.add({peerId, Endpoint{r->host, r->port}, swarmId});
+        });
+
+        server.start();
+        connector.start();
+        if (topology) {
+            topology->start();
+        } else {
+            for (const auto& r : cfg.peers.earlierPeers(selfId)){
+                for (const auto& sw : p2p::gSwarms.all()) {
+                    connector.add({r.peerId, Endpoint{r.host, r.port}, sw.id});
+                }
+            }
         }
 
         // Simple schedulers (midpoint: just log ticks)
@@ -88,16 +360,37 @@ int main(int argc, char** argv){
         RepeatingTask optimisticTick(cfg.common.optimisticUnchokingIntervalSec, [&]{
             logger.info("[tick] optimistic unchoke reselection (stub)");
         });
-        preferredTick.start(); optimisticTick.start();
+        RepeatingTask reapTick(5, [&]{
+            conns.reap();
+            conns.forEach([](ConnectionHandler& h){ h.superSeedTick(); });
+        });
+        RepeatingTask topologyTick(std::max(1, cfg.common.neighborRefreshSec), [&]{
+            if (topology) topology->refresh();
+        });
+        RepeatingTask pexTick(std::max(1, cfg.common.pexIntervalSec), [&]{
+            conns.forEach([](ConnectionHandler& h){ h.sendPex(); });
+        });
+        RepeatingTask recordTick(1, []{ p2p::gRecorder.flush(); });
+        preferredTick.start(); optimisticTick.start(); reapTick.start();
+        if (topology) topologyTick.start();
+        if (cfg.common.pexIntervalSec > 0) pexTick.start();
+        if (p2p::gRecorder.enabled()) recordTick.start();
 
         // Keep main thread alive until Ctrl-C
         logger.info("peerProcess running. Press Ctrl-C to exit.");
         for(;;) std::this_thread::sleep_for(std::chrono::seconds(60));
 
         // Cleanup (unreachable in this simple loop)
-        preferredTick.stop(); optimisticTick.stop();
+        preferredTick.stop(); optimisticTick.stop(); reapTick.stop(); topologyTick.stop(); pexTick.stop(); recordTick.stop();
+        p2p::gTimers.stop();
+        p2p::gLocalListener.stop();
+        p2p::gUdpMux.stop();
+        connector.stop();
         server.stop();
-        for (auto& h: conns) if (h) h->join();
+        conns.closeAll();
+        p2p::gWorkPool.stop(); // after the connections: their tasks may still be queued
+        if (stream) stream->stop();
+        p2p::gRecorder.close();
         return 0;
     } catch (const std::exception& ex) {
         std::cerr << "Fatal: " << ex.what() << "\n";
@@ -0,0 +1,105 @@
+// p2pecbench: what erasure-coded pieces (ErasureParity in Common.cfg) cost in CPU.
+//
+//   p2pecbench [k] [m] [blockKB] [--seconds S]
+//
+// For every GF(256) kernel this CPU has, times the raw multiply-accumulate,
+// encoding m parity blocks from k data blocks, and rebuilding a stripe that
+// lost m data blocks (the worst case), and checks the rebuilt bytes. Rates
+// are data bytes per second, i.e. how fast a file of that size gets encoded
+// or repaired on one core.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "p2p/ErasureCode.hpp"
+
+using namespace p2p;
+
+namespace {
+
+    // Runs fn until `seconds` have passed; returns calls per second.
+    double rate(double seconds, const std::function<void()>& fn){
+        using clock = std::chrono::steady_clock;
+        fn(); // warm up
+        auto start = clock::now();
+        long calls = 0;
+        double elapsed = 0;
+        do {
+            fn();
+            ++calls;
+            elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        } while (elapsed < seconds);
+        return static_cast<double>(calls) / elapsed;
+    }
+
+} // namespace
+
+int main(int argc, char** argv){
+    try {
+        int k = 16, m = 4;
+        size_t block = 256u << 10;
+        double seconds = 1.0;
+        int pos = 0;
+        for (int i = 1; i < argc; ++i) {
+            std::string a = argv[i];
+            if (a == "--seconds" && i + 1 < argc) { seconds = std::stod(argv[++i]); continue; }
+            if (pos == 0) k = std::stoi(a);
+            else if (pos == 1) m = std::stoi(a);
+            else if (pos == 2) block = static_cast<size_t>(std::stoi(a)) << 10;
+            else throw std::runtime_error("Unexpected argument " + a);
+            ++pos;
+        }
+        ReedSolomon rs(k, m);
+
+        std::mt19937 rng(42);
+        std::vector<std::vector<uint8_t>> blocks(static_cast<size_t>(k + m), std::vector<uint8_t>(block));
+        for (int i = 0; i < k; ++i) {
+            for (auto& b : blocks[i]) b = static_cast<uint8_t>(rng());
+        }
+        std::vector<uint8_t*> ptrs;
+        for (auto& b : blocks) ptrs.push_back(b.data());
+        auto original = blocks;
+        double stripeMB = static_cast<double>(block) * k / (1 << 20);
+
+        std::printf("k=%d m=%d block=%zu KB (stripe %.1f MB, %.0f%% overhead)\n",
+                    k, m, block >> 10, stripeMB, 100.0 * m / k);
+        std::printf("%-8s %14s %14s %14s\n", "kernel", "mulAdd MB/s", "encode MB/s", "rebuild MB/s");
+
+        for (const char* name : gf256::backends()) {
+            gf256::useBackend(name);
+
+            std::vector<uint8_t> acc(block);
+            double madd = rate(seconds, [&]{ gf256::mulAdd(acc.data(), blocks[0].data(), 0x57, block); });
+
+            double enc = rate(seconds, [&]{ rs.encode(ptrs.data(), k, ptrs.data() + k, block); });
+
+            // Lose the first m data blocks; the rebuild has to use every parity row.
+            std::vector<uint8_t> present(static_cast<size_t>(k + m), 1);
+            int lose = std::min(k, m);
+            for (int i = 0; i < lose; ++i) present[i] = 0;
+            bool ok = true;
+            double dec = rate(seconds, [&]{
+                for (int i = 0; i < lose; ++i) std::memset(ptrs[i], 0, block);
+                ok = rs.reconstruct(ptrs.data(), present.data(), k, block) && ok;
+            });
+            for (int i = 0; i < k; ++i) ok = ok && blocks[i] == original[i];
+
+            std::printf("%-8s %14.0f %14.0f %14.0f%s\n", name,
+                        madd * static_cast<double>(block) / (1 << 20),
+                        enc * stripeMB, dec * stripeMB, ok ? "" : "   MISMATCH");
+            if (!ok) return 1;
+        }
+        return 0;
+    } catch (const std::exception& ex) {
+        std::cerr << "Fatal: " << ex.what() << "\n";
+        return 2;
+    }
+}
@@ -0,0 +1,492 @@
+// p2pfault: a TCP proxy that makes a loopback link misbehave, for testing
+// peerProcess's pipelining, timeouts and reconnects without root or netem.
+//
+//   p2pfault <listenPort> <targetHost:port> [--delay MS] [--jitter MS] [--rate KB/s]
+//            [--queue KB] [--stall-every SEC] [--stall-for MS] [--drop-every SEC]
+//            [--drop-after KB] [--seed N] [--stats SEC] [--script FILE]
+//
+// Every connection to listenPort is a link to the target, and each direction
+// of it gets its own bottleneck: bytes leave at --rate after --delay (+-
+// --jitter, never reordered). Past --queue bytes held the proxy stops
+// reading, so TCP flow control pushes back on the sender as a slow link
+// would. Faults, per link:
+//   --stall-every SEC  freeze both directions for --stall-for MS, on average
+//                      this often (exponential gaps)
+//   --drop-every SEC   reset the link (RST to both ends), on average this often
+//   --drop-after KB    reset it once this much has gone through
+//
+// Point a dialing peer at it with "TcpRoute <peerId> 127.0.0.1:<listenPort>"
+// in Common.cfg. Settings can change while it runs. Each line on stdin is one
+// command, applied at once; with --script FILE, each line is "<sec> <command>",
+// applied that many seconds after start:
+//   delay MS | jitter MS | rate KB/s | queue KB | stall-every SEC | stall-for MS
+//   drop-every SEC | drop-after KB   same as the options (0 turns a fault off)
+//   stall MS                          freeze every open link now
+//   cut                               reset every open link now
+//   refuse 1|0                        reset new connections as they come in (peer down)
+// Every --stats seconds it prints each link's throughput and queue.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+    int64_t nowUs(){
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    struct Options {
+        int64_t delayUs = 0, jitterUs = 0;
+        double rate = 0;             // bytes/s, 0 = unlimited
+        size_t queue = 256u << 10;   // bytes held per direction before we stop reading
+        double stallEverySec = 0;    // 0 = no stalls
+        int64_t stallForUs = 500000;
+        double dropEverySec = 0;     // 0 = no random resets
+        uint64_t dropAfterBytes = 0; // 0 = no reset after a byte count
+        int statsSec = 1;
+        bool refuse = false;
+    };
+
+    struct Chunk {
+        int64_t dueUs;
+        std::vector<uint8_t> data;
+        size_t off = 0;
+    };
+
+    // One direction of a link: read from `from`, hold, write to `to`.
+    struct Direction {
+        int from = -1, to = -1;
+        std::deque<Chunk> q;
+        size_t held = 0;
+        int64_t freeAtUs = 0;  // when the bottleneck is done with what's queued
+        int64_t lastDueUs = 0; // TCP doesn't reorder, so neither does jitter
+        bool eof = false;      // `from` is done; pass the FIN on once drained
+        bool finSent = false;
+        bool blocked = false;  // last write hit EAGAIN
+        uint64_t bytes = 0;    // forwarded since the last stats line
+        uint64_t total = 0;
+    };
+
+    struct Link {
+        int id = 0;
+        int client = -1, server = -1;
+        Direction up, down; // client -> server, server -> client
+        int64_t stallUntilUs = 0, nextStallUs = 0, dropAtUs = 0;
+        int stalls = 0;
+        int64_t connectingUntilUs = 0; // nonzero while connect() to the target is in progress
+    };
+
+    // A target that doesn't answer a SYN shouldn't hold a dialer forever.
+    constexpr int64_t CONNECT_TIMEOUT_US = 5000000;
+
+    void setNonBlocking(int fd){
+        int fl = ::fcntl(fd, F_GETFL, 0);
+        ::fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+    }
+
+    // Close with RST instead of FIN: what a crashed peer or a dropped NAT entry looks like.
+    void reset(int fd){
+        if (fd < 0) return;
+        linger l{1, 0};
+        ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+        ::close(fd);
+    }
+
+    class Fault {
+    public:
+        Fault(const Options& o, int listenFd, sockaddr_in target, uint64_t seed)
+        : opt_(o), listen_(listenFd), target_(target), rng_(seed) {}
+
+        void addScript(double atSec, const std::string& cmd){ script_.push_back({atSec, cmd}); }
+        void run();
+
+    private:
+        Options opt_;
+        int listen_;
+        sockaddr_in target_;
+        std::mt19937_64 rng_;
+        std::map<int, std::unique_ptr<Link>> links_;
+        int nextId_ = 1;
+        int64_t startUs_ = nowUs();
+        std::vector<std::pair<double, std::string>> script_;
+        size_t scriptAt_ = 0;
+        std::string stdinBuf_;
+        bool stdinOpen_ = true;
+
+        int64_t expGapUs_(double meanSec){
+            std::exponential_distribution<double> e(1.0 / meanSec);
+            return static_cast<int64_t>(e(rng_) * 1e6);
+        }
+        void armFaults_(Link& l, int64_t now);
+        void accept_();
+        void connected_(Link& l);
+        void read_(Link& l, Direction& d, int64_t now);
+        bool write_(Direction& d, int64_t now, int64_t stallUntil);
+        void drop_(Link& l, const char* why);
+        void command_(const std::string& line);
+        void readStdin_();
+        void printStats_(double secs);
+    };
+
+    void Fault::armFaults_(Link& l, int64_t now){
+        l.nextStallUs = opt_.stallEverySec > 0 ? now + expGapUs_(opt_.stallEverySec) : 0;
+        l.dropAtUs = opt_.dropEverySec > 0 ? now + expGapUs_(opt_.dropEverySec) : 0;
+    }
+
+    // The connect to the target is non-blocking and finishes in the poll loop
+    // (connected_), so a slow target doesn't hold up the other links.
+    void Fault::accept_(){
+        for (;;) {
+            int c = ::accept(listen_, nullptr, nullptr);
+            if (c < 0) return;
+            if (opt_.refuse) { reset(c); continue; }
+            int s = ::socket(AF_INET, SOCK_STREAM, 0);
+            int one = 1;
+            if (s >= 0) {
+                ::setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                setNonBlocking(s);
+            }
+            int r = s < 0 ? -1 : ::connect(s, reinterpret_cast<const sockaddr*>(&target_), sizeof(target_));
+            if (r != 0 && (s < 0 || errno != EINPROGRESS)) {
+                // Target not up: the dialer sees its connection reset, as it would have.
+                if (s >= 0) ::close(s);
+                reset(c);
+                continue;
+            }
+            ::setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            setNonBlocking(c);
+            auto l = std::make_unique<Link>();
+            l->id = nextId_++;
+            l->client = c;
+            l->server = s;
+            l->up.from = c; l->up.to = s;
+            l->down.from = s; l->down.to = c;
+            Link& ref = *l;
+            links_[l->id] = std::move(l);
+            if (r == 0) connected_(ref);
+            else ref.connectingUntilUs = nowUs() + CONNECT_TIMEOUT_US;
+        }
+    }
+
+    void Fault::connected_(Link& l){
+        l.connectingUntilUs = 0;
+        armFaults_(l, nowUs());
+        std::printf("link %d: open\n", l.id);
+        std::fflush(stdout);
+    }
+
+    // Bytes join the queue behind what's already there, leave the bottleneck at
+    // --rate, then take --delay (+- jitter) to arrive.
+    void Fault::read_(Link&, Direction& d, int64_t now){
+        // Small reads when rate-limited, so one read isn't one big burst.
+        size_t want = opt_.rate > 0 ? std::clamp<size_t>(static_cast<size_t>(opt_.rate / 100), 1024, 65536) : 65536;
+        want = std::min(want, opt_.queue > d.held ? opt_.queue - d.held : 0);
+        if (want == 0) return;
+        std::vector<uint8_t> buf(want);
+        ssize_t n = ::recv(d.from, buf.data(), buf.size(), 0);
+        if (n == 0) { d.eof = true; return; }
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) d.eof = true;
+            return;
+        }
+        buf.resize(static_cast<size_t>(n));
+        int64_t start = std::max(now, d.freeAtUs);
+        int64_t txUs = opt_.rate > 0 ? static_cast<int64_t>(static_cast<double>(n) * 1e6 / opt_.rate) : 0;
+        d.freeAtUs = start + txUs;
+        std::uniform_real_distribution<double> u(-1, 1);
+        int64_t jitter = opt_.jitterUs ? static_cast<int64_t>(u(rng_) * static_cast<double>(opt_.jitterUs)) : 0;
+        int64_t due = std::max(d.lastDueUs, start + txUs + std::max<int64_t>(0, opt_.delayUs + jitter));
+        d.lastDueUs = due;
+        d.held += buf.size();
+        d.q.push_back({due, std::move(buf)});
+    }
+
+    // Send whatever is due. False if the other end is gone.
+    bool Fault::write_(Direction& d, int64_t now, int64_t stallUntil){
+        d.blocked = false;
+        while (!d.q.empty() && d.q.front().dueUs <= now && now >= stallUntil) {
+            Chunk& c = d.q.front();
+            ssize_t n = ::send(d.to, c.data.data() + c.off, c.data.size() - c.off, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) { d.blocked = true; return true; }
+                return false;
+            }
+            c.off += static_cast<size_t>(n);
+            d.bytes += static_cast<uint64_t>(n);
+            d.total += static_cast<uint64_t>(n);
+            if (c.off == c.data.size()) {
+                d.held -= c.data.size();
+                d.q.pop_front();
+            }
+        }
+        if (d.eof && d.q.empty() && !d.finSent) {
+            ::shutdown(d.to, SHUT_WR);
+            d.finSent = true;
+        }
+        return true;
+    }
+
+    void Fault::drop_(Link& l, const char* why){
+        std::printf("link %d: reset (%s) after %.1f KB up, %.1f KB down\n", l.id, why,
+                    static_cast<double>(l.up.total) / 1024, static_cast<double>(l.down.total) / 1024);
+        std::fflush(stdout);
+        reset(l.client);
+        reset(l.server);
+        l.client = l.server = -1;
+    }
+
+    void Fault::command_(const std::string& line){
+        std::istringstream in(line);
+        std::string cmd;
+        double v = 0;
+        if (!(in >> cmd) || cmd[0] == '#') return;
+        in >> v;
+        int64_t now = nowUs();
+        if (cmd == "delay") opt_.delayUs = static_cast<int64_t>(v * 1000);
+        else if (cmd == "jitter") opt_.jitterUs = static_cast<int64_t>(v * 1000);
+        else if (cmd == "rate") opt_.rate = v * 1024;
+        else if (cmd == "queue") opt_.queue = static_cast<size_t>(v * 1024);
+        else if (cmd == "stall-for") opt_.stallForUs = static_cast<int64_t>(v * 1000);
+        else if (cmd == "drop-after") opt_.dropAfterBytes = static_cast<uint64_t>(v * 1024);
+        else if (cmd == "stall-every" || cmd == "drop-every") {
+            (cmd == "stall-every" ? opt_.stallEverySec : opt_.dropEverySec) = v;
+            for (auto& [id, l] : links_) armFaults_(*l, now);
+        } else if (cmd == "stall") {
+            for (auto& [id, l] : links_) { l->stallUntilUs = now + static_cast<int64_t>(v * 1000); ++l->stalls; }
+        } else if (cmd == "cut") {
+            for (auto& [id, l] : links_) drop_(*l, "cut");
+        } else if (cmd == "refuse") {
+            opt_.refuse = v != 0;
+        } else {
+            std::fprintf(stderr, "p2pfault: unknown command '%s'\n", cmd.c_str());
+            return;
+        }
+        std::printf("> %s\n", line.c_str());
+        std::fflush(stdout);
+    }
+
+    void Fault::readStdin_(){
+        char buf[4096];
+        ssize_t n = ::read(0, buf, sizeof(buf));
+        if (n <= 0) { stdinOpen_ = false; return; }
+        stdinBuf_.append(buf, static_cast<size_t>(n));
+        for (size_t nl; (nl = stdinBuf_.find('\n')) != std::string::npos; ) {
+            command_(stdinBuf_.substr(0, nl));
+            stdinBuf_.erase(0, nl + 1);
+        }
+    }
+
+    void Fault::printStats_(double secs){
+        for (auto& [id, l] : links_) {
+            std::printf("link %-3d up %8.1f KB/s held %6.1f KB   down %8.1f KB/s held %6.1f KB   stalls %d\n", id,
+                        static_cast<double>(l->up.bytes) / 1024 / secs, static_cast<double>(l->up.held) / 1024,
+                        static_cast<double>(l->down.bytes) / 1024 / secs, static_cast<double>(l->down.held) / 1024,
+                        l->stalls);
+            l->up.bytes = l->down.bytes = 0;
+        }
+        std::fflush(stdout);
+    }
+
+    void Fault::run(){
+        std::sort(script_.begin(), script_.end(),
+                  [](const auto& a, const auto& b){ return a.first < b.first; });
+        int64_t statsAt = nowUs();
+        for (;;) {
+            int64_t now = nowUs();
+            while (scriptAt_ < script_.size() && now - startUs_ >= static_cast<int64_t>(script_[scriptAt_].first * 1e6)) {
+                command_(script_[scriptAt_++].second);
+            }
+
+            // Faults that are due, and finished links.
+            for (auto it = links_.begin(); it != links_.end();) {
+                Link& l = *it->second;
+                if (l.client >= 0 && l.nextStallUs && now >= l.nextStallUs) {
+                    l.stallUntilUs = now + opt_.stallForUs;
+                    l.nextStallUs = now + opt_.stallForUs + expGapUs_(opt_.stallEverySec);
+                    ++l.stalls;
+                }
+                if (l.client >= 0 && l.dropAtUs && now >= l.dropAtUs) drop_(l, "drop-every");
+                if (l.client >= 0 && opt_.dropAfterBytes && l.up.total + l.down.total >= opt_.dropAfterBytes) {
+                    drop_(l, "drop-after");
+                }
+                bool done = l.client < 0 || (l.up.finSent && l.down.finSent);
+                if (done) {
+                    if (l.client >= 0) {
+                        std::printf("link %d: closed\n", l.id);
+                        ::close(l.client);
+                        ::close(l.server);
+                    }
+                    it = links_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            // Wake for the next due chunk, stall end, fault or script line; at most 100 ms.
+            int64_t wake = now + 100000;
+            if (scriptAt_ < script_.size()) wake = std::min(wake, startUs_ + static_cast<int64_t>(script_[scriptAt_].first * 1e6));
+            std::vector<pollfd> fds{{listen_, POLLIN, 0}};
+            if (stdinOpen_) fds.push_back({0, POLLIN, 0});
+            std::vector<std::pair<Link*, Direction*>> owners;
+            for (auto& [id, l] : links_) {
+                if (l->connectingUntilUs) {
+                    // Nothing moves until the target answers; the client's bytes wait in its socket.
+                    fds.push_back({l->server, POLLOUT, 0});
+                    owners.push_back({l.get(), nullptr});
+                    wake = std::min(wake, l->connectingUntilUs);
+                    continue;
+                }
+                if (l->nextStallUs) wake = std::min(wake, l->nextStallUs);
+                if (l->dropAtUs) wake = std::min(wake, l->dropAtUs);
+                for (Direction* d : {&l->up, &l->down}) {
+                    short ev = 0;
+                    if (!d->eof && d->held < opt_.queue) ev |= POLLIN;
+                    if (!d->q.empty()) {
+                        int64_t due = std::max(d->q.front().dueUs, l->stallUntilUs);
+                        if (due <= now && d->blocked) ev |= POLLOUT;
+                        else if (due > now) wake = std::min(wake, due);
+                    }
+                    // Both directions share the sockets, so one pollfd per direction and event.
+                    if (ev & POLLIN) { fds.push_back({d->from, POLLIN, 0}); owners.push_back({l.get(), d}); }
+                    if (ev & POLLOUT) { fds.push_back({d->to, POLLOUT, 0}); owners.push_back({l.get(), d}); }
+                }
+            }
+            int timeoutMs = static_cast<int>(std::clamp<int64_t>((wake - now + 999) / 1000, 0, 100));
+            ::poll(fds.data(), fds.size(), timeoutMs);
+
+            now = nowUs();
+            if (fds[0].revents & POLLIN) accept_();
+            size_t base = stdinOpen_ ? 2 : 1;
+            if (stdinOpen_ && (fds[1].revents & (POLLIN | POLLHUP))) readStdin_();
+            for (size_t i = base; i < fds.size(); ++i) {
+                auto [l, d] = owners[i - base];
+                if (l->client < 0) continue;
+                if (!d) {
+                    int err = 0;
+                    socklen_t len = sizeof(err);
+                    if (fds[i].revents) ::getsockopt(l->server, SOL_SOCKET, SO_ERROR, &err, &len);
+                    if (fds[i].revents && err == 0) connected_(*l);
+                    else if (fds[i].revents || now >= l->connectingUntilUs) drop_(*l, err ? std::strerror(err) : "connect timed out");
+                    continue;
+                }
+                if (fds[i].events == POLLIN && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) read_(*l, *d, now);
+            }
+            for (auto& [id, l] : links_) {
+                if (l->client < 0 || l->connectingUntilUs) continue;
+                if (!write_(l->up, now, l->stallUntilUs) || !write_(l->down, now, l->stallUntilUs)) {
+                    drop_(*l, "peer went away");
+                }
+            }
+
+            if (opt_.statsSec > 0 && now - statsAt >= opt_.statsSec * 1000000LL) {
+                printStats_(static_cast<double>(now - statsAt) / 1e6);
+                statsAt = now;
+            }
+        }
+    }
+
+} // namespace
+
+int main(int argc, char** argv){
+    if (argc < 3) {
+        std::cerr << "Usage: p2pfault <listenPort> <targetHost:port> [--delay MS] [--jitter MS] [--rate KB/s]\n"
+                     "                [--queue KB] [--stall-every SEC] [--stall-for MS] [--drop-every SEC]\n"
+                     "                [--drop-after KB] [--seed N] [--stats SEC] [--script FILE]\n";
+        return 1;
+    }
+    try {
+        int listenPort = std::stoi(argv[1]);
+        std::string target = argv[2];
+        Options o;
+        uint64_t seed = std::random_device{}();
+        std::string script;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            std::string a = argv[i];
+            if (a == "--script") { script = argv[i + 1]; continue; }
+            double v = std::stod(argv[i + 1]);
+            if (a == "--delay") o.delayUs = static_cast<int64_t>(v * 1000);
+            else if (a == "--jitter") o.jitterUs = static_cast<int64_t>(v * 1000);
+            else if (a == "--rate") o.rate = v * 1024;
+            else if (a == "--queue") o.queue = static_cast<size_t>(v * 1024);
+            else if (a == "--stall-every") o.stallEverySec = v;
+            else if (a == "--stall-for") o.stallForUs = static_cast<int64_t>(v * 1000);
+            else if (a == "--drop-every") o.dropEverySec = v;
+            else if (a == "--drop-after") o.dropAfterBytes = static_cast<uint64_t>(v * 1024);
+            else if (a == "--seed") seed = static_cast<uint64_t>(v);
+            else if (a == "--stats") o.statsSec = static_cast<int>(v);
+            else throw std::runtime_error("Unknown option " + a);
+        }
+        if (o.queue == 0) throw std::runtime_error("--queue must be at least 1 KB");
+
+        auto colon = target.rfind(':');
+        if (colon == std::string::npos) throw std::runtime_error("Target wants host:port");
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res = nullptr;
+        if (::getaddrinfo(target.substr(0, colon).c_str(), target.substr(colon + 1).c_str(), &hints, &res) != 0) {
+            throw std::runtime_error("Cannot resolve " + target);
+        }
+        sockaddr_in to{};
+        std::memcpy(&to, res->ai_addr, sizeof(to));
+        ::freeaddrinfo(res);
+
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        if (fd >= 0) ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_addr.s_addr = htonl(INADDR_ANY);
+        a.sin_port = htons(static_cast<uint16_t>(listenPort));
+        if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&a), sizeof(a)) != 0 || ::listen(fd, 64) != 0) {
+            throw std::runtime_error("Cannot listen on TCP port " + std::to_string(listenPort));
+        }
+        setNonBlocking(fd);
+
+        Fault f(o, fd, to, seed);
+        if (!script.empty()) {
+            std::ifstream in(script);
+            if (!in) throw std::runtime_error("Cannot open " + script);
+            std::string line;
+            while (std::getline(in, line)) {
+                std::istringstream ls(line);
+                double at;
+                if (line.empty() || line[0] == '#' || !(ls >> at)) continue;
+                std::string rest;
+                std::getline(ls >> std::ws, rest);
+                f.addScript(at, rest);
+            }
+        }
+
+        std::printf("Proxying TCP :%d -> %s\n", listenPort, target.c_str());
+        std::fflush(stdout);
+        f.run();
+        return 0;
+    } catch (const std::exception& ex) {
+        std::cerr << "Fatal: " << ex.what() << "\n";
+        return 2;
+    }
+}
@@ -0,0 +1,236 @@
+// p2pnetem: a UDP relay that behaves like a slow link, for trying the UDP
+// transport (UdpTransport in Common.cfg) on one machine.
+//
+//   p2pnetem <listenPort> <targetHost:port> [--delay MS] [--jitter MS] [--loss PCT]
+//            [--rate KB/s] [--queue KB] [--stats SEC]
+//
+// Datagrams to listenPort go to the target and replies come back, each way
+// through its own bottleneck: a drop-tail queue of --queue bytes drained at
+// --rate, then --delay (+- --jitter) of propagation, like netem + tbf. Point
+// a peer's UDP at it with "UdpRoute <peerId> 127.0.0.1:<listenPort>". Every
+// --stats seconds it prints what each direction saw, including how long
+// packets sat in the queue: that's the delay LEDBAT is supposed to keep low.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+    int64_t nowUs(){
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    struct Options {
+        int64_t delayUs = 0, jitterUs = 0;
+        double loss = 0;           // 0..1
+        double rate = 0;           // bytes/s, 0 = unlimited
+        size_t queue = 256u << 10; // bytes
+        int statsSec = 1;
+    };
+
+    // One direction of the link.
+    struct Link {
+        const char* name;
+        int64_t freeAtUs = 0;      // when the bottleneck finishes what's queued
+        uint64_t pkts = 0, bytes = 0, drops = 0;
+        double queuedUsSum = 0;
+        int64_t queuedUsMax = 0;
+    };
+
+    struct Pending {
+        int64_t dueUs;
+        int fd;
+        sockaddr_in to;
+        std::vector<uint8_t> data;
+        bool operator>(const Pending& o) const { return dueUs > o.dueUs; }
+    };
+
+    class Netem {
+    public:
+        Netem(const Options& o, int listenFd, sockaddr_in target)
+        : opt_(o), listen_(listenFd), target_(target) {}
+
+        void run();
+
+    private:
+        Options opt_;
+        int listen_;
+        sockaddr_in target_;
+        Link up_{"to target"}, down_{"from target"};
+        std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> inFlight_;
+        std::map<std::pair<uint32_t, uint16_t>, int> upstream_; // client -> its socket to the target
+        std::map<int, sockaddr_in> clientOf_;                   // and back
+        std::mt19937_64 rng_{std::random_device{}()};
+
+        int upstreamFor_(const sockaddr_in& client);
+        void enqueue_(Link& l, int fd, const sockaddr_in& to, const uint8_t* p, size_t n);
+        void printStats_(double secs);
+    };
+
+    int Netem::upstreamFor_(const sockaddr_in& client){
+        auto key = std::make_pair(client.sin_addr.s_addr, client.sin_port);
+        auto it = upstream_.find(key);
+        if (it != upstream_.end()) return it->second;
+        int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0) throw std::runtime_error("socket() failed");
+        int buf = 4 << 20;
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+        upstream_[key] = fd;
+        clientOf_[fd] = client;
+        return fd;
+    }
+
+    // Tail-drop if the queue is full, else leave after the queue drains to it,
+    // its own transmission time, and the propagation delay.
+    void Netem::enqueue_(Link& l, int fd, const sockaddr_in& to, const uint8_t* p, size_t n){
+        std::uniform_real_distribution<double> u(0, 1);
+        if (opt_.loss > 0 && u(rng_) < opt_.loss) { ++l.drops; return; }
+        int64_t now = nowUs();
+        int64_t start = std::max(now, l.freeAtUs);
+        int64_t waited = start - now;
+        int64_t txUs = 0;
+        if (opt_.rate > 0) {
+            double backlog = static_cast<double>(waited) * opt_.rate / 1e6;
+            if (backlog + static_cast<double>(n) > static_cast<double>(opt_.queue)) { ++l.drops; return; }
+            txUs = static_cast<int64_t>(static_cast<double>(n) * 1e6 / opt_.rate);
+        }
+        l.freeAtUs = start + txUs;
+        int64_t jitter = opt_.jitterUs ? static_cast<int64_t>((u(rng_) * 2 - 1) * static_cast<double>(opt_.jitterUs)) : 0;
+        int64_t due = start + txUs + std::max<int64_t>(0, opt_.delayUs + jitter);
+        inFlight_.push({due, fd, to, std::vector<uint8_t>(p, p + n)});
+        ++l.pkts;
+        l.bytes += n;
+        l.queuedUsSum += static_cast<double>(waited);
+        l.queuedUsMax = std::max(l.queuedUsMax, waited);
+    }
+
+    void Netem::printStats_(double secs){
+        for (Link* l : {&up_, &down_}) {
+            if (!l->pkts && !l->drops) continue;
+            std::printf("%-12s %7.1f KB/s  %6llu pkts  %5llu drops  queue avg %6.1f ms  max %6.1f ms\n",
+                        l->name, static_cast<double>(l->bytes) / 1024 / secs,
+                        (unsigned long long)l->pkts, (unsigned long long)l->drops,
+                        l->pkts ? l->queuedUsSum / static_cast<double>(l->pkts) / 1000 : 0.0,
+                        static_cast<double>(l->queuedUsMax) / 1000);
+            *l = Link{l->name, l->freeAtUs};
+        }
+        std::fflush(stdout);
+    }
+
+    void Netem::run(){
+        std::vector<uint8_t> buf(65536);
+        int64_t statsAt = nowUs();
+        for (;;) {
+            std::vector<pollfd> fds{{listen_, POLLIN, 0}};
+            for (const auto& [fd, c] : clientOf_) fds.push_back({fd, POLLIN, 0});
+
+            int timeoutMs = 100;
+            if (!inFlight_.empty()) {
+                int64_t left = inFlight_.top().dueUs - nowUs();
+                timeoutMs = static_cast<int>(std::clamp<int64_t>((left + 999) / 1000, 0, 100));
+            }
+            if (::poll(fds.data(), fds.size(), timeoutMs) > 0) {
+                for (const auto& pf : fds) {
+                    if (!(pf.revents & POLLIN)) continue;
+                    for (;;) {
+                        sockaddr_in from{};
+                        socklen_t len = sizeof(from);
+                        ssize_t n = ::recvfrom(pf.fd, buf.data(), buf.size(), MSG_DONTWAIT,
+                                               reinterpret_cast<sockaddr*>(&from), &len);
+                        if (n < 0) break;
+                        if (pf.fd == listen_) {
+                            enqueue_(up_, upstreamFor_(from), target_, buf.data(), static_cast<size_t>(n));
+                        } else {
+                            enqueue_(down_, listen_, clientOf_[pf.fd], buf.data(), static_cast<size_t>(n));
+                        }
+                    }
+                }
+            }
+
+            int64_t now = nowUs();
+            while (!inFlight_.empty() && inFlight_.top().dueUs <= now) {
+                const Pending& p = inFlight_.top();
+                ::sendto(p.fd, p.data.data(), p.data.size(), 0, reinterpret_cast<const sockaddr*>(&p.to), sizeof(p.to));
+                inFlight_.pop();
+            }
+            if (opt_.statsSec > 0 && now - statsAt >= opt_.statsSec * 1000000LL) {
+                printStats_(static_cast<double>(now - statsAt) / 1e6);
+                statsAt = now;
+            }
+        }
+    }
+
+} // namespace
+
+int main(int argc, char** argv){
+    if (argc < 3) {
+        std::cerr << "Usage: p2pnetem <listenPort> <targetHost:port> [--delay MS] [--jitter MS] [--loss PCT]\n"
+                     "                [--rate KB/s] [--queue KB] [--stats SEC]\n";
+        return 1;
+    }
+    try {
+        int listenPort = std::stoi(argv[1]);
+        std::string target = argv[2];
+        Options o;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            std::string a = argv[i];
+            double v = std::stod(argv[i + 1]);
+            if (a == "--delay") o.delayUs = static_cast<int64_t>(v * 1000);
+            else if (a == "--jitter") o.jitterUs = static_cast<int64_t>(v * 1000);
+            else if (a == "--loss") o.loss = v / 100;
+            else if (a == "--rate") o.rate = v * 1024;
+            else if (a == "--queue") o.queue = static_cast<size_t>(v * 1024);
+            else if (a == "--stats") o.statsSec = static_cast<int>(v);
+            else throw std::runtime_error("Unknown option " + a);
+        }
+
+        auto colon = target.rfind(':');
+        if (colon == std::string::npos) throw std::runtime_error("Target wants host:port");
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo* res = nullptr;
+        if (::getaddrinfo(target.substr(0, colon).c_str(), target.substr(colon + 1).c_str(), &hints, &res) != 0) {
+            throw std::runtime_error("Cannot resolve " + target);
+        }
+        sockaddr_in to{};
+        std::memcpy(&to, res->ai_addr, sizeof(to));
+        ::freeaddrinfo(res);
+
+        int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_addr.s_addr = htonl(INADDR_ANY);
+        a.sin_port = htons(static_cast<uint16_t>(listenPort));
+        if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&a), sizeof(a)) != 0) {
+            throw std::runtime_error("Cannot bind UDP port " + std::to_string(listenPort));
+        }
+        int buf = 4 << 20;
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+
+        std::printf("Relaying UDP :%d -> %s\n", listenPort, target.c_str());
+        std::fflush(stdout);
+        Netem(o, fd, to).run();
+        return 0;
+    } catch (const std::exception& ex) {
+        std::cerr << "Fatal: " << ex.what() << "\n";
+        return 2;
+    }
+}
@@ -0,0 +1,238 @@
+// p2preplay: feed a wire recording (RecordTo in Common.cfg) back through the
+// real ConnectionHandler, over in-memory pipes instead of sockets.
+//
+//   p2preplay <recording> [--fast | --speed X] [--out DIR] [--threads N]
+//
+// Each recorded connection gets a handler; the remote's side of it (handshake,
+// then every inbound message in recorded order) is written into its pipe, at
+// recorded pace or as fast as the handlers take it. What the handlers send
+// back is read and counted, so a replay shows how today's piece selection
+// answers yesterday's traffic. Pieces land in DIR (default ./replay).
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "p2p/Logger.hpp"
+#include "p2p/Net.hpp"
+#include "p2p/PieceManager.hpp"
+#include "p2p/Protocol.hpp"
+#include "p2p/Recorder.hpp"
+#include "p2p/Swarm.hpp"
+#include "p2p/WorkPool.hpp"
+
+using namespace p2p;
+
+namespace {
+
+    using Counts = std::array<std::atomic<uint64_t>, 256>;
+
+    // One replayed connection: the handler under test and our end of its pipe.
+    struct Conn {
+        std::unique_ptr<MemoryTransport> remote;
+        std::unique_ptr<ConnectionHandler> handler;
+        std::thread drain;
+        uint32_t swarm = 0;
+        uint32_t caps = 0;
+    };
+
+    // Read (and count) everything the handler sends until the pipe closes.
+    void drainLoop(MemoryTransport& t, Counts& out){
+        std::array<uint8_t, Handshake::LEN> hs{};
+        if (!t.recvAll(hs.data(), hs.size())) return;
+        std::vector<uint8_t> body;
+        for (;;) {
+            uint8_t lenBuf[4];
+            if (!t.recvAll(lenBuf, 4)) return;
+            uint32_t len = (uint32_t(lenBuf[0]) << 24) | (uint32_t(lenBuf[1]) << 16) |
+                           (uint32_t(lenBuf[2]) << 8) | uint32_t(lenBuf[3]);
+            if (len == 0) { out[Recorder::KEEP_ALIVE]++; continue; }
+            body.resize(len);
+            if (!t.recvAll(body.data(), len)) return;
+            out[body[0]]++;
+        }
+    }
+
+    const char* typeName(int t){
+        switch (t) {
+            case 0: return "CHOKE";
+            case 1: return "UNCHOKE";
+            case 2: return "INTERESTED";
+            case 3: return "NOT_INTERESTED";
+            case 4: return "HAVE";
+            case 5: return "BITFIELD";
+            case 6: return "REQUEST";
+            case 7: return "PIECE";
+            case 8: return "HAVE_ALL";
+            case 9: return "HAVE_NONE";
+            case 10: return "BITFIELD_RUNS";
+            case 11: return "PEX";
+            case 12: return "LOCAL_OFFER";
+            case 13: return "TRANSPORT_SWITCH";
+            case 14: return "UDP_OFFER";
+            case 15: return "MANIFEST_REQUEST";
+            case 16: return "MANIFEST";
+            case 17: return "ZERO_PIECES";
+            case Recorder::KEEP_ALIVE: return "KEEP_ALIVE";
+            default: return "?";
+        }
+    }
+
+    void putU32(std::vector<uint8_t>& out, uint32_t v){
+        out.push_back(uint8_t(v >> 24));
+        out.push_back(uint8_t(v >> 16));
+        out.push_back(uint8_t(v >> 8));
+        out.push_back(uint8_t(v));
+    }
+
+} // namespace
+
+int main(int argc, char** argv){
+    if (argc < 2) {
+        std::cerr << "Usage: p2preplay <recording> [--fast | --speed X] [--out DIR] [--threads N]\n";
+        return 1;
+    }
+    std::string path = argv[1];
+    double speed = 1.0;
+    std::string outDir = "replay";
+    int threads = 0;
+    for (int i = 2; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--fast") speed = 0;
+        else if (a == "--speed" && i + 1 < argc) speed = std::stod(argv[++i]);
+        else if (a == "--out" && i + 1 < argc) outDir = argv[++i];
+        else if (a == "--threads" && i + 1 < argc) threads = std::stoi(argv[++i]);
+        else { std::cerr << "Unknown option " << a << "\n"; return 1; }
+    }
+
+    try {
+        RecordReader rec(path);
+        std::filesystem::create_directories(outDir);
+        Logger logger(outDir + "/replay.log");
+
+        // Fresh, empty copies of the recorded swarms.
+        std::map<uint32_t, std::shared_ptr<PieceManager>> swarms;
+        for (const auto& s : rec.swarms()) {
+            auto file = outDir + "/swarm_" + std::to_string(s.id) + ".dat";
+            std::filesystem::remove(file);
+            auto pm = std::make_shared<PieceManager>(file, s.fileSize, s.pieceSize, false);
+            pm->prepareStorage(false);
+            gSwarms.add({s.id, file, pm, nullptr, std::make_shared<DeltaSync>(pm)});
+            swarms[s.id] = pm;
+        }
+        gWorkPool.start(static_cast<size_t>(std::max(0, threads)));
+
+        Counts recordedOut{}, replayedOut{};
+        std::map<uint32_t, Conn> conns;
+        uint64_t msgsIn = 0, bytesIn = 0, synthesized = 0;
+        std::vector<uint8_t> frame;
+
+        auto start = std::chrono::steady_clock::now();
+        RecordReader::Record r;
+        while (rec.next(r)) {
+            if (speed > 0) {
+                std::this_thread::sleep_until(start + std::chrono::microseconds(
+                    static_cast<int64_t>(static_cast<double>(r.tUs) / speed)));
+            }
+
+            if (r.kind == Recorder::OPEN) {
+                auto ends = MemoryTransport::pair();
+                Conn& c = conns[r.conn];
+                c.swarm = r.swarm;
+                c.caps = r.caps;
+                c.remote = std::move(ends.second);
+                // Always the accepting side, so it takes the swarm from the handshake.
+                c.handler = std::make_unique<ConnectionHandler>(rec.selfId(), logger, std::move(ends.first),
+                                                                /*incoming=*/true);
+                c.handler->start();
+                c.drain = std::thread(drainLoop, std::ref(*c.remote), std::ref(replayedOut));
+                auto hs = Handshake::encode(r.remotePeer, r.caps, r.swarm);
+                c.remote->sendAll(hs.data(), hs.size());
+                continue;
+            }
+
+            auto it = conns.find(r.conn);
+            if (it == conns.end()) continue;
+            Conn& c = it->second;
+
+            if (r.kind == Recorder::CLOSE) {
+                c.remote->closeWrite();
+                continue;
+            }
+            if (r.dir == Recorder::OUT) {
+                recordedOut[r.type]++;
+                continue;
+            }
+            // Transport moves, not traffic: the pipe is all there is here.
+            if (r.type == static_cast<uint8_t>(MessageType::LOCAL_OFFER) ||
+                r.type == static_cast<uint8_t>(MessageType::TRANSPORT_SWITCH) ||
+                r.type == static_cast<uint8_t>(MessageType::UDP_OFFER)) {
+                continue;
+            }
+
+            frame.clear();
+            if (r.type == Recorder::KEEP_ALIVE) {
+                putU32(frame, 0);
+            } else if (r.payload.size() + 1 == r.len) {
+                putU32(frame, r.len);
+                frame.push_back(r.type);
+                frame.insert(frame.end(), r.payload.begin(), r.payload.end());
+            } else if (r.type == static_cast<uint8_t>(MessageType::PIECE) && r.index >= 0) {
+                // Recorded without piece data: same header, zeros as raw data.
+                auto pm = swarms.count(c.swarm) ? swarms[c.swarm] : nullptr;
+                if (!pm || static_cast<size_t>(r.index) >= pm->pieceCount()) continue;
+                size_t hdr = (c.caps & CAP_COMPRESSION) ? 5 : 4;
+                size_t size = static_cast<size_t>(pm->pieceSize(static_cast<size_t>(r.index)));
+                putU32(frame, static_cast<uint32_t>(1 + hdr + size));
+                frame.push_back(r.type);
+                putU32(frame, static_cast<uint32_t>(r.index));
+                if (hdr == 5) frame.push_back(static_cast<uint8_t>(PieceCodec::RAW));
+                frame.resize(frame.size() + size, 0);
+                ++synthesized;
+            } else {
+                continue; // payload missing; can't rebuild it
+            }
+            ++msgsIn;
+            bytesIn += frame.size();
+            c.remote->sendAll(frame.data(), frame.size());
+        }
+
+        // Let the handlers finish what they were given (they see EOF once it's
+        // read), then tear down.
+        for (auto& [id, c] : conns) c.remote->closeWrite();
+        for (auto& [id, c] : conns) {
+            while (!c.handler->finished()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            c.remote->shutdown();
+            c.handler.reset();
+            if (c.drain.joinable()) c.drain.join();
+        }
+        gWorkPool.stop();
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::printf("Replayed %zu connection(s), %llu message(s) in, %.1f MB in %.3f s (%.1f MB/s)%s\n",
+                    conns.size(), (unsigned long long)msgsIn, bytesIn / 1e6, secs,
+                    secs > 0 ? bytesIn / 1e6 / secs : 0.0,
+                    synthesized ? " [piece data synthesized]" : "");
+        std::printf("%-16s %10s %10s\n", "sent by us", "recorded", "replayed");
+        for (int t = 0; t < 256; ++t) {
+            if (!recordedOut[t] && !replayedOut[t]) continue;
+            std::printf("%-16s %10llu %10llu\n", typeName(t),
+                        (unsigned long long)recordedOut[t].load(), (unsigned long long)replayedOut[t].load());
+        }
+        for (const auto& [id, pm] : swarms) {
+            std::printf("swarm %u: %zu/%zu pieces\n", id, pm->haveCount(), pm->pieceCount());
+        }
+        return 0;
+    } catch (const std::exception& ex) {
+        std::cerr << "Fatal: " << ex.what() << "\n";
+        return 2;
+    }
+}